@@ -0,0 +1,580 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "ImageAnalysisService.h"
+#include "RawImage.h"
+#include "DistanceMap.h"
+#include "Smoothing.h"
+#include "Morphology.h"
+
+//Benchmarks of every stage of the service, a program of its own (build it with the library sources but
+//without Sample Code.cpp):
+//	Benchmark [--sizes 1,16,200] [--threads 1,0] [--simd scalar,sse2,avx2] [--filter text] [--min-time seconds] [--dir folder]
+//Each stage runs on synthetic images of every size (in megapixels) and thread count, repeated until
+//min-time has passed. It reports the time per call, the throughput in megapixels of the image per second
+//and the heap and cv::Mat allocations per call (on every thread). Stages that have more than one engine, like the
+//fills, region formats, image loaders and the SIMD levels of the classifier, smoothing and distance map,
+//are listed side by side. A stage is only run for the levels it has a kernel for.
+
+//calls of one benchmark stop after this many, even under min-time
+static const int MAX_CALLS = 1000;
+
+//every heap allocation in the process, the benchmark reads the difference around each call.
+//operator new is replaced in all its forms, so every new and delete pair goes through malloc and free
+static std::atomic<size_t> g_allocations{ 0 };
+
+//gcc warns about free on memory from operator new once a replaced delete is inlined into its caller,
+//so the frees stay behind a call it does not see through
+#if defined(__GNUC__)
+#define IAS_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define IAS_NOINLINE __declspec(noinline)
+#else
+#define IAS_NOINLINE
+#endif
+
+static void* Counted_Malloc(size_t size)
+{
+	++g_allocations;
+	return malloc((size != 0) ? size : 1);
+}
+
+static IAS_NOINLINE void Counted_Free(void *p)
+{
+	free(p);
+}
+
+void* operator new(size_t size)
+{
+	void *p = Counted_Malloc(size);
+	if (p == nullptr)
+		throw std::bad_alloc();
+	return p;
+}
+
+void* operator new[](size_t size)
+{
+	void *p = Counted_Malloc(size);
+	if (p == nullptr)
+		throw std::bad_alloc();
+	return p;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	return Counted_Malloc(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+	return Counted_Malloc(size);
+}
+
+void operator delete(void *p) noexcept
+{
+	Counted_Free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+	Counted_Free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	Counted_Free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+	Counted_Free(p);
+}
+
+void operator delete(void *p, const std::nothrow_t&) noexcept
+{
+	Counted_Free(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t&) noexcept
+{
+	Counted_Free(p);
+}
+
+//cv::Mat buffers come from cv::fastMalloc rather than operator new, so every Mat the process allocates is
+//counted by wrapping OpenCV's default allocator. The buffers are still allocated and freed by that allocator
+#if (CV_VERSION_MAJOR > 3) || ((CV_VERSION_MAJOR == 3) && (CV_VERSION_MINOR >= 2))
+#define IAS_COUNT_MAT_ALLOCATIONS
+#if CV_VERSION_MAJOR >= 4
+typedef cv::AccessFlag MatAccessFlag;
+#else
+typedef int MatAccessFlag;
+#endif
+
+class CountingMatAllocator : public cv::MatAllocator
+{
+private:
+	const cv::MatAllocator *m_allocator;
+
+public:
+	explicit CountingMatAllocator(const cv::MatAllocator *allocator) : m_allocator(allocator)
+	{
+	}
+
+	cv::UMatData* allocate(int dims, const int *sizes, int type, void *data, size_t *step, MatAccessFlag flags, cv::UMatUsageFlags usageFlags) const override
+	{
+		//a Mat over memory it does not own allocates no buffer
+		if (data == nullptr)
+			++g_allocations;
+		return m_allocator->allocate(dims, sizes, type, data, step, flags, usageFlags);
+	}
+
+	bool allocate(cv::UMatData *data, MatAccessFlag accessFlags, cv::UMatUsageFlags usageFlags) const override
+	{
+		return m_allocator->allocate(data, accessFlags, usageFlags);
+	}
+
+	void deallocate(cv::UMatData *data) const override
+	{
+		m_allocator->deallocate(data);
+	}
+};
+#endif
+
+struct BenchmarkOptions
+{
+	std::vector<double> sizes;
+	std::vector<int> threads;
+	std::vector<SimdLevel> simdLevels;
+	std::string filter;
+	double minTime = 0.5;
+	std::string dir = ".";
+};
+
+//the pool the service uses for a thread count, for the kernels timed without a service
+static ThreadPool& Pool_For(int threads, std::unique_ptr<ThreadPool> &own)
+{
+	if (threads == 0)
+		return ThreadPool::Shared();
+	own.reset(new ThreadPool(threads));
+	return *own;
+}
+
+//a synthetic image and the seed that grows its region of interest
+struct Scene
+{
+	std::string name;
+	cv::Mat image;
+	int seedX;
+	int seedY;
+	int tolerance;
+};
+
+static void Fill_Rect(cv::Mat &image, int top, int left, int bottom, int right, const cv::Vec3b &colour)
+{
+	top = std::max(top, 0);
+	left = std::max(left, 0);
+	bottom = std::min(bottom, image.rows - 1);
+	right = std::min(right, image.cols - 1);
+	for (int r = top; r <= bottom; ++r)
+	{
+		cv::Vec3b *row = image.ptr<cv::Vec3b>(r);
+		for (int c = left; c <= right; ++c)
+			row[c] = colour;
+	}
+}
+
+//one colour, the region is the whole image
+static Scene Make_Uniform(int width, int height)
+{
+	Scene scene = { "uniform", cv::Mat(height, width, CV_8UC3), width / 2, height / 2, 10 };
+	Fill_Rect(scene.image, 0, 0, height - 1, width - 1, cv::Vec3b(120, 130, 140));
+	return scene;
+}
+
+//one colour with noise a little larger than the tolerance, so about two thirds of the pixels are in and the
+//region is ragged and full of holes
+static Scene Make_Noisy(int width, int height)
+{
+	Scene scene = { "noisy", cv::Mat(height, width, CV_8UC3), width / 2, height / 2, 16 };
+	std::mt19937 random(12345);
+	std::uniform_int_distribution<int> noise(-17, 17);
+	for (int r = 0; r < height; ++r)
+	{
+		cv::Vec3b *row = scene.image.ptr<cv::Vec3b>(r);
+		for (int c = 0; c < width; ++c)
+			row[c] = cv::Vec3b((uchar)(120 + noise(random)), (uchar)(130 + noise(random)), (uchar)(140 + noise(random)));
+	}
+	//the seed gets the base colour, so the noise is spread evenly around it
+	scene.image.ptr<cv::Vec3b>(scene.seedY)[scene.seedX] = cv::Vec3b(120, 130, 140);
+	return scene;
+}
+
+//8 pixel squares of two colours that are both inside the tolerance, every row changes colour every few pixels
+static Scene Make_Checkerboard(int width, int height)
+{
+	Scene scene = { "checkerboard", cv::Mat(height, width, CV_8UC3), width / 2, height / 2, 24 };
+	for (int r = 0; r < height; ++r)
+	{
+		cv::Vec3b *row = scene.image.ptr<cv::Vec3b>(r);
+		for (int c = 0; c < width; ++c)
+			row[c] = (((r >> 3) + (c >> 3)) & 1) ? cv::Vec3b(100, 110, 120) : cv::Vec3b(120, 130, 140);
+	}
+	return scene;
+}
+
+//a single corridor winding in to the centre, the worst case for the fills: runs are short, the region
+//is long and thin, and its perimeter is about as long as it can be. Corridors and walls are 4 pixels wide,
+//so the 3 x 3 opening and closing leave them as they are
+static Scene Make_Spiral(int width, int height)
+{
+	const int CORRIDOR = 4;
+	const int WALL = 4;
+	const int PITCH = CORRIDOR + WALL;
+	const cv::Vec3b open(200, 200, 200);
+
+	Scene scene = { "spiral", cv::Mat(height, width, CV_8UC3), WALL, WALL, 10 };
+	Fill_Rect(scene.image, 0, 0, height - 1, width - 1, cv::Vec3b(40, 40, 40));
+
+	//each turn draws the top, right, bottom and left sides, the left side stops short of the top one and
+	//joins the next turn's top side instead
+	int top = WALL, left = WALL, bottom = height - WALL - CORRIDOR, right = width - WALL - CORRIDOR;
+	while ((top <= bottom) && (left <= right))
+	{
+		Fill_Rect(scene.image, top, left, top + CORRIDOR - 1, right + CORRIDOR - 1, open);
+		Fill_Rect(scene.image, top, right, bottom + CORRIDOR - 1, right + CORRIDOR - 1, open);
+		if (bottom - top >= PITCH)
+		{
+			Fill_Rect(scene.image, bottom, left, bottom + CORRIDOR - 1, right + CORRIDOR - 1, open);
+			Fill_Rect(scene.image, top + PITCH, left, bottom + CORRIDOR - 1, left + CORRIDOR - 1, open);
+			Fill_Rect(scene.image, top + PITCH, left, top + PITCH + CORRIDOR - 1, left + PITCH + CORRIDOR - 1, open);
+		}
+		top += PITCH;
+		left += PITCH;
+		bottom -= PITCH;
+		right -= PITCH;
+	}
+	return scene;
+}
+
+static bool Is_Selected(const BenchmarkOptions &options, const std::string &name)
+{
+	return options.filter.empty() || (name.find(options.filter) != std::string::npos);
+}
+
+//runs body until minTime has passed and prints the time, throughput and allocations per call.
+//setup runs before every call and is not timed
+static void Run_Benchmark(const BenchmarkOptions &options, const std::string &name, double megapixels,
+	const std::function<void()> &setup, const std::function<bool()> &body)
+{
+	if (!Is_Selected(options, name))
+		return;
+
+	double elapsed = 0;
+	size_t allocations = 0;
+	int calls = 0;
+	bool isOk = true;
+	do
+	{
+		if (setup)
+			setup();
+		size_t before = g_allocations;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		isOk = body() && isOk;
+		elapsed += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		allocations += g_allocations - before;
+		++calls;
+	} while ((elapsed < options.minTime) && (calls < MAX_CALLS));
+
+	double perCall = elapsed / calls;
+	printf("%-56s %12.3f ms %10.1f MP/s %12.1f allocs %8d calls%s\n", name.c_str(), perCall * 1000,
+		(perCall > 0) ? megapixels / perCall : 0.0, (double)allocations / calls, calls, isOk ? "" : "  FAILED");
+	fflush(stdout);
+}
+
+static const char* Simd_Name(SimdLevel level)
+{
+	const char *names[] = { "scalar", "sse2", "avx2" };
+	return names[level];
+}
+
+static std::string Size_Name(double megapixels)
+{
+	std::ostringstream name;
+	name << megapixels << "MP";
+	return name.str();
+}
+
+//INITIALIZE with each loader: decoding the image file, mapping the raw cache written next to it, and streaming a raw image
+static void Run_Load_Benchmarks(const BenchmarkOptions &options, const Scene &scene, const std::string &suffix, double megapixels)
+{
+	const std::string names[] = { "INITIALIZE/decode/" + suffix, "INITIALIZE/raw_cache/" + suffix, "INITIALIZE/stream+FIND_REGION/" + suffix };
+	if (!Is_Selected(options, names[0]) && !Is_Selected(options, names[1]) && !Is_Selected(options, names[2]))
+		return;
+
+	std::string imagePath = options.dir + "/benchmark_" + scene.name + ".png";
+	std::string cachePath = imagePath + RAW_IMAGE_EXTENSION;
+	std::string rawPath = options.dir + "/benchmark_" + scene.name + RAW_IMAGE_EXTENSION;
+	if (!cv::imwrite(imagePath, scene.image) || !Write_Raw_Image(rawPath, scene.image))
+	{
+		printf("INITIALIZE/%s: could not write the images to %s\n", suffix.c_str(), options.dir.c_str());
+		return;
+	}
+
+	//the service lets go of the mapping before the files go
+	{
+		ImageAnalysisService service;
+		service.SET_CACHE_LIMIT(0);
+		service.SET_RAW_CACHE(false);
+		Run_Benchmark(options, names[0], megapixels, nullptr, [&]()
+		{
+			return service.INITIALIZE(imagePath) == Status::SUCCESS;
+		});
+
+		//the first load writes the cache, the timed ones map it
+		service.SET_RAW_CACHE(true);
+		service.INITIALIZE(imagePath);
+		Run_Benchmark(options, names[1], megapixels, nullptr, [&]()
+		{
+			return service.INITIALIZE(imagePath) == Status::SUCCESS;
+		});
+		service.SET_RAW_CACHE(false);
+
+		//a streamed image reads its rows when they are first needed, so the load is timed with a fill over all of them
+		Run_Benchmark(options, names[2], megapixels, nullptr, [&]()
+		{
+			return (service.INITIALIZE(rawPath) == Status::SUCCESS)
+				&& (service.FIND_REGION(scene.seedX, scene.seedY, scene.tolerance) == Status::SUCCESS);
+		});
+	}
+	remove(imagePath.c_str());
+	remove(cachePath.c_str());
+	remove(rawPath.c_str());
+}
+
+static void Run_Scene_Benchmarks(const BenchmarkOptions &options, const Scene &scene, const std::string &sizeName, double megapixels, int threads)
+{
+	//levels the cpu can not run are left out rather than timed at a lower one
+	std::vector<SimdLevel> levels;
+	for (size_t l = 0; l < options.simdLevels.size(); ++l)
+		if (options.simdLevels[l] <= Detect_Simd_Level())
+			levels.push_back(options.simdLevels[l]);
+
+	std::string suffix = scene.name + "/" + sizeName + "/threads:" + std::to_string(threads);
+	int width = scene.image.cols;
+	int height = scene.image.rows;
+
+	ImageAnalysisService service;
+	service.SET_THREAD_COUNT(threads);
+	//every call has to do its work, not find it in the cache or resume the fill before it
+	service.SET_CACHE_LIMIT(0);
+	service.SET_FILL_RESUME(false);
+	service.LOAD_IMAGE(scene.image);
+	std::unique_ptr<ThreadPool> ownPool;
+	ThreadPool &pool = Pool_For(threads, ownPool);
+	if (service.FIND_REGION(scene.seedX, scene.seedY, scene.tolerance) != Status::SUCCESS)
+	{
+		printf("%s: the seed does not grow a region\n", suffix.c_str());
+		return;
+	}
+
+	//the fills on their own, the ones on the candidate mask with each level of the row classifier
+	const FillMode modes[] = { FillMode::FORREST_FIRE, FillMode::SCANLINE, FillMode::PARALLEL };
+	const char *modeNames[] = { "forrest_fire", "scanline", "parallel" };
+	Run_Benchmark(options, std::string("FILL/") + modeNames[0] + "/" + suffix, megapixels, nullptr, [&]()
+	{
+		return service.GROW_FILL(scene.seedX, scene.seedY, scene.tolerance, modes[0]) == Status::SUCCESS;
+	});
+	for (size_t l = 0; l < levels.size(); ++l)
+	{
+		service.SET_SIMD_LEVEL(levels[l]);
+		for (int m = 1; m < 3; ++m)
+			Run_Benchmark(options, std::string("FILL/") + modeNames[m] + "/" + suffix + "/simd:" + Simd_Name(levels[l]), megapixels, nullptr, [&]()
+			{
+				return service.GROW_FILL(scene.seedX, scene.seedY, scene.tolerance, modes[m]) == Status::SUCCESS;
+			});
+	}
+	service.SET_SIMD_LEVEL(Detect_Simd_Level());
+
+	//the distance map of BUILD_LEVEL_MAP with each level it has a kernel for, sse2 would time the scalar loop again
+	cv::Mat distance;
+	cv::Vec3b seedColour = scene.image.ptr<cv::Vec3b>(scene.seedY)[scene.seedX];
+	for (size_t l = 0; l < levels.size(); ++l)
+		if (levels[l] != SIMD_SSE2)
+			Run_Benchmark(options, "DISTANCE_MAP/" + suffix + "/simd:" + Simd_Name(levels[l]), megapixels, nullptr, [&]()
+			{
+				Build_Distance_Map(scene.image, seedColour, distance, &pool, levels[l]);
+				return true;
+			});
+
+	//whole FIND_REGION (fill, opening, closing and statistics) with each region format
+	const RegionFormat formats[] = { RegionFormat::PACKED_MASK, RegionFormat::RUN_LENGTH };
+	const char *formatNames[] = { "mask", "runs" };
+	for (int f = 0; f < 2; ++f)
+	{
+		service.SET_REGION_FORMAT(formats[f]);
+		Run_Benchmark(options, std::string("FIND_REGION/") + formatNames[f] + "/" + suffix, megapixels, nullptr, [&]()
+		{
+			return service.FIND_REGION(scene.seedX, scene.seedY, scene.tolerance) == Status::SUCCESS;
+		});
+		Run_Benchmark(options, std::string("FIND_PERIMETER/") + formatNames[f] + "/" + suffix, megapixels, nullptr, [&]()
+		{
+			return service.FIND_PERIMETER() == Status::SUCCESS;
+		});
+	}
+	service.SET_REGION_FORMAT(RegionFormat::PACKED_MASK);
+	service.FIND_REGION(scene.seedX, scene.seedY, scene.tolerance);
+
+	//morphology of the region over the whole image, for each kernel size
+	cv::Mat regionImage;
+	service.GET_PIXELS(OutputImageType::REGION, regionImage);
+	BinaryMask region, morphed(width, height);
+	region.From_Mat(regionImage);
+	cv::Rect whole(0, 0, width, height);
+	const int kernels[] = { 3, 15 };
+	for (int k = 0; k < 2; ++k)
+	{
+		std::string kernel = std::to_string(kernels[k]) + "x" + std::to_string(kernels[k]);
+		Run_Benchmark(options, "EROSION/" + kernel + "/" + suffix, megapixels, nullptr, [&]()
+		{
+			Erode_Rect(region, morphed, kernels[k], kernels[k], whole, &pool);
+			return true;
+		});
+		Run_Benchmark(options, "DILATION/" + kernel + "/" + suffix, megapixels, nullptr, [&]()
+		{
+			Dilate_Rect(region, morphed, kernels[k], kernels[k], whole, &pool);
+			return true;
+		});
+	}
+
+	//the smoothing filter over the whole perimeter image with each level, the small kernels use taps and the large one box passes
+	service.FIND_PERIMETER();
+	cv::Mat perimeter, smoothed = cv::Mat::zeros(height, width, CV_8UC1);
+	service.GET_PIXELS(OutputImageType::PERIMETER, perimeter);
+	const int smoothingSizes[] = { 3, 15, 31 };
+	for (int s = 0; s < 3; ++s)
+	{
+		SmoothingKernel smoothing = Make_Smoothing_Kernel(smoothingSizes[s], 0);
+		for (size_t l = 0; l < levels.size(); ++l)
+			Run_Benchmark(options, "SMOOTHING/" + std::to_string(smoothingSizes[s]) + "/" + suffix + "/simd:" + Simd_Name(levels[l]), megapixels, nullptr, [&]()
+			{
+				Gaussian_Smooth(perimeter, smoothed, smoothing, whole, &pool, nullptr, levels[l]);
+				return true;
+			});
+	}
+}
+
+static bool Parse_Simd_Levels(const std::string &text, std::vector<SimdLevel> &levels)
+{
+	levels.clear();
+	std::stringstream stream(text);
+	std::string item;
+	while (std::getline(stream, item, ','))
+	{
+		if (item == "scalar")
+			levels.push_back(SIMD_SCALAR);
+		else if (item == "sse2")
+			levels.push_back(SIMD_SSE2);
+		else if (item == "avx2")
+			levels.push_back(SIMD_AVX2);
+		else
+			return false;
+	}
+	return !levels.empty();
+}
+
+static bool Parse_List(const std::string &text, std::vector<double> &values)
+{
+	values.clear();
+	std::stringstream stream(text);
+	std::string item;
+	while (std::getline(stream, item, ','))
+	{
+		char *end = nullptr;
+		double value = strtod(item.c_str(), &end);
+		if ((end == item.c_str()) || (value < 0))
+			return false;
+		values.push_back(value);
+	}
+	return !values.empty();
+}
+
+int main(int argc, char **argv)
+{
+	BenchmarkOptions options;
+	options.sizes.push_back(1);
+	options.sizes.push_back(16);
+	options.threads.push_back(0);
+	options.simdLevels.push_back(Detect_Simd_Level());
+
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		bool hasValue = (i + 1 < argc);
+		std::vector<double> values;
+		std::vector<SimdLevel> levels;
+		if ((arg == "--sizes") && hasValue && Parse_List(argv[++i], values))
+			options.sizes = values;
+		else if ((arg == "--threads") && hasValue && Parse_List(argv[++i], values))
+			options.threads.assign(values.begin(), values.end());
+		else if ((arg == "--simd") && hasValue && Parse_Simd_Levels(argv[++i], levels))
+			options.simdLevels = levels;
+		else if ((arg == "--filter") && hasValue)
+			options.filter = argv[++i];
+		else if ((arg == "--min-time") && hasValue)
+			options.minTime = atof(argv[++i]);
+		else if ((arg == "--dir") && hasValue)
+			options.dir = argv[++i];
+		else
+		{
+			printf("usage: Benchmark [--sizes 1,16,200] [--threads 1,0] [--simd scalar,sse2,avx2] [--filter text] [--min-time seconds] [--dir folder]\n"
+				"sizes are in megapixels, thread count 0 uses one thread per core, simd defaults to the best level of this cpu\n");
+			return 1;
+		}
+	}
+
+#ifdef IAS_COUNT_MAT_ALLOCATIONS
+	static CountingMatAllocator matAllocator(cv::Mat::getDefaultAllocator());
+	cv::Mat::setDefaultAllocator(&matAllocator);
+#else
+	printf("this OpenCV can not replace the default Mat allocator, the allocations leave out cv::Mat buffers\n");
+#endif
+
+	typedef Scene(*SceneMaker)(int, int);
+	const SceneMaker makers[] = { Make_Uniform, Make_Noisy, Make_Checkerboard, Make_Spiral };
+
+	for (size_t l = 0; l < options.simdLevels.size(); ++l)
+		if (options.simdLevels[l] > Detect_Simd_Level())
+			printf("simd:%s is not supported by this cpu and is skipped\n", Simd_Name(options.simdLevels[l]));
+	if (std::find(options.simdLevels.begin(), options.simdLevels.end(), SIMD_SSE2) != options.simdLevels.end())
+		printf("DISTANCE_MAP has no sse2 kernel and is not run for simd:sse2\n");
+
+	printf("%-56s %15s %15s %19s %14s\n", "Benchmark", "Time", "Throughput", "Allocations", "Calls");
+	for (size_t s = 0; s < options.sizes.size(); ++s)
+	{
+		//4:3 images of the requested size
+		double megapixels = options.sizes[s];
+		int width = std::max(16, (int)std::lround(std::sqrt(megapixels * 1e6 * 4 / 3)));
+		int height = std::max(16, (int)std::lround(megapixels * 1e6 / width));
+		double actual = (double)width * height / 1e6;
+
+		for (int m = 0; m < 4; ++m)
+		{
+			Scene scene = makers[m](width, height);
+			Run_Load_Benchmarks(options, scene, scene.name + "/" + Size_Name(megapixels), actual);
+			for (size_t t = 0; t < options.threads.size(); ++t)
+				Run_Scene_Benchmarks(options, scene, Size_Name(megapixels), actual, options.threads[t]);
+		}
+	}
+	return 0;
+}
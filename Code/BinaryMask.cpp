@@ -0,0 +1,338 @@
+#include "BinaryMask.h"
+
+//8 bits of a mask word to 8 bytes of 0 or 255
+struct ByteExpandTable
+{
+	uint64_t bytes[256];
+	ByteExpandTable()
+	{
+		for (int i = 0; i < 256; ++i)
+		{
+			bytes[i] = 0;
+			for (int b = 0; b < 8; ++b)
+				if (i & (1 << b))
+					bytes[i] |= 0xFFULL << (8 * b);
+		}
+	}
+};
+
+static const ByteExpandTable BYTE_EXPAND_TABLE;
+
+BinaryMask::BinaryMask()
+{
+}
+
+BinaryMask::BinaryMask(int width, int height)
+{
+	Create(width, height);
+}
+
+void BinaryMask::Create(int width, int height)
+{
+	m_width = width;
+	m_height = height;
+	m_wordsPerRow = ::Words_Per_Row(width);
+	m_words.assign((size_t)m_wordsPerRow * height, 0);
+	m_isPaged = false;
+	std::vector<std::vector<uint64_t>>().swap(m_pages);
+	m_pageCount = 0;
+	std::vector<uint64_t>().swap(m_zeroRow);
+}
+
+void BinaryMask::Create_Paged(int width, int height)
+{
+	m_width = width;
+	m_height = height;
+	m_wordsPerRow = ::Words_Per_Row(width);
+	std::vector<uint64_t>().swap(m_words);
+	m_isPaged = true;
+	m_pages.clear();
+	m_pages.resize((height + MASK_PAGE_ROWS - 1) / MASK_PAGE_ROWS);
+	m_pageCount = 0;
+	m_zeroRow.assign(m_wordsPerRow, 0);
+}
+
+bool BinaryMask::Is_Paged() const
+{
+	return m_isPaged;
+}
+
+void BinaryMask::Allocate(const cv::Rect &area)
+{
+	cv::Rect bounds = area & cv::Rect(0, 0, m_width, m_height);
+	if (!m_isPaged || bounds.empty())
+		return;
+	for (int page = bounds.y / MASK_PAGE_ROWS; page <= (bounds.y + bounds.height - 1) / MASK_PAGE_ROWS; ++page)
+		Row(page * MASK_PAGE_ROWS);
+}
+
+bool BinaryMask::Has_Row(int row) const
+{
+	return !m_isPaged || !m_pages[row / MASK_PAGE_ROWS].empty();
+}
+
+void BinaryMask::Clear()
+{
+	if (m_isPaged)
+	{
+		for (size_t page = 0; page < m_pages.size(); ++page)
+			std::vector<uint64_t>().swap(m_pages[page]);
+		m_pageCount = 0;
+		return;
+	}
+	std::fill(m_words.begin(), m_words.end(), 0);
+}
+
+void BinaryMask::Clear(const cv::Rect &area)
+{
+	cv::Rect bounds = area & cv::Rect(0, 0, m_width, m_height);
+	if (bounds.empty())
+		return;
+
+	int firstWord = bounds.x >> 6;
+	int lastWord = (bounds.x + bounds.width - 1) >> 6;
+	uint64_t firstBits = ~0ULL << (bounds.x & 63);
+	uint64_t lastBits = (2ULL << ((bounds.x + bounds.width - 1) & 63)) - 1;
+
+	for (int i = bounds.y; i < bounds.y + bounds.height; ++i)
+	{
+		//pages not allocated are already clear
+		if (!Has_Row(i))
+			continue;
+		uint64_t *words = Row(i);
+		if (firstWord == lastWord)
+		{
+			words[firstWord] &= ~(firstBits & lastBits);
+			continue;
+		}
+		words[firstWord] &= ~firstBits;
+		for (int w = firstWord + 1; w < lastWord; ++w)
+			words[w] = 0;
+		words[lastWord] &= ~lastBits;
+	}
+}
+
+int BinaryMask::Width() const
+{
+	return m_width;
+}
+
+int BinaryMask::Height() const
+{
+	return m_height;
+}
+
+int BinaryMask::Words_Per_Row() const
+{
+	return m_wordsPerRow;
+}
+
+bool BinaryMask::Empty() const
+{
+	return m_isPaged ? m_pages.empty() : m_words.empty();
+}
+
+uint64_t* BinaryMask::Row(int row)
+{
+	if (!m_isPaged)
+		return &m_words[(size_t)row * m_wordsPerRow];
+
+	std::vector<uint64_t> &page = m_pages[row / MASK_PAGE_ROWS];
+	if (page.empty())
+	{
+		page.assign((size_t)MASK_PAGE_ROWS * m_wordsPerRow, 0);
+		++m_pageCount;
+	}
+	return &page[(size_t)(row % MASK_PAGE_ROWS) * m_wordsPerRow];
+}
+
+const uint64_t* BinaryMask::Row(int row) const
+{
+	if (!m_isPaged)
+		return &m_words[(size_t)row * m_wordsPerRow];
+
+	const std::vector<uint64_t> &page = m_pages[row / MASK_PAGE_ROWS];
+	return page.empty() ? m_zeroRow.data() : &page[(size_t)(row % MASK_PAGE_ROWS) * m_wordsPerRow];
+}
+
+bool BinaryMask::Get(int row, int col) const
+{
+	return ((Row(row)[col >> 6] >> (col & 63)) & 1) != 0;
+}
+
+void BinaryMask::Set(int row, int col)
+{
+	Row(row)[col >> 6] |= 1ULL << (col & 63);
+}
+
+void BinaryMask::Set_Run(int row, int first, int last)
+{
+	uint64_t *words = Row(row);
+	int firstWord = first >> 6;
+	int lastWord = last >> 6;
+	uint64_t firstBits = ~0ULL << (first & 63);
+	uint64_t lastBits = (2ULL << (last & 63)) - 1;
+
+	if (firstWord == lastWord)
+	{
+		words[firstWord] |= firstBits & lastBits;
+		return;
+	}
+	words[firstWord] |= firstBits;
+	for (int w = firstWord + 1; w < lastWord; ++w)
+		words[w] = ~0ULL;
+	words[lastWord] |= lastBits;
+}
+
+//64 bits of a row starting at column col, bits past the row are 0
+static uint64_t Read_Bits(const uint64_t *words, int wordsPerRow, int col)
+{
+	int w = col >> 6;
+	int shift = col & 63;
+	uint64_t bits = words[w] >> shift;
+	if ((shift != 0) && (w + 1 < wordsPerRow))
+		bits |= words[w + 1] << (64 - shift);
+	return bits;
+}
+
+void BinaryMask::Copy_Rect(const BinaryMask &src, const cv::Rect &srcArea, int dstX, int dstY)
+{
+	for (int i = 0; i < srcArea.height; ++i)
+	{
+		const uint64_t *ipWords = src.Row(srcArea.y + i);
+		uint64_t *opWords = Row(dstY + i);
+		int done = 0;
+		while (done < srcArea.width)
+		{
+			//fill the rest of the current destination word
+			int col = dstX + done;
+			int count = std::min(64 - (col & 63), srcArea.width - done);
+			uint64_t keep = ((count == 64) ? ~0ULL : ((1ULL << count) - 1)) << (col & 63);
+			uint64_t bits = Read_Bits(ipWords, src.m_wordsPerRow, srcArea.x + done) << (col & 63);
+			opWords[col >> 6] = (opWords[col >> 6] & ~keep) | (bits & keep);
+			done += count;
+		}
+	}
+}
+
+void BinaryMask::Crop(const BinaryMask &src, const cv::Rect &area)
+{
+	Create(area.width, area.height);
+	Copy_Rect(src, area, 0, 0);
+}
+
+size_t BinaryMask::Bytes() const
+{
+	if (m_isPaged)
+		return (m_pageCount * MASK_PAGE_ROWS + 1) * m_wordsPerRow * sizeof(uint64_t);
+	return m_words.size() * sizeof(uint64_t);
+}
+
+int BinaryMask::Count(const cv::Rect &area) const
+{
+	cv::Rect bounds = area & cv::Rect(0, 0, m_width, m_height);
+	if (bounds.empty())
+		return 0;
+
+	int firstWord = bounds.x >> 6;
+	int lastWord = (bounds.x + bounds.width - 1) >> 6;
+	uint64_t firstBits = ~0ULL << (bounds.x & 63);
+	uint64_t lastBits = (2ULL << ((bounds.x + bounds.width - 1) & 63)) - 1;
+	int count = 0;
+
+	for (int i = bounds.y; i < bounds.y + bounds.height; ++i)
+	{
+		const uint64_t *words = Row(i);
+		for (int w = firstWord; w <= lastWord; ++w)
+		{
+			uint64_t bits = words[w];
+			if (w == firstWord)
+				bits &= firstBits;
+			if (w == lastWord)
+				bits &= lastBits;
+			count += Count_Set_Bits(bits);
+		}
+	}
+	return count;
+}
+
+cv::Rect BinaryMask::Bounding_Box(const cv::Rect &area) const
+{
+	cv::Rect bounds = area & cv::Rect(0, 0, m_width, m_height);
+	if (bounds.empty())
+		return cv::Rect();
+
+	int firstWord = bounds.x >> 6;
+	int lastWord = (bounds.x + bounds.width - 1) >> 6;
+	uint64_t firstBits = ~0ULL << (bounds.x & 63);
+	uint64_t lastBits = (2ULL << ((bounds.x + bounds.width - 1) & 63)) - 1;
+	int top = -1, bottom = -1, left = m_width, right = -1;
+
+	for (int i = bounds.y; i < bounds.y + bounds.height; ++i)
+	{
+		const uint64_t *words = Row(i);
+		for (int w = firstWord; w <= lastWord; ++w)
+		{
+			uint64_t bits = words[w];
+			if (w == firstWord)
+				bits &= firstBits;
+			if (w == lastWord)
+				bits &= lastBits;
+			if (bits == 0)
+				continue;
+
+			if (top < 0)
+				top = i;
+			bottom = i;
+			left = std::min(left, (w << 6) + Lowest_Set_Bit(bits));
+			right = std::max(right, (w << 6) + Highest_Set_Bit(bits));
+		}
+	}
+
+	if (top < 0)
+		return cv::Rect();
+	return cv::Rect(left, top, right - left + 1, bottom - top + 1);
+}
+
+void BinaryMask::To_Mat(cv::Mat &opImage) const
+{
+	opImage.create(m_height, m_width, CV_8UC1);
+	for (int i = 0; i < m_height; ++i)
+	{
+		const uint64_t *words = Row(i);
+		uchar *opPixel = opImage.ptr<uchar>(i);
+		for (int j = 0; j < m_width; j += 8)
+		{
+			uint64_t bytes = BYTE_EXPAND_TABLE.bytes[(words[j >> 6] >> (j & 63)) & 0xFF];
+			if (j + 8 <= m_width)
+				memcpy(opPixel + j, &bytes, 8);
+			else
+				memcpy(opPixel + j, &bytes, m_width - j);
+		}
+	}
+}
+
+void BinaryMask::To_Mat(cv::Mat &opImage, const cv::Rect &area) const
+{
+	cv::Rect bounds = area & cv::Rect(0, 0, m_width, m_height);
+	for (int i = bounds.y; i < bounds.y + bounds.height; ++i)
+	{
+		const uint64_t *words = Row(i);
+		uchar *opPixel = opImage.ptr<uchar>(i);
+		for (int j = bounds.x; j < bounds.x + bounds.width; ++j)
+			opPixel[j] = ((words[j >> 6] >> (j & 63)) & 1) ? 255 : 0;
+	}
+}
+
+void BinaryMask::From_Mat(const cv::Mat &ipImage)
+{
+	Create(ipImage.cols, ipImage.rows);
+	for (int i = 0; i < m_height; ++i)
+	{
+		const uchar *ipPixel = ipImage.ptr<uchar>(i);
+		uint64_t *words = Row(i);
+		for (int j = 0; j < m_width; ++j)
+			if (ipPixel[j] != 0)
+				words[j >> 6] |= 1ULL << (j & 63);
+	}
+}
@@ -0,0 +1,79 @@
+#ifndef BINARY_MASK_H
+#define BINARY_MASK_H
+
+#include <stdint.h>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "BitOps.h"
+
+//rows in one page of a paged mask
+static const int MASK_PAGE_ROWS = 16;
+
+//Bit packed binary image, 64 pixels per word.
+//Pixel (row, col) is bit (col % 64) of word (col / 64) of the row, bits past the width are always 0.
+//This is the working representation for region and perimeter masks, they are only expanded to
+//CV_8UC1 0/255 images when they have to be shown or saved.
+//A paged mask holds its rows in pages of MASK_PAGE_ROWS, a page is allocated the first time one of its rows is
+//written and reads of the others see zeros, so it only costs the rows its pixels were set in.
+class BinaryMask
+{
+private:
+	int m_width = 0;
+	int m_height = 0;
+	int m_wordsPerRow = 0;
+	std::vector<uint64_t> m_words;
+	bool m_isPaged = false;
+	std::vector<std::vector<uint64_t>> m_pages;
+	size_t m_pageCount = 0;
+	std::vector<uint64_t> m_zeroRow;
+
+	bool Has_Row(int row) const;
+
+public:
+	BinaryMask();
+	BinaryMask(int width, int height);
+
+	//allocates width x height and clears it
+	void Create(int width, int height);
+	//width x height without any page allocated yet
+	void Create_Paged(int width, int height);
+	bool Is_Paged() const;
+	//allocates the pages holding the rows of area, so they can then be written from several threads
+	void Allocate(const cv::Rect &area);
+	//a paged mask gives all its pages back
+	void Clear();
+	//clears only the pixels inside area
+	void Clear(const cv::Rect &area);
+
+	int Width() const;
+	int Height() const;
+	int Words_Per_Row() const;
+	bool Empty() const;
+
+	uint64_t* Row(int row);
+	const uint64_t* Row(int row) const;
+	bool Get(int row, int col) const;
+	void Set(int row, int col);
+	//sets columns first..last (inclusive) of a row
+	void Set_Run(int row, int first, int last);
+
+	//copies srcArea of src so its top left lands on (dstX, dstY), both rectangles must be inside the masks
+	void Copy_Rect(const BinaryMask &src, const cv::Rect &srcArea, int dstX, int dstY);
+	//becomes a copy of area of src, area.width x area.height
+	void Crop(const BinaryMask &src, const cv::Rect &area);
+	//bytes held by the bits, the allocated pages of a paged mask
+	size_t Bytes() const;
+
+	//number of set pixels inside area
+	int Count(const cv::Rect &area) const;
+	//smallest rectangle holding every set pixel inside area, empty if there are none
+	cv::Rect Bounding_Box(const cv::Rect &area) const;
+
+	//conversion to and from CV_8UC1, any non zero byte is a set pixel
+	void To_Mat(cv::Mat &opImage) const;
+	//expands only the pixels inside area into an already allocated width x height CV_8UC1 image
+	void To_Mat(cv::Mat &opImage, const cv::Rect &area) const;
+	void From_Mat(const cv::Mat &ipImage);
+};
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef BIT_OPS_H
+#define BIT_OPS_H
+
+#include <stdint.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+//number of 64 bit words needed to hold one row of a bit mask
+inline int Words_Per_Row(int width)
+{
+	return (width + 63) / 64;
+}
+
+//index of the lowest set bit, word must not be zero
+inline int Lowest_Set_Bit(uint64_t word)
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+	unsigned long index;
+	_BitScanForward64(&index, word);
+	return (int)index;
+#elif defined(_MSC_VER)
+	//32 bit builds only have the 32 bit scans
+	unsigned long index;
+	if (_BitScanForward(&index, (unsigned long)word))
+		return (int)index;
+	_BitScanForward(&index, (unsigned long)(word >> 32));
+	return (int)index + 32;
+#else
+	return __builtin_ctzll(word);
+#endif
+}
+
+//index of the highest set bit, word must not be zero
+inline int Highest_Set_Bit(uint64_t word)
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+	unsigned long index;
+	_BitScanReverse64(&index, word);
+	return (int)index;
+#elif defined(_MSC_VER)
+	unsigned long index;
+	if (_BitScanReverse(&index, (unsigned long)(word >> 32)))
+		return (int)index + 32;
+	_BitScanReverse(&index, (unsigned long)word);
+	return (int)index;
+#else
+	return 63 - __builtin_clzll(word);
+#endif
+}
+
+//number of set bits. MSVC's __popcnt64 is the POPCNT instruction whatever the cpu, so it gets the
+//portable count, gcc and clang pick the instruction only when the build targets it
+inline int Count_Set_Bits(uint64_t word)
+{
+#ifdef _MSC_VER
+	word = word - ((word >> 1) & 0x5555555555555555ULL);
+	word = (word & 0x3333333333333333ULL) + ((word >> 2) & 0x3333333333333333ULL);
+	word = (word + (word >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+	return (int)((word * 0x0101010101010101ULL) >> 56);
+#else
+	return __builtin_popcountll(word);
+#endif
+}
+
+#endif
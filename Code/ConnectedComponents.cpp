@@ -0,0 +1,210 @@
+#include "ConnectedComponents.h"
+
+struct ComponentRun
+{
+	int row;
+	int first;
+	int last;
+};
+
+struct ComponentBand
+{
+	int firstRow;
+	int lastRow;
+	int offset;
+	std::vector<ComponentRun> runs;
+};
+
+//parents always point to a smaller index, so one forward pass resolves every root
+static int Find_Root(std::vector<int> &parent, int i)
+{
+	while (parent[i] != i)
+	{
+		parent[i] = parent[parent[i]];
+		i = parent[i];
+	}
+	return i;
+}
+
+static void Join_Runs(std::vector<int> &parent, int a, int b)
+{
+	a = Find_Root(parent, a);
+	b = Find_Root(parent, b);
+	if (a < b)
+		parent[b] = a;
+	else if (b < a)
+		parent[a] = b;
+}
+
+//joins every pair of overlapping runs between two consecutive rows, both lists sorted by column
+static void Join_Rows(std::vector<int> &parent, const ComponentRun *upper, int upperCount, int upperIndex,
+	const ComponentRun *lower, int lowerCount, int lowerIndex)
+{
+	int u = 0, l = 0;
+	while ((u < upperCount) && (l < lowerCount))
+	{
+		if ((upper[u].first <= lower[l].last) && (lower[l].first <= upper[u].last))
+			Join_Runs(parent, upperIndex + u, lowerIndex + l);
+
+		if (upper[u].last < lower[l].last)
+			++u;
+		else
+			++l;
+	}
+}
+
+//first column >= j whose bit equals value, or limit if there is none before it
+static int Find_Bit(const uint64_t *words, int j, int limit, bool value)
+{
+	uint64_t flip = value ? 0 : ~0ULL;
+	int w = j >> 6;
+	uint64_t bits = (words[w] ^ flip) & (~0ULL << (j & 63));
+	while (bits == 0)
+	{
+		++w;
+		if ((w << 6) >= limit)
+			return limit;
+		bits = words[w] ^ flip;
+	}
+	int col = (w << 6) + Lowest_Set_Bit(bits);
+	return (col < limit) ? col : limit;
+}
+
+//horizontal runs of set pixels of a row, restricted to the columns of domain
+static void Extract_Runs(const BinaryMask &candidates, const cv::Rect &domain, int row, std::vector<ComponentRun> &runs)
+{
+	const uint64_t *words = candidates.Row(row);
+	int limit = domain.x + domain.width;
+	int col = domain.x;
+	while (col < limit)
+	{
+		int first = Find_Bit(words, col, limit, true);
+		if (first >= limit)
+			break;
+		col = Find_Bit(words, first, limit, false);
+		ComponentRun run = { row, first, col - 1 };
+		runs.push_back(run);
+	}
+}
+
+cv::Rect Extract_Component(const BinaryMask &candidates, const cv::Rect &domain, int seedRow, int seedCol, BinaryMask &component, ThreadPool *pool,
+	const std::function<void(int, int, int)> &onRun)
+{
+	cv::Rect bounds = domain & cv::Rect(0, 0, candidates.Width(), candidates.Height());
+	if (bounds.empty() || !bounds.contains(cv::Point(seedCol, seedRow)) || !candidates.Get(seedRow, seedCol))
+		return cv::Rect();
+
+	//one band per chunk of rows, more bands than threads so they balance
+	const int BAND_ROWS = 256;
+	std::vector<ComponentBand> bands;
+	for (int r = bounds.y; r < bounds.y + bounds.height; r += BAND_ROWS)
+	{
+		ComponentBand band;
+		band.firstRow = r;
+		band.lastRow = std::min(r + BAND_ROWS, bounds.y + bounds.height) - 1;
+		band.offset = 0;
+		bands.push_back(band);
+	}
+
+	//runs of every band
+	pool->Parallel_For(0, (int)bands.size(), 1, [&](int first, int last)
+	{
+		for (int b = first; b < last; ++b)
+			for (int r = bands[b].firstRow; r <= bands[b].lastRow; ++r)
+				Extract_Runs(candidates, bounds, r, bands[b].runs);
+	});
+
+	int runCount = 0;
+	for (size_t b = 0; b < bands.size(); ++b)
+	{
+		bands[b].offset = runCount;
+		runCount += (int)bands[b].runs.size();
+	}
+
+	std::vector<int> parent(runCount);
+	for (int i = 0; i < runCount; ++i)
+		parent[i] = i;
+
+	//join runs inside each band, bands only touch their own part of parent
+	pool->Parallel_For(0, (int)bands.size(), 1, [&](int first, int last)
+	{
+		for (int b = first; b < last; ++b)
+		{
+			const std::vector<ComponentRun> &runs = bands[b].runs;
+			int previous = 0, current = 0;
+			while (current < (int)runs.size())
+			{
+				int next = current;
+				while ((next < (int)runs.size()) && (runs[next].row == runs[current].row))
+					++next;
+				if ((current > 0) && (runs[previous].row == runs[current].row - 1))
+					Join_Rows(parent, &runs[previous], current - previous, bands[b].offset + previous,
+						&runs[current], next - current, bands[b].offset + current);
+				previous = current;
+				current = next;
+			}
+		}
+	});
+
+	//join across band borders
+	for (size_t b = 1; b < bands.size(); ++b)
+	{
+		const std::vector<ComponentRun> &upper = bands[b - 1].runs;
+		const std::vector<ComponentRun> &lower = bands[b].runs;
+		int upperFirst = (int)upper.size();
+		while ((upperFirst > 0) && (upper[upperFirst - 1].row == bands[b - 1].lastRow))
+			--upperFirst;
+		int lowerCount = 0;
+		while ((lowerCount < (int)lower.size()) && (lower[lowerCount].row == bands[b].firstRow))
+			++lowerCount;
+		Join_Rows(parent, upper.data() + upperFirst, (int)upper.size() - upperFirst, bands[b - 1].offset + upperFirst,
+			lower.data(), lowerCount, bands[b].offset);
+	}
+
+	//resolve roots in one pass
+	for (int i = 0; i < runCount; ++i)
+		parent[i] = (parent[i] == i) ? i : parent[parent[i]];
+
+	int seedRoot = -1;
+	for (size_t b = 0; (b < bands.size()) && (seedRoot < 0); ++b)
+		for (size_t i = 0; i < bands[b].runs.size(); ++i)
+		{
+			const ComponentRun &run = bands[b].runs[i];
+			if ((run.row == seedRow) && (run.first <= seedCol) && (seedCol <= run.last))
+			{
+				seedRoot = parent[bands[b].offset + i];
+				break;
+			}
+		}
+
+	//write the seed's component, each band only writes its own rows
+	std::vector<cv::Rect> bandBounds(bands.size());
+	pool->Parallel_For(0, (int)bands.size(), 1, [&](int first, int last)
+	{
+		for (int b = first; b < last; ++b)
+		{
+			int top = -1, bottom = -1, left = candidates.Width(), right = -1;
+			for (size_t i = 0; i < bands[b].runs.size(); ++i)
+			{
+				const ComponentRun &run = bands[b].runs[i];
+				if (parent[bands[b].offset + i] != seedRoot)
+					continue;
+				component.Set_Run(run.row, run.first, run.last);
+				if (onRun)
+					onRun(run.row, run.first, run.last);
+				if (top < 0)
+					top = run.row;
+				bottom = run.row;
+				left = std::min(left, run.first);
+				right = std::max(right, run.last);
+			}
+			if (top >= 0)
+				bandBounds[b] = cv::Rect(left, top, right - left + 1, bottom - top + 1);
+		}
+	});
+
+	cv::Rect componentBounds;
+	for (size_t b = 0; b < bandBounds.size(); ++b)
+		componentBounds |= bandBounds[b];
+	return componentBounds;
+}
@@ -0,0 +1,18 @@
+#ifndef CONNECTED_COMPONENTS_H
+#define CONNECTED_COMPONENTS_H
+
+#include <opencv2/opencv.hpp>
+#include "BinaryMask.h"
+#include "ThreadPool.h"
+
+//Sets in component the 4-connected component of candidate pixels that contains (seedRow, seedCol).
+//Only pixels inside domain take part. The image is cut into bands of rows that are labelled in
+//parallel as horizontal runs, each band joins its runs with a union-find, and the bands are then
+//merged across their borders. component is expected to be clear.
+//Returns the component's bounding box, empty if the seed is not a candidate.
+//onRun(row, first, last), if given, is called for every run written. Calls for one row all come from
+//the band writing it, so per row results need no locking.
+cv::Rect Extract_Component(const BinaryMask &candidates, const cv::Rect &domain, int seedRow, int seedCol, BinaryMask &component, ThreadPool *pool,
+	const std::function<void(int, int, int)> &onRun = nullptr);
+
+#endif
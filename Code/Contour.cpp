@@ -0,0 +1,279 @@
+#include "Contour.h"
+#include <cmath>
+#include <fstream>
+
+//Moore neighbours counterclockwise (on screen, rows grow downwards) starting from the east
+static const int ROW_STEP[8] = { 0, -1, -1, -1, 0, 1, 1, 1 };
+static const int COL_STEP[8] = { 1, 1, 0, -1, -1, -1, 0, 1 };
+static const int EAST = 0;
+static const int WEST = 4;
+
+static inline bool Is_Set(const BinaryMask &region, int row, int col)
+{
+	return (row >= 0) && (col >= 0) && (row < region.Height()) && (col < region.Width()) && region.Get(row, col);
+}
+
+//index of the neighbour step (dRow, dCol)
+static int Direction(int dRow, int dCol)
+{
+	for (int d = 0; d < 8; ++d)
+		if ((ROW_STEP[d] == dRow) && (COL_STEP[d] == dCol))
+			return d;
+	return 0;
+}
+
+//follows one border from its start pixel, whose clear neighbour towards fromDir is where the scan came from.
+//Pixels with a clear east neighbour met on the way are marked negative, so no hole border starts there again
+static void Follow_Border(const BinaryMask &region, BinaryMask &marked, BinaryMask &negative, int row, int col, int fromDir, Contour &contour)
+{
+	//clockwise from the clear neighbour for the first set one
+	int first = -1;
+	for (int k = 0; k < 8; ++k)
+	{
+		int d = (fromDir - k + 8) & 7;
+		if (Is_Set(region, row + ROW_STEP[d], col + COL_STEP[d]))
+		{
+			first = d;
+			break;
+		}
+	}
+
+	//a lone pixel is a border on its own
+	if (first < 0)
+	{
+		marked.Set(row, col);
+		negative.Set(row, col);
+		contour.points.push_back(cv::Point2f((float)col, (float)row));
+		return;
+	}
+
+	const int firstRow = row + ROW_STEP[first];
+	const int firstCol = col + COL_STEP[first];
+	int prevRow = firstRow, prevCol = firstCol;
+	int curRow = row, curCol = col;
+	while (true)
+	{
+		contour.points.push_back(cv::Point2f((float)curCol, (float)curRow));
+
+		//counterclockwise from the neighbour after the one we came from, to the next set pixel
+		int back = Direction(prevRow - curRow, prevCol - curCol);
+		bool isEastClear = false;
+		int nextRow = prevRow, nextCol = prevCol;
+		for (int k = 1; k <= 8; ++k)
+		{
+			int d = (back + k) & 7;
+			nextRow = curRow + ROW_STEP[d];
+			nextCol = curCol + COL_STEP[d];
+			if (Is_Set(region, nextRow, nextCol))
+				break;
+			if (d == EAST)
+				isEastClear = true;
+		}
+
+		marked.Set(curRow, curCol);
+		if (isEastClear)
+			negative.Set(curRow, curCol);
+
+		//back at the start about to take the first step again
+		if ((nextRow == row) && (nextCol == col) && (curRow == firstRow) && (curCol == firstCol))
+			break;
+		prevRow = curRow;
+		prevCol = curCol;
+		curRow = nextRow;
+		curCol = nextCol;
+	}
+}
+
+void Trace_Contours(const BinaryMask &region, const RunRegion &runs, BinaryMask &marked, BinaryMask &negative, std::vector<Contour> &contours)
+{
+	contours.clear();
+	const Run *rowRuns;
+	for (int i = runs.Top(); i < runs.Top() + runs.Rows(); ++i)
+	{
+		int count = runs.Row(i, rowRuns);
+		for (int r = 0; r < count; ++r)
+		{
+			const int first = rowRuns[r].first;
+			const int last = rowRuns[r].last;
+
+			//an outer border starts at the first pixel of a run no border has gone through yet
+			if (!marked.Get(i, first))
+			{
+				contours.push_back(Contour());
+				Follow_Border(region, marked, negative, i, first, WEST, contours.back());
+				if (first == last)
+					continue;
+			}
+			else if ((first == last) && !negative.Get(i, first))
+			{
+				//a one pixel run is checked for an outer border first, as in the raster scan
+				contours.push_back(Contour());
+				contours.back().isHole = true;
+				Follow_Border(region, marked, negative, i, first, EAST, contours.back());
+				continue;
+			}
+			else if (first == last)
+				continue;
+
+			//a hole border starts at the last pixel of a run, unless one has already been traced past it
+			if (!negative.Get(i, last))
+			{
+				contours.push_back(Contour());
+				contours.back().isHole = true;
+				Follow_Border(region, marked, negative, i, last, EAST, contours.back());
+			}
+		}
+	}
+}
+
+void Smooth_Moving_Average(Contour &contour, int radius)
+{
+	const int n = (int)contour.points.size();
+	if ((radius < 1) || (n < 3))
+		return;
+
+	//running sum round the closed polyline
+	std::vector<cv::Point2f> smoothed(n);
+	const int window = std::min(2 * radius + 1, n);
+	const int before = (window - 1) / 2;
+	double sumX = 0, sumY = 0;
+	for (int k = 0; k < window; ++k)
+	{
+		const cv::Point2f &p = contour.points[(k - before + n) % n];
+		sumX += p.x;
+		sumY += p.y;
+	}
+	for (int i = 0; i < n; ++i)
+	{
+		smoothed[i] = cv::Point2f((float)(sumX / window), (float)(sumY / window));
+		const cv::Point2f &entering = contour.points[(i - before + window + n) % n];
+		const cv::Point2f &leaving = contour.points[(i - before + n) % n];
+		sumX += entering.x - leaving.x;
+		sumY += entering.y - leaving.y;
+	}
+	contour.points.swap(smoothed);
+}
+
+void Smooth_Chaikin(Contour &contour, int passes)
+{
+	std::vector<cv::Point2f> cut;
+	for (int pass = 0; pass < passes; ++pass)
+	{
+		const size_t n = contour.points.size();
+		if (n < 3)
+			return;
+		cut.clear();
+		for (size_t i = 0; i < n; ++i)
+		{
+			const cv::Point2f &a = contour.points[i];
+			const cv::Point2f &b = contour.points[(i + 1) % n];
+			cut.push_back(cv::Point2f(0.75f * a.x + 0.25f * b.x, 0.75f * a.y + 0.25f * b.y));
+			cut.push_back(cv::Point2f(0.25f * a.x + 0.75f * b.x, 0.25f * a.y + 0.75f * b.y));
+		}
+		contour.points.swap(cut);
+	}
+}
+
+//distance from p to the segment a b
+static double Segment_Distance(const cv::Point2f &p, const cv::Point2f &a, const cv::Point2f &b)
+{
+	double abX = b.x - a.x, abY = b.y - a.y;
+	double apX = p.x - a.x, apY = p.y - a.y;
+	double length = abX * abX + abY * abY;
+	double t = (length > 0) ? std::min(1.0, std::max(0.0, (apX * abX + apY * abY) / length)) : 0;
+	double dX = apX - t * abX, dY = apY - t * abY;
+	return std::sqrt(dX * dX + dY * dY);
+}
+
+void Simplify_Douglas_Peucker(Contour &contour, double epsilon)
+{
+	const int n = (int)contour.points.size();
+	if ((epsilon <= 0) || (n < 4))
+		return;
+
+	//the point furthest from the first splits the closed polyline into two open ones, index n being the first again
+	int furthest = 0;
+	double best = -1;
+	for (int i = 1; i < n; ++i)
+	{
+		double dX = contour.points[i].x - contour.points[0].x;
+		double dY = contour.points[i].y - contour.points[0].y;
+		if (dX * dX + dY * dY > best)
+		{
+			best = dX * dX + dY * dY;
+			furthest = i;
+		}
+	}
+
+	std::vector<char> isKept(n, 0);
+	isKept[0] = 1;
+	isKept[furthest] = 1;
+	std::vector<std::pair<int, int>> pending;
+	pending.push_back(std::make_pair(0, furthest));
+	pending.push_back(std::make_pair(furthest, n));
+	while (!pending.empty())
+	{
+		int first = pending.back().first;
+		int last = pending.back().second;
+		pending.pop_back();
+
+		int split = -1;
+		double distance = epsilon;
+		for (int i = first + 1; i < last; ++i)
+		{
+			double d = Segment_Distance(contour.points[i], contour.points[first], contour.points[last % n]);
+			if (d > distance)
+			{
+				distance = d;
+				split = i;
+			}
+		}
+		if (split < 0)
+			continue;
+		isKept[split] = 1;
+		pending.push_back(std::make_pair(first, split));
+		pending.push_back(std::make_pair(split, last));
+	}
+
+	size_t kept = 0;
+	for (int i = 0; i < n; ++i)
+		if (isKept[i])
+			contour.points[kept++] = contour.points[i];
+	contour.points.resize(kept);
+}
+
+bool Write_Contours(const std::string &path, const std::vector<Contour> &contours, int width, int height)
+{
+	std::ofstream file(path);
+	if (!file)
+		return false;
+
+	bool isSvg = (path.size() >= 4) && (path.compare(path.size() - 4, 4, ".svg") == 0);
+	if (isSvg)
+	{
+		file << "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"" << width << "\" height=\"" << height
+			<< "\" viewBox=\"0 0 " << width << " " << height << "\">\n<path fill=\"white\" fill-rule=\"evenodd\" d=\"";
+		for (size_t c = 0; c < contours.size(); ++c)
+		{
+			const std::vector<cv::Point2f> &points = contours[c].points;
+			//pixel centres are at half coordinates in svg
+			for (size_t i = 0; i < points.size(); ++i)
+				file << ((i == 0) ? "M" : "L") << points[i].x + 0.5f << " " << points[i].y + 0.5f << " ";
+			if (!points.empty())
+				file << "Z ";
+		}
+		file << "\"/>\n</svg>\n";
+	}
+	else
+	{
+		for (size_t c = 0; c < contours.size(); ++c)
+		{
+			const std::vector<cv::Point2f> &points = contours[c].points;
+			file << (contours[c].isHole ? "hole " : "outer ") << points.size();
+			for (size_t i = 0; i < points.size(); ++i)
+				file << " " << points[i].x << " " << points[i].y;
+			file << "\n";
+		}
+	}
+	return (bool)file;
+}
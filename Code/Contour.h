@@ -0,0 +1,40 @@
+#ifndef CONTOUR_H
+#define CONTOUR_H
+
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "BinaryMask.h"
+#include "RunRegion.h"
+
+//one closed border of a region as an ordered list of points, x being the column and y the row
+struct Contour
+{
+	std::vector<cv::Point2f> points;
+	//border of a hole inside the region rather than an outer border
+	bool isHole = false;
+};
+
+//Border following (Suzuki and Abe) with 8 connected regions: every outer border and hole border is traced
+//once by walking round its pixels Moore neighbour by neighbour. Borders can only start at the first or last
+//pixel of a run, so only the runs of the region are scanned and the work follows the outline, not the area.
+//marked and negative are scratch masks of the region's size that must be clear where the region is set;
+//they are left marked along the traced borders.
+void Trace_Contours(const BinaryMask &region, const RunRegion &runs, BinaryMask &marked, BinaryMask &negative, std::vector<Contour> &contours);
+
+//Smoothing of closed polylines
+//every point becomes the average of the radius points on each side of it
+void Smooth_Moving_Average(Contour &contour, int radius);
+//each pass replaces every edge by the points a quarter and three quarters along it, so it doubles the points.
+//SMOOTH_CONTOURS allows up to MAX_CHAIKIN_PASSES of them
+static const int MAX_CHAIKIN_PASSES = 8;
+void Smooth_Chaikin(Contour &contour, int passes);
+//drops points until no removed point is further than epsilon from the polyline left
+void Simplify_Douglas_Peucker(Contour &contour, double epsilon);
+
+//polygons of a width x height image. .svg files get a single path of every contour, filled with the even odd rule
+//so holes are cut out,
+//anything else one line per contour: "outer" or "hole", the point count, then x y of every point
+bool Write_Contours(const std::string &path, const std::vector<Contour> &contours, int width, int height);
+
+#endif
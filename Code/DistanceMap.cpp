@@ -0,0 +1,182 @@
+#include "DistanceMap.h"
+#include "BitOps.h"
+#include "BinaryMask.h"
+
+//pshufb masks that pick channel c of 16 consecutive pixels out of the k-th 16 bytes of the 48 they span
+struct DeinterleaveTable
+{
+	unsigned char masks[3][3][16];
+	DeinterleaveTable()
+	{
+		for (int c = 0; c < 3; ++c)
+			for (int k = 0; k < 3; ++k)
+				for (int i = 0; i < 16; ++i)
+				{
+					int byte = 3 * i + c;
+					masks[c][k][i] = ((byte >> 4) == k) ? (unsigned char)(byte & 15) : 0x80;
+				}
+	}
+};
+
+static const DeinterleaveTable DEINTERLEAVE_TABLE;
+
+static void Distance_Scalar(const cv::Vec3b &seed, const unsigned char *src, int first, int width, uchar *distance)
+{
+	for (int j = first; j < width; ++j)
+	{
+		const unsigned char *px = src + 3 * j;
+		int d = std::max(std::max(abs(px[0] - seed[0]), abs(px[1] - seed[1])), abs(px[2] - seed[2]));
+		distance[j] = (uchar)d;
+	}
+}
+
+#ifdef IAS_HAVE_AVX2
+//the byte shuffles are SSSE3, which every AVX2 cpu has
+static IAS_TARGET_AVX2 inline __m128i Channel_Distance(__m128i v0, __m128i v1, __m128i v2, int c, __m128i seed)
+{
+	__m128i channel = _mm_shuffle_epi8(v0, _mm_loadu_si128((const __m128i*)DEINTERLEAVE_TABLE.masks[c][0]));
+	channel = _mm_or_si128(channel, _mm_shuffle_epi8(v1, _mm_loadu_si128((const __m128i*)DEINTERLEAVE_TABLE.masks[c][1])));
+	channel = _mm_or_si128(channel, _mm_shuffle_epi8(v2, _mm_loadu_si128((const __m128i*)DEINTERLEAVE_TABLE.masks[c][2])));
+	return _mm_or_si128(_mm_subs_epu8(channel, seed), _mm_subs_epu8(seed, channel));
+}
+
+static IAS_TARGET_AVX2 int Distance_Avx2(const cv::Vec3b &seed, const unsigned char *src, int width, uchar *distance)
+{
+	const __m128i seed0 = _mm_set1_epi8((char)seed[0]);
+	const __m128i seed1 = _mm_set1_epi8((char)seed[1]);
+	const __m128i seed2 = _mm_set1_epi8((char)seed[2]);
+
+	//16 pixels per step, split into channels then the largest difference kept
+	int j = 0;
+	for (; j + 16 <= width; j += 16)
+	{
+		const unsigned char *px = src + 3 * j;
+		__m128i v0 = _mm_loadu_si128((const __m128i*)px);
+		__m128i v1 = _mm_loadu_si128((const __m128i*)(px + 16));
+		__m128i v2 = _mm_loadu_si128((const __m128i*)(px + 32));
+		__m128i d = _mm_max_epu8(Channel_Distance(v0, v1, v2, 0, seed0), Channel_Distance(v0, v1, v2, 1, seed1));
+		d = _mm_max_epu8(d, Channel_Distance(v0, v1, v2, 2, seed2));
+		_mm_storeu_si128((__m128i*)(distance + j), d);
+	}
+	return j;
+}
+#endif
+
+void Build_Distance_Map(const cv::Mat &image, const cv::Vec3b &seed, cv::Mat &distance, ThreadPool *pool, SimdLevel level)
+{
+	distance.create(image.rows, image.cols, CV_8UC1);
+	if (level > Detect_Simd_Level())
+		level = Detect_Simd_Level();
+
+	pool->Parallel_For(0, image.rows, 16, [&](int first, int last)
+	{
+		for (int i = first; i < last; ++i)
+		{
+			const unsigned char *src = image.ptr<uchar>(i);
+			uchar *opPixel = distance.ptr<uchar>(i);
+			int done = 0;
+#ifdef IAS_HAVE_AVX2
+			if (level == SIMD_AVX2)
+				done = Distance_Avx2(seed, src, image.cols, opPixel);
+#endif
+			Distance_Scalar(seed, src, done, image.cols, opPixel);
+		}
+	});
+}
+
+void Threshold_Distance_Row(const uchar *distance, int width, int tolerance, uint64_t *mask)
+{
+	memset(mask, 0, Words_Per_Row(width) * sizeof(uint64_t));
+	if (tolerance <= 0)
+		return;
+	if (tolerance > 256)
+		tolerance = 256;
+
+	int j = 0;
+#ifdef IAS_HAVE_SSE2
+	//distance < tolerance is max(distance, tolerance - 1) == tolerance - 1
+	const __m128i limit = _mm_set1_epi8((char)(tolerance - 1));
+	for (; j + 16 <= width; j += 16)
+	{
+		__m128i d = _mm_loadu_si128((const __m128i*)(distance + j));
+		uint64_t bits = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(d, limit), limit));
+		mask[j >> 6] |= bits << (j & 63);
+	}
+#endif
+	for (; j < width; ++j)
+		if (distance[j] < tolerance)
+			mask[j >> 6] |= 1ULL << (j & 63);
+}
+
+void Build_Level_Map(const cv::Mat &distance, int seedRow, int seedCol, cv::Mat &levels)
+{
+	int width = distance.cols;
+	int height = distance.rows;
+	levels.create(height, width, CV_16UC1);
+	levels.setTo(cv::Scalar(UNREACHED_LEVEL));
+
+	//levels only go up along a path, so pixels are settled bucket by bucket in level order
+	std::vector<std::vector<int>> buckets(256);
+	BinaryMask settled(width, height);
+	int seedLevel = distance.ptr<uchar>(seedRow)[seedCol];
+	levels.ptr<uint16_t>(seedRow)[seedCol] = (uint16_t)seedLevel;
+	buckets[seedLevel].push_back(seedRow * width + seedCol);
+
+	for (int level = 0; level < 256; ++level)
+	{
+		std::vector<int> &bucket = buckets[level];
+		while (!bucket.empty())
+		{
+			int index = bucket.back();
+			bucket.pop_back();
+			int row = index / width;
+			int col = index % width;
+			if (settled.Get(row, col))
+				continue;
+			settled.Set(row, col);
+
+			//same steps as the fills: down, up unless into row 0, right, left unless into column 0
+			int next[4][2] = { { row + 1, col }, { row - 1, col }, { row, col + 1 }, { row, col - 1 } };
+			bool allowed[4] = { row + 1 < height, row - 1 > 0, col + 1 < width, col - 1 > 0 };
+			for (int k = 0; k < 4; ++k)
+			{
+				if (!allowed[k])
+					continue;
+				uint16_t &current = levels.ptr<uint16_t>(next[k][0])[next[k][1]];
+				int nextLevel = std::max(level, (int)distance.ptr<uchar>(next[k][0])[next[k][1]]);
+				if (nextLevel < current)
+				{
+					current = (uint16_t)nextLevel;
+					buckets[nextLevel].push_back(next[k][0] * width + next[k][1]);
+				}
+			}
+		}
+		//the bucket is done with, give back its memory
+		std::vector<int>().swap(bucket);
+	}
+}
+
+void Threshold_Level_Row(const uint16_t *levels, int width, int tolerance, uint64_t *mask)
+{
+	memset(mask, 0, Words_Per_Row(width) * sizeof(uint64_t));
+	if (tolerance <= 0)
+		return;
+	if (tolerance > UNREACHED_LEVEL)
+		tolerance = UNREACHED_LEVEL;
+
+	int j = 0;
+#ifdef IAS_HAVE_SSE2
+	//levels are at most 256 so the signed compare is safe
+	const __m128i limit = _mm_set1_epi16((short)tolerance);
+	for (; j + 16 <= width; j += 16)
+	{
+		__m128i low = _mm_cmplt_epi16(_mm_loadu_si128((const __m128i*)(levels + j)), limit);
+		__m128i high = _mm_cmplt_epi16(_mm_loadu_si128((const __m128i*)(levels + j + 8)), limit);
+		uint64_t bits = (uint32_t)_mm_movemask_epi8(_mm_packs_epi16(low, high));
+		mask[j >> 6] |= bits << (j & 63);
+	}
+#endif
+	for (; j < width; ++j)
+		if (levels[j] < tolerance)
+			mask[j >> 6] |= 1ULL << (j & 63);
+}
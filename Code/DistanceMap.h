@@ -0,0 +1,28 @@
+#ifndef DISTANCE_MAP_H
+#define DISTANCE_MAP_H
+
+#include <stdint.h>
+#include <opencv2/opencv.hpp>
+#include "Simd.h"
+#include "ThreadPool.h"
+
+//value of the level map for pixels the seed can not reach at any tolerance
+static const int UNREACHED_LEVEL = 256;
+
+//Chebyshev distance (largest channel difference) of every pixel of a BGR image to a seed colour, CV_8UC1.
+//A pixel is a candidate at tolerance t exactly when its distance is below t.
+void Build_Distance_Map(const cv::Mat &image, const cv::Vec3b &seed, cv::Mat &distance, ThreadPool *pool, SimdLevel level = Detect_Simd_Level());
+
+//bits of a distance row below tolerance, packed 64 pixels per word
+void Threshold_Distance_Row(const uchar *distance, int width, int tolerance, uint64_t *mask);
+
+//Flood level of every pixel from a seed, CV_16UC1: the smallest possible largest distance along a path
+//from the seed using the fill's neighbour steps (no steps up into row 0, no steps left into column 0).
+//The fill at tolerance t is every pixel whose level is below t. Built with a 256 bucket Dijkstra,
+//pixels never reached hold UNREACHED_LEVEL.
+void Build_Level_Map(const cv::Mat &distance, int seedRow, int seedCol, cv::Mat &levels);
+
+//bits of a level row below tolerance, packed 64 pixels per word
+void Threshold_Level_Row(const uint16_t *levels, int width, int tolerance, uint64_t *mask);
+
+#endif
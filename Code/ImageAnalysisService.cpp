@@ -1,247 +1,258 @@
 #include "ImageAnalysisService.h"
+#include "Morphology.h"
+#include "MaskFile.h"
+#include <algorithm>
+#include <climits>
 
-Status ImageAnalysisService::INITIALIZE(string& filename)
-{
-	try
-	{
-		m_imageLoaded = false;
-		m_inputImage = imread(filename, 1);
-
-		if (!m_inputImage.data)
-			return Status::INVALID_IMAGE;
+//fill steps between two checks for cancellation, and on a streamed image for the memory budget
+static const int CANCEL_CHECK_STEPS = 4096;
 
-		m_regionImage = Mat::zeros(m_inputImage.size(), CV_8UC1);
-		m_perimeterImage = Mat::zeros(m_inputImage.size(), CV_8UC1);
+//bytes a command holds outside the service's buffers for as long as it runs, the labels of FIND_REGIONS or an
+//8 bit image about to be built, so a streamed image's reservation counts them too
+struct HeldBytes
+{
+	size_t &held;
+	size_t bytes;
 
-		m_rgbChannels = m_inputImage.channels();
-		m_width = m_inputImage.size().width;
-		m_height = m_inputImage.size().height;
-		m_imageLoaded = true;
-		m_isRegionCalculated = false;
-		m_isPerimeterCalculated = false;
-		return Status::SUCCESS;
+	HeldBytes(size_t &total, size_t count) : held(total), bytes(count)
+	{
+		held += bytes;
 	}
-	catch (...)
+	~HeldBytes()
 	{
-		m_imageLoaded = false;
-		return Status::FAILURE;
+		held -= bytes;
 	}
-}
-
-bool ImageAnalysisService::IsIntitialized()
-{
-	return m_imageLoaded;
-}
-
-bool ImageAnalysisService::IsRegionCalculated()
-{
-	return m_isRegionCalculated;
-}
+	//the bytes are the caller's now, so the reservation settles without them
+	void Release()
+	{
+		held -= bytes;
+		bytes = 0;
+	}
+};
 
-bool ImageAnalysisService::IsPerimeterCalculated()
+//bytes of a mask cropped to area
+static size_t Crop_Bytes(const cv::Rect &area)
 {
-	return m_isPerimeterCalculated;
+	return (size_t)Words_Per_Row(area.width) * sizeof(uint64_t) * area.height;
 }
 
-Status ImageAnalysisService::FIND_REGION(int seedX, int seedY, int tolerance)
+Status ImageAnalysisService::INITIALIZE(string& filename)
 {
 	try
 	{
-		if ((seedX > m_width) || (seedX < 0) || (seedY > m_height) || (seedY < 0))
-			return Status::SEED_POINT_OUT_OF_RANGE;
-
-		//reset images
-		m_isRegionCalculated = false;
-		m_isPerimeterCalculated = false;
-		m_regionImage = Mat::zeros(m_inputImage.size(), CV_8UC1);
-		m_perimeterImage = Mat::zeros(m_inputImage.size(), CV_8UC1);
-
-		//swap points for different conventions
-		int tmpPt = seedX;
-		seedX = seedY;
-		seedY = tmpPt;
-
-		Status val;
-
-		Vec3b* tmp;
-		tmp = m_inputImage.ptr<Vec3b>(seedX);
-
-		Pixel oldPixel;
-		oldPixel.red = tmp[seedY][0];
-		oldPixel.green = tmp[seedY][1];
-		oldPixel.blue = tmp[seedY][2];
-		m_seedPixel = oldPixel;
-
-		m_tolerence = tolerance;
-
-		val = Flood_Fill_Forrest_Fire(seedX, seedY);
-		if (val == Status::FAILURE)
-			return val;
+		StageTimer timer(m_instrumentation, STAGE_INITIALIZE);
+		m_imageLoaded = false;
+		m_isRawCacheMissed = false;
+		Release_Image();
+		timer.Restart_Bytes();
 
-		//enhancements
-		//Apply opening and closing to remove noise
-		cv::Mat tmpImage = Mat::zeros(m_inputImage.size(), CV_8UC1);
-		val = Apply_Opening(m_regionImage, tmpImage);
-		if (val == Status::FAILURE)
-			return val;
+		if (Is_Raw_Image_Path(filename))
+		{
+			//raw images are streamed, strips of rows are read as they are needed and only the
+			//memory budget's worth of them stay loaded
+			std::shared_ptr<StripImage> strips = std::make_shared<StripImage>();
+			if (!strips->Open(filename))
+				return Status::INVALID_IMAGE;
+			if (!strips->Set_Budget(m_memoryBudget))
+				return Status::OVER_MEMORY_BUDGET;
+			m_stripImage = strips;
+			m_rgbChannels = 3;
+			m_width = m_stripImage->Width();
+			m_height = m_stripImage->Height();
+		}
+		else
+		{
+			if (m_isRawCacheUsed)
+				Load_Raw_Cache(filename);
+			else
+				m_inputImage = imread(filename, 1);
 
-		val = Apply_Closing(tmpImage, m_regionImage);
-		if (val == Status::FAILURE)
-			return val;
+			if (!m_inputImage.data)
+				return Status::INVALID_IMAGE;
 
-		m_isRegionCalculated = true;
+			m_rgbChannels = m_inputImage.channels();
+			m_width = m_inputImage.size().width;
+			m_height = m_inputImage.size().height;
+		}
 
-		return val;
+		Reset_Image_State();
+		timer.Add_Pixels((uint64_t)m_width * m_height);
+		return Status::SUCCESS;
 	}
 	catch (...)
 	{
-		m_isRegionCalculated = false;
-		m_isPerimeterCalculated = false;
+		m_imageLoaded = false;
 		return Status::FAILURE;
 	}
 }
 
-Status ImageAnalysisService::Apply_Erosion(cv::Mat ipImage, cv::Mat opImage)
+Status ImageAnalysisService::SHARE_IMAGE(const ImageAnalysisService &source)
 {
 	try
 	{
-		//should only work with grayscale images
-		if ((ipImage.type() != CV_8UC1) || (ipImage.type() != CV_8UC1))
+		if (!source.m_imageLoaded)
 			return Status::FAILURE;
 
-		int sum = 0;
-		uchar *ipPixel, *opPixel;
-		for (int i = 1; i < m_height - 1; ++i)
-		{
-			for (int j = 1; j < m_width - 1; ++j)
-			{
-				sum = 0;
-				ipPixel = ipImage.ptr<uchar>(i);
-				sum += ipPixel[j];
-				sum += ipPixel[j + 1];
-				sum += ipPixel[j - 1];
-				ipPixel = ipImage.ptr<uchar>(i + 1);
-				sum += ipPixel[j];
-				sum += ipPixel[j + 1];
-				sum += ipPixel[j - 1];
-				ipPixel = ipImage.ptr<uchar>(i - 1);
-				sum += ipPixel[j];
-				sum += ipPixel[j + 1];
-				sum += ipPixel[j - 1];
-
-				opPixel = opImage.ptr<uchar>(i);
-				if (sum >= (9 * WHITE))
-				{
-					opPixel[j] = WHITE;
-				}
-				else
-				{
-					opPixel[j] = BLACK;
-				}
-			}
-		}
+		//only the handles are copied, the pixels, strips and mapping stay shared and are never written
+		m_imageLoaded = false;
+		Release_Image();
+		m_inputImage = source.m_inputImage;
+		m_stripImage = source.m_stripImage;
+		m_mappedImage = source.m_mappedImage;
+		m_rgbChannels = source.m_rgbChannels;
+		m_width = source.m_width;
+		m_height = source.m_height;
+		Reset_Image_State();
 		return Status::SUCCESS;
 	}
 	catch (...)
 	{
+		m_imageLoaded = false;
 		return Status::FAILURE;
 	}
 }
 
-Status ImageAnalysisService::Apply_Dialation(cv::Mat ipImage, cv::Mat opImage)
+Status ImageAnalysisService::LOAD_IMAGE(const cv::Mat &image)
 {
 	try
 	{
-		//should only work with grayscale images
-		if ((ipImage.type() != CV_8UC1) || (ipImage.type() != CV_8UC1))
-			return Status::FAILURE;
+		m_imageLoaded = false;
+		Release_Image();
+		if (image.empty() || (image.type() != CV_8UC3))
+			return Status::INVALID_IMAGE;
 
-		int sum = 0;
-		uchar *ipPixel, *opPixel;
-		for (int i = 1; i < m_height - 1; ++i)
-		{
-			for (int j = 1; j < m_width - 1; ++j)
-			{
-				sum = 0;
-				ipPixel = ipImage.ptr<uchar>(i);
-				sum += ipPixel[j];
-				sum += ipPixel[j + 1];
-				sum += ipPixel[j - 1];
-				ipPixel = ipImage.ptr<uchar>(i + 1);
-				sum += ipPixel[j];
-				sum += ipPixel[j + 1];
-				sum += ipPixel[j - 1];
-				ipPixel = ipImage.ptr<uchar>(i - 1);
-				sum += ipPixel[j];
-				sum += ipPixel[j + 1];
-				sum += ipPixel[j - 1];
-
-				opPixel = opImage.ptr<uchar>(i);
-				if (sum >= WHITE)
-				{
-					opPixel[j] = WHITE;
-				}
-				else
-				{
-					opPixel[j] = BLACK;
-				}
-			}
-		}
+		//the pixels stay the caller's, as they stay the source's with SHARE_IMAGE
+		m_inputImage = image;
+		m_rgbChannels = image.channels();
+		m_width = image.cols;
+		m_height = image.rows;
+		Reset_Image_State();
 		return Status::SUCCESS;
 	}
 	catch (...)
 	{
+		m_imageLoaded = false;
 		return Status::FAILURE;
 	}
 }
 
-Status ImageAnalysisService::Apply_Opening(cv::Mat ipImage, cv::Mat opImage)
+void ImageAnalysisService::Release_Image()
 {
-	try
+	//sessions sharing the previous image may still be reading it, so it is let go of rather than closed.
+	//a mapped image has to let go of the mapping first, a streamed one gets back what was reserved of its budget
+	if (m_stripImage)
+		m_stripImage->Reserve(m_streamReserved, 0);
+	m_streamReserved = 0;
+	m_stripImage.reset();
+	m_inputImage.release();
+	m_mappedImage.reset();
+}
+
+bool ImageAnalysisService::Reserve_Stream_Memory()
+{
+	//a streamed image's reservation is what the buffers and region cache hold now, so it grows with the regions
+	//grown rather than with the image, and a service that only loads or shares the image holds nothing
+	if (!m_stripImage)
+		return true;
+	size_t bytes = Working_Bytes();
+	if (!m_stripImage->Reserve(m_streamReserved, bytes))
 	{
-		//should only work with grayscale images
-		if ((ipImage.type() != CV_8UC1) || (ipImage.type() != CV_8UC1))
-			return Status::FAILURE;
+		//classified rows and cached regions can be worked out again, so they are given back before giving up,
+		//the least recently used regions first
+		m_candidateMask.Clear();
+		std::fill(m_isRowClassified.begin(), m_isRowClassified.end(), 0);
+		bytes = Working_Bytes();
+		while (!m_stripImage->Reserve(m_streamReserved, bytes))
+		{
+			if (!m_regionCache.Evict_Oldest())
+				return false;
+			bytes = Working_Bytes();
+		}
+	}
+	m_streamReserved = bytes;
+	return true;
+}
 
-		cv::Mat tmpImage = Mat::zeros(m_inputImage.size(), CV_8UC1);
-		Status val;
+bool ImageAnalysisService::Reserve_Stream_Memory(size_t extraBytes)
+{
+	//room for extraBytes more that the caller is about to allocate
+	HeldBytes held(m_heldBytes, extraBytes);
+	return Reserve_Stream_Memory();
+}
 
-		val = Apply_Erosion(ipImage, tmpImage);
-		if (val == Status::FAILURE)
-			return val;
+void ImageAnalysisService::Reset_Image_State()
+{
+	//the working masks are allocated when a command first needs them, an image of the same
+	//size keeps them and only the areas the previous image touched are cleared.
+	//A streamed image starts with paged masks holding nothing, and without the images of the last one
+	if (m_stripImage)
+	{
+		BinaryMask *masks[] = { &m_regionMask, &m_perimeterMask, &m_fillMask, &m_candidateMask, &m_scratchMasks[0], &m_scratchMasks[1] };
+		for (int i = 0; i < 6; ++i)
+			if (!Prepare_Mask(*masks[i]))
+				masks[i]->Clear();
+		Release_Stream_Images();
+	}
+	Clear_Mask(m_regionMask, m_regionArea);
+	Clear_Mask(m_perimeterMask, m_perimeterArea);
+	m_hasRegionRuns = false;
+	Clear_Mask(m_fillMask, m_fillBounds);
+	m_fillBounds = cv::Rect();
+	m_hasFill = false;
+	m_distanceMap.release();
+	m_distanceColour = -1;
+	m_levelMap.release();
+	m_levelSeed = PointImg(-1, -1);
+	m_regionArea = cv::Rect();
+	m_perimeterArea = cv::Rect();
+
+	//cached regions belong to the previous image
+	++m_imageGeneration;
+	m_regionCache.Clear();
+	m_cacheEntryId = 0;
+	m_imageLoaded = true;
+	m_isRegionCalculated = false;
+	m_isPerimeterCalculated = false;
+	m_isPerimeterSmoothed = false;
+	m_isContourCalculated = false;
+}
 
-		val = Apply_Dialation(tmpImage, opImage);
-		if (val == Status::FAILURE)
-			return val;
+void ImageAnalysisService::Release_Stream_Images()
+{
+	//a streamed image's 8 bit images hold a byte a pixel of its budget, so they are let go of once the
+	//region or perimeter they were made from is gone
+	if (!m_stripImage)
+		return;
+	m_perimeterImage.release();
+	m_smoothImage.release();
+	m_smoothArea = cv::Rect();
+	m_outputImage.release();
+}
 
-		return val;
-	}
-	catch (...)
-	{
+Status ImageAnalysisService::SET_KERNEL_SIZE(int width, int height)
+{
+	if ((width < 1) || (height < 1))
 		return Status::FAILURE;
-	}
+
+	m_kernelWidth = width;
+	m_kernelHeight = height;
+
+	//the perimeter depends on the kernel, so the current region can no longer add it to its cache entry
+	m_cacheEntryId = 0;
+	return Status::SUCCESS;
 }
 
-Status ImageAnalysisService::Apply_Closing(cv::Mat ipImage, cv::Mat opImage)
+Status ImageAnalysisService::SET_SMOOTHING_KERNEL(int size, double sigma)
 {
 	try
 	{
-		//should only work with grayscale images
-		if ((ipImage.type() != CV_8UC1) || (ipImage.type() != CV_8UC1))
+		if ((size < 1) || (size % 2 == 0) || (sigma < 0) || (sigma > MAX_SMOOTHING_SIGMA))
+			return Status::FAILURE;
+		if ((sigma == 0) && ((size - 1) / 4.0 > MAX_SMOOTHING_SIGMA * MAX_SMOOTHING_SIGMA))
 			return Status::FAILURE;
 
-		cv::Mat tmpImage = Mat::zeros(m_inputImage.size(), CV_8UC1);
-		Status val;
-
-		val = Apply_Dialation(ipImage, tmpImage);
-		if (val == Status::FAILURE)
-			return val;
-
-		val == Apply_Erosion(tmpImage, opImage);
-		if (val == Status::FAILURE)
-			return val;
-
-		return val;
+		m_smoothingKernel = Make_Smoothing_Kernel(size, sigma);
+		return Status::SUCCESS;
 	}
 	catch (...)
 	{
@@ -249,25 +260,18 @@ Status ImageAnalysisService::Apply_Closing(cv::Mat ipImage, cv::Mat opImage)
 	}
 }
 
-Status ImageAnalysisService::Subtract_Image(cv::Mat firstImage, cv::Mat secondImage, cv::Mat opImage)
+Status ImageAnalysisService::SET_THREAD_COUNT(int count)
 {
 	try
 	{
-		//should only work with grayscale images
-		if ((firstImage.type() != CV_8UC1) || (secondImage.type() != CV_8UC1) || (opImage.type() != CV_8UC1))
+		//0 goes back to the shared pool with one thread per core
+		if (count < 0)
 			return Status::FAILURE;
 
-		uchar *firstImgPixel, *secondImgPixel, *opPixel;
-		for (int i = 0; i < m_height; ++i)
-		{
-			firstImgPixel = firstImage.ptr<uchar>(i);
-			secondImgPixel = secondImage.ptr<uchar>(i);
-			opPixel = opImage.ptr<uchar>(i);
-			for (int j = 0; j < m_width; ++j)
-			{
-				opPixel[j] = abs(firstImgPixel[j] - secondImgPixel[j]);
-			}
-		}
+		if (count == 0)
+			m_threadPool.reset();
+		else
+			m_threadPool = std::make_shared<ThreadPool>(count);
 		return Status::SUCCESS;
 	}
 	catch (...)
@@ -276,56 +280,33 @@ Status ImageAnalysisService::Subtract_Image(cv::Mat firstImage, cv::Mat secondIm
 	}
 }
 
-Status ImageAnalysisService::Apply_Gaussian_Smoothing(cv::Mat ipImage, cv::Mat opImage)
+Status ImageAnalysisService::SET_SIMD_LEVEL(SimdLevel level)
 {
-	try
-	{
-		//should only work with grayscale images
-		if ((ipImage.type() != CV_8UC1) || (ipImage.type() != CV_8UC1))
-			return Status::FAILURE;
-
-		float sum = 0.0;
+	//the classifier keeps to the levels the cpu runs, the other kernels follow it
+	m_classifier.Set_Level(level);
+	m_simdLevel = m_classifier.Get_Level();
+	return Status::SUCCESS;
+}
 
-		//Gaussian filter constants
-		const int FILTER_SIZE = 9;
-		const int FILTER_WEIGHT = 4;
+SimdLevel ImageAnalysisService::GetSimdLevel()
+{
+	return m_simdLevel;
+}
 
-		float GAUSSIAN_3X3[FILTER_SIZE] =
-		{
-			0.0625, 0.125, 0.0625,
-			0.125, 0.25, 0.125,
-			0.0625, 0.125, 0.0625
-		};
+Status ImageAnalysisService::SET_FILL_RESUME(bool enabled)
+{
+	m_isFillResumed = enabled;
+	return Status::SUCCESS;
+}
 
-		uchar *ipPixel, *opPixel;
-		for (int i = 1; i < m_height - 1; ++i)
-		{
-			opPixel = opImage.ptr<uchar>(i);
-			for (int j = 1; j < m_width - 1; ++j)
-			{
-				ipPixel = ipImage.ptr<uchar>(i - 1);
-				sum += GAUSSIAN_3X3[0] * ipPixel[j - 1];
-				sum += GAUSSIAN_3X3[1] * ipPixel[j];
-				sum += GAUSSIAN_3X3[2] * ipPixel[j + 1];
-				ipPixel = ipImage.ptr<uchar>(i);
-				sum += GAUSSIAN_3X3[3] * ipPixel[j - 1];
-				sum += GAUSSIAN_3X3[4] * ipPixel[j];
-				sum += GAUSSIAN_3X3[5] * ipPixel[j + 1];
-				ipPixel = ipImage.ptr<uchar>(i + 1);
-				sum += GAUSSIAN_3X3[6] * ipPixel[j - 1];
-				sum += GAUSSIAN_3X3[7] * ipPixel[j];
-				sum += GAUSSIAN_3X3[8] * ipPixel[j + 1];
-				
-				//take average
-				sum = sum / FILTER_SIZE;
-
-				//central pixel's weight is 0.25, multiply by 4 to keep output bright enough and properly weighted
-				sum = sum * FILTER_WEIGHT;
-
-				//let it round off
-				opPixel[j] = (unsigned char)sum;
-			}
-		}
+Status ImageAnalysisService::SET_REGION_FORMAT(RegionFormat format)
+{
+	try
+	{
+		//the current region keeps the masks it has, its runs are read from them if they are needed
+		m_regionFormat = format;
+		m_hasFillRuns = false;
+		m_hasRegionRuns = false;
 		return Status::SUCCESS;
 	}
 	catch (...)
@@ -334,45 +315,84 @@ Status ImageAnalysisService::Apply_Gaussian_Smoothing(cv::Mat ipImage, cv::Mat o
 	}
 }
 
-Status ImageAnalysisService::FIND_PERIMETER()
+size_t ImageAnalysisService::GetRegionArea()
 {
-	try
-	{
-		if (!m_isRegionCalculated)
-			return Status::FAILURE;
-
-		//reset perimeter image
-		m_perimeterImage = Mat::zeros(m_inputImage.size(), CV_8UC1);
+	if (!m_isRegionCalculated)
+		return 0;
+	return (size_t)m_regionMoments.area;
+}
 
-		Status val;
-		m_isPerimeterCalculated = false;
+cv::Rect ImageAnalysisService::GetRegionBounds()
+{
+	if (!m_isRegionCalculated)
+		return cv::Rect();
+	return m_regionExtent;
+}
 
-		//do morphological erosion
-		val = Apply_Erosion(m_regionImage, m_perimeterImage);
-		if (val == Status::FAILURE)
-			return val;
+RegionStats ImageAnalysisService::GetRegionStats()
+{
+	RegionStats stats = RegionStats();
+	if (!m_isRegionCalculated || (m_regionMoments.area == 0))
+		return stats;
+
+	double area = (double)m_regionMoments.area;
+	stats.area = (size_t)m_regionMoments.area;
+	stats.bounds = m_regionExtent;
+	stats.centroidX = (double)m_regionMoments.colSum / area;
+	stats.centroidY = (double)m_regionMoments.rowSum / area;
+	//the sums follow the channels of the BGR input
+	stats.meanBlue = (double)m_regionMoments.colourSum[0] / area;
+	stats.meanGreen = (double)m_regionMoments.colourSum[1] / area;
+	stats.meanRed = (double)m_regionMoments.colourSum[2] / area;
+	stats.perimeterLength = m_isPerimeterCalculated ? m_perimeterLength : 0;
+	return stats;
+}
 
-		//subtrack from region image to get perimeter
-		val = Subtract_Image(m_regionImage, m_perimeterImage, m_perimeterImage);
-		if (val == Status::FAILURE)
-			return val;
+Status ImageAnalysisService::SET_CACHE_LIMIT(size_t bytes)
+{
+	try
+	{
+		m_regionCache.Set_Limit(bytes);
+		if ((m_cacheEntryId != 0) && (m_regionCache.Get(m_cacheEntryId) == nullptr))
+			m_cacheEntryId = 0;
 
-		m_isPerimeterCalculated = true;
+		//a streamed image's budget gets back what the cache let go of
+		Reserve_Stream_Memory();
 		return Status::SUCCESS;
 	}
 	catch (...)
 	{
-		m_isPerimeterCalculated = false;
 		return Status::FAILURE;
 	}
 }
 
+CacheStats ImageAnalysisService::GetCacheStats()
+{
+	CacheStats stats;
+	stats.hits = m_regionCache.Hits();
+	stats.misses = m_regionCache.Misses();
+	stats.entries = m_regionCache.Entries();
+	stats.bytes = m_regionCache.Bytes();
+	stats.limit = m_regionCache.Limit();
+	return stats;
+}
 
-Status ImageAnalysisService::DISPLAY_IMAGE()
+ServiceStats ImageAnalysisService::GetServiceStats()
+{
+	return m_instrumentation.Snapshot();
+}
+
+Status ImageAnalysisService::RESET_STATS()
+{
+	m_instrumentation.Reset();
+	return Status::SUCCESS;
+}
+
+Status ImageAnalysisService::START_TRACE()
 {
 	try
 	{
-		SHOW_MAT(m_inputImage, "Input Image");
+		m_instrumentation.Start_Trace();
 		return Status::SUCCESS;
 	}
 	catch (...)
@@ -381,23 +401,11 @@ Status ImageAnalysisService::DISPLAY_IMAGE()
 	}
 }
 
-Status ImageAnalysisService::DISPLAY_PIXELS(OutputImageType type)
+Status ImageAnalysisService::SAVE_TRACE(std::string& filename)
 {
 	try
 	{
-		switch (type)
-		{
-		case REGION:
-			SHOW_MAT(m_regionImage, "Region Image");
-			break;
-		case PERIMETER:
-			SHOW_MAT(m_perimeterImage, "Perimeter Image");
-			break;
-		default:
-			return Status::FAILURE;
-			break;
-		}
-		return Status::SUCCESS;
+		return m_instrumentation.Save_Trace(filename) ? Status::SUCCESS : Status::FAILURE;
 	}
 	catch (...)
 	{
@@ -405,22 +413,19 @@ Status ImageAnalysisService::DISPLAY_PIXELS(OutputImageType type)
 	}
 }
 
-Status ImageAnalysisService::SAVE_PIXELS(OutputImageType type, std::string& filename)
+Status ImageAnalysisService::SET_RAW_CACHE(bool enabled)
+{
+	m_isRawCacheUsed = enabled;
+	return Status::SUCCESS;
+}
+
+Status ImageAnalysisService::SET_MEMORY_BUDGET(size_t bytes)
 {
 	try
 	{
-		switch (type)
-		{
-		case REGION:
-			imwrite(filename, m_regionImage);
-			break;
-		case PERIMETER:
-			imwrite(filename, m_perimeterImage);
-			break;
-		default:
-			return Status::FAILURE;
-			break;
-		}
+		if (m_stripImage && !m_stripImage->Set_Budget(bytes))
+			return Status::OVER_MEMORY_BUDGET;
+		m_memoryBudget = bytes;
 		return Status::SUCCESS;
 	}
 	catch (...)
@@ -429,17 +434,14 @@ Status ImageAnalysisService::SAVE_PIXELS(OutputImageType type, std::string& file
 	}
 }
 
-Status ImageAnalysisService::FIND_SMOOTH_PERIMETER()
+Status ImageAnalysisService::SAVE_RAW_IMAGE(std::string& filename)
 {
 	try
 	{
-		if (!m_isPerimeterCalculated)
+		if (!m_imageLoaded || m_stripImage)
 			return Status::FAILURE;
 
-		cv::Mat tmpImage = Mat::zeros(m_inputImage.size(), CV_8UC1);
-		Apply_Gaussian_Smoothing(m_perimeterImage, tmpImage);
-		m_perimeterImage = tmpImage;
-		return Status::SUCCESS;
+		return Write_Raw_Image(filename, m_inputImage) ? Status::SUCCESS : Status::FAILURE;
 	}
 	catch (...)
 	{
@@ -447,43 +449,1398 @@ Status ImageAnalysisService::FIND_SMOOTH_PERIMETER()
 	}
 }
 
-Status ImageAnalysisService::Flood_Fill_Forrest_Fire(int seedX, int seedY)
+std::future<Status> ImageAnalysisService::INITIALIZE_ASYNC(std::string filename)
 {
-	try
-	{
-		Vec3b* tmp;
-		Pixel currentPixel;
-		uchar *grayPixel;
+	return Run_Async([this, filename]() mutable { return INITIALIZE(filename); });
+}
 
-		PointImg pnt(seedX, seedY);
+std::future<Status> ImageAnalysisService::FIND_REGION_ASYNC(int x, int y, int tolerance, FillMode mode)
+{
+	return Run_Async([this, x, y, tolerance, mode] { return FIND_REGION(x, y, tolerance, mode); });
+}
 
-		//maintain a list of node
-		m_listPt.push_back(pnt);
-		while (!m_listPt.empty())
-		{
-			PointImg pnt = m_listPt.back();
-			seedX = pnt.X;
-			seedY = pnt.Y;
+std::future<Status> ImageAnalysisService::FIND_PERIMETER_ASYNC()
+{
+	return Run_Async([this] { return FIND_PERIMETER(); });
+}
 
-			//get last node
-			m_listPt.pop_back();
+std::future<Status> ImageAnalysisService::FIND_SMOOTH_PERIMETER_ASYNC()
+{
+	return Run_Async([this] { return FIND_SMOOTH_PERIMETER(); });
+}
 
-			tmp = m_inputImage.ptr<Vec3b>(seedX);
-			currentPixel.red = tmp[seedY][0];
-			currentPixel.green = tmp[seedY][1];
-			currentPixel.blue = tmp[seedY][2];
+std::future<Status> ImageAnalysisService::SAVE_PIXELS_ASYNC(OutputImageType type, std::string filename)
+{
+	return Run_Async([this, type, filename]() mutable { return SAVE_PIXELS(type, filename); });
+}
 
-			grayPixel = m_regionImage.ptr<uchar>(seedX);
+Status ImageAnalysisService::CANCEL()
+{
+	//commands queued before this see a new generation and do not start, the running one sees the flag
+	++m_cancelGeneration;
+	m_isCancelled = true;
+	return Status::SUCCESS;
+}
 
-			//if already visited continue
-			if (grayPixel[seedY] == WHITE)
-				continue;
+float ImageAnalysisService::GetProgress()
+{
+	return m_progress;
+}
 
-			if ((abs(currentPixel.red - m_seedPixel.red) < m_tolerence) && (abs(currentPixel.green - m_seedPixel.green) < m_tolerence) && (abs(currentPixel.blue - m_seedPixel.blue) < m_tolerence))
-			{
-				grayPixel[seedY] = WHITE;
+bool ImageAnalysisService::IsIntitialized()
+{
+	return m_imageLoaded;
+}
 
-				if ((seedX + 1) < m_width)
+bool ImageAnalysisService::IsRegionCalculated()
+{
+	return m_isRegionCalculated;
+}
+
+bool ImageAnalysisService::IsContourCalculated()
+{
+	return m_isContourCalculated;
+}
+
+bool ImageAnalysisService::IsRawCacheMissed()
+{
+	return m_isRawCacheMissed;
+}
+
+bool ImageAnalysisService::IsPerimeterCalculated()
+{
+	return m_isPerimeterCalculated;
+}
+
+Status ImageAnalysisService::FIND_REGION(int seedX, int seedY, int tolerance, FillMode mode)
+{
+	try
+	{
+		if ((seedX >= m_width) || (seedX < 0) || (seedY >= m_height) || (seedY < 0))
+			return Status::SEED_POINT_OUT_OF_RANGE;
+		//the forrest fire stack can grow with the region's area and the parallel fill classifies every row,
+		//neither of which the memory budget has room for
+		if (m_stripImage)
+			mode = FillMode::SCANLINE;
+
+		StageTimer timer(m_instrumentation, STAGE_FIND_REGION);
+		Prepare_Mask(m_regionMask);
+		Prepare_Mask(m_fillMask);
+
+		//reset images
+		m_isRegionCalculated = false;
+		m_isPerimeterCalculated = false;
+		m_isContourCalculated = false;
+		m_isPerimeterSmoothed = false;
+		Release_Stream_Images();
+
+		//only the area the previous region and perimeter were worked on can be non zero
+		Clear_Mask(m_regionMask, m_regionArea);
+		Clear_Mask(m_perimeterMask, m_perimeterArea);
+		m_regionArea = cv::Rect();
+		m_perimeterArea = cv::Rect();
+		m_hasFillRuns = false;
+		m_hasRegionRuns = false;
+		if (!Reserve_Stream_Memory())
+			return Status::OVER_MEMORY_BUDGET;
+
+		//swap points for different conventions
+		int tmpPt = seedX;
+		seedX = seedY;
+		seedY = tmpPt;
+
+		Status val;
+
+		ImageStrip strip;
+		const Vec3b* tmp;
+		tmp = Input_Row(seedX, strip);
+
+		Pixel oldPixel;
+		oldPixel.red = tmp[seedY][0];
+		oldPixel.green = tmp[seedY][1];
+		oldPixel.blue = tmp[seedY][2];
+		m_seedPixel = oldPixel;
+
+		m_tolerence = tolerance;
+
+		//a seed that grows a region already cached gets it back without a fill
+		m_cacheEntryId = 0;
+		RegionKey key = Region_Key();
+		const CachedRegion *cached = m_regionCache.Enabled() ? m_regionCache.Find(key, seedX, seedY) : nullptr;
+		if (cached != nullptr)
+		{
+			Restore_Region(*cached, seedX, seedY);
+			if (!Reserve_Stream_Memory())
+			{
+				Discard_Region();
+				return Status::OVER_MEMORY_BUDGET;
+			}
+			timer.Add_Pixels((uint64_t)m_regionArea.area());
+			m_isRegionCalculated = true;
+			return Status::SUCCESS;
+		}
+
+		//a seed of the level map is one compare pass, a larger tolerance for a seed of the kept fill
+		//carries on from where that fill stopped
+		bool isLevelled = Has_Level_Map(seedX, seedY);
+		bool isResumed = !isLevelled && Can_Resume(seedX, seedY);
+		bool isClassified = !isLevelled && ((mode != FillMode::FORREST_FIRE) || isResumed);
+		{
+			StageTimer fillTimer(m_instrumentation, STAGE_FILL);
+			if (isClassified)
+				Prepare_Candidates();
+			if (isLevelled)
+				val = Flood_Fill_Levels();
+			else if (isResumed)
+				val = Resume_Fill(seedX, seedY);
+			else
+				val = Flood_Fill(seedX, seedY, mode);
+
+			//fills on the candidate mask test whole rows at a time, the others count as they go
+			if (isClassified)
+				m_testedPixels = (uint64_t)std::count(m_isRowClassified.begin(), m_isRowClassified.end(), 1) * m_width;
+			fillTimer.Add_Pixels(m_testedPixels);
+			timer.Add_Pixels(m_testedPixels);
+		}
+		if (val != Status::SUCCESS)
+		{
+			Discard_Region();
+			return val;
+		}
+		Report_Progress(0.5f);
+
+		//the raw fill decides which later seeds resume or hit the cache, so keep it before it is cleaned up
+		Keep_Fill(seedX, seedY);
+		BinaryMask fill;
+		if (m_regionCache.Enabled())
+			fill.Crop(m_regionMask, m_regionBounds);
+
+		//enhancements
+		//Apply opening and closing to remove noise
+		{
+			StageTimer cleanupTimer(m_instrumentation, STAGE_CLEANUP);
+			val = Clean_Region();
+			cleanupTimer.Add_Pixels((uint64_t)m_regionArea.area());
+			timer.Add_Pixels((uint64_t)m_regionArea.area());
+		}
+		//the kept fill and the cleanup's pages and runs are what a streamed region has grown by since the fill
+		if ((val == Status::SUCCESS) && !Reserve_Stream_Memory(fill.Bytes()))
+			val = Status::OVER_MEMORY_BUDGET;
+		if (val != Status::SUCCESS)
+		{
+			Discard_Region();
+			return val;
+		}
+		{
+			StageTimer statsTimer(m_instrumentation, STAGE_REGION_STATS);
+			Finish_Region_Stats();
+			statsTimer.Add_Pixels((uint64_t)m_regionArea.area());
+			timer.Add_Pixels((uint64_t)m_regionArea.area());
+		}
+
+		//a streamed image's budget makes room by evicting older entries, a region that still does not fit is not cached
+		if (m_regionCache.Enabled() && Reserve_Stream_Memory(fill.Bytes() + Crop_Bytes(m_regionArea)))
+			m_cacheEntryId = m_regionCache.Insert(key, seedX, seedY, fill, m_regionBounds, m_regionMask, m_regionArea,
+				m_fillMoments, m_regionMoments, m_regionExtent);
+		//the reservation settles on what is held now the fill's crop is in the cache or gone
+		fill = BinaryMask();
+		Reserve_Stream_Memory();
+
+		m_isRegionCalculated = true;
+
+		return val;
+	}
+	catch (...)
+	{
+		m_isRegionCalculated = false;
+		m_isPerimeterCalculated = false;
+		m_isContourCalculated = false;
+		return Status::FAILURE;
+	}
+}
+
+Status ImageAnalysisService::GROW_FILL(int seedX, int seedY, int tolerance, FillMode mode)
+{
+	try
+	{
+		if ((seedX >= m_width) || (seedX < 0) || (seedY >= m_height) || (seedY < 0))
+			return Status::SEED_POINT_OUT_OF_RANGE;
+		if (m_stripImage)
+			mode = FillMode::SCANLINE;
+
+		StageTimer timer(m_instrumentation, STAGE_FILL);
+		Prepare_Mask(m_regionMask);
+		m_cacheEntryId = 0;
+		m_isRegionCalculated = false;
+		m_isPerimeterCalculated = false;
+		m_isContourCalculated = false;
+		m_isPerimeterSmoothed = false;
+		Release_Stream_Images();
+		Clear_Mask(m_regionMask, m_regionArea);
+		m_regionArea = cv::Rect();
+		m_hasFillRuns = false;
+		m_hasRegionRuns = false;
+		if (!Reserve_Stream_Memory())
+			return Status::OVER_MEMORY_BUDGET;
+
+		//same X = row, Y = column convention as FIND_REGION
+		ImageStrip strip;
+		Vec3b colour = Input_Row(seedY, strip)[seedX];
+		m_seedPixel.red = colour[0];
+		m_seedPixel.green = colour[1];
+		m_seedPixel.blue = colour[2];
+		m_tolerence = tolerance;
+
+		if (mode != FillMode::FORREST_FIRE)
+			Prepare_Candidates();
+		Status val = Flood_Fill(seedY, seedX, mode);
+		if (val != Status::SUCCESS)
+		{
+			Discard_Region();
+			return val;
+		}
+
+		//the next command clears the region mask over the fill
+		m_regionArea = m_regionBounds;
+		if (mode != FillMode::FORREST_FIRE)
+			m_testedPixels = (uint64_t)std::count(m_isRowClassified.begin(), m_isRowClassified.end(), 1) * m_width;
+		timer.Add_Pixels(m_testedPixels);
+		return Status::SUCCESS;
+	}
+	catch (...)
+	{
+		Discard_Region();
+		return Status::FAILURE;
+	}
+}
+
+Status ImageAnalysisService::FIND_REGIONS(const std::vector<RegionSeed> &seeds, cv::Mat &labels, std::vector<RegionCrop> *regions, FillMode mode)
+{
+	try
+	{
+		for (size_t i = 0; i < seeds.size(); ++i)
+			if ((seeds[i].x >= m_width) || (seeds[i].x < 0) || (seeds[i].y >= m_height) || (seeds[i].y < 0))
+				return Status::SEED_POINT_OUT_OF_RANGE;
+		if (m_stripImage)
+			mode = FillMode::SCANLINE;
+
+		StageTimer timer(m_instrumentation, STAGE_FIND_REGIONS);
+		//reset images, the batch does not leave a current region or kept fill behind
+		m_cacheEntryId = 0;
+		m_hasFill = false;
+		m_isRegionCalculated = false;
+		m_isPerimeterCalculated = false;
+		m_isContourCalculated = false;
+		m_isPerimeterSmoothed = false;
+		Release_Stream_Images();
+		Prepare_Mask(m_regionMask);
+		Clear_Mask(m_regionMask, m_regionArea);
+		Clear_Mask(m_perimeterMask, m_perimeterArea);
+		m_regionArea = cv::Rect();
+		m_perimeterArea = cv::Rect();
+		m_hasFillRuns = false;
+		m_hasRegionRuns = false;
+
+		//a streamed image's budget has to have room for the labels, they are the caller's once the batch is done
+		HeldBytes held(m_heldBytes, m_stripImage ? (size_t)m_width * m_height * sizeof(int) : 0);
+		if (!Reserve_Stream_Memory())
+			return Status::OVER_MEMORY_BUDGET;
+		labels = cv::Mat::zeros(m_height, m_width, CV_32SC1);
+		if (regions != nullptr)
+			regions->assign(seeds.size(), RegionCrop());
+
+		//seeds of the same colour and tolerance share one classification, so they are grown one after the other.
+		//the sort is stable, so inside a group seeds stay in their original order
+		std::vector<int> colours(seeds.size());
+		std::vector<int> order(seeds.size());
+		ImageStrip strip;
+		for (size_t i = 0; i < seeds.size(); ++i)
+		{
+			Vec3b colour = Input_Row(seeds[i].y, strip)[seeds[i].x];
+			colours[i] = (colour[0] << 16) | (colour[1] << 8) | colour[2];
+			order[i] = (int)i;
+		}
+		std::stable_sort(order.begin(), order.end(), [&](int a, int b)
+		{
+			if (seeds[a].tolerance != seeds[b].tolerance)
+				return seeds[a].tolerance < seeds[b].tolerance;
+			return colours[a] < colours[b];
+		});
+
+		//index of the seed whose region each seed ended up with
+		std::vector<int> owner(seeds.size(), -1);
+		size_t groupStart = 0;
+		while (groupStart < order.size())
+		{
+			size_t groupEnd = groupStart + 1;
+			while ((groupEnd < order.size()) && (seeds[order[groupEnd]].tolerance == seeds[order[groupStart]].tolerance)
+				&& (colours[order[groupEnd]] == colours[order[groupStart]]))
+				++groupEnd;
+
+			const RegionSeed &first = seeds[order[groupStart]];
+			Vec3b colour = Input_Row(first.y, strip)[first.x];
+			m_seedPixel.red = colour[0];
+			m_seedPixel.green = colour[1];
+			m_seedPixel.blue = colour[2];
+			m_tolerence = first.tolerance;
+			if (mode != FillMode::FORREST_FIRE)
+				Prepare_Candidates();
+
+			for (size_t k = groupStart; k < groupEnd; ++k)
+			{
+				int i = order[k];
+				if (owner[i] >= 0)
+					continue;
+				owner[i] = i;
+
+				//same X = row, Y = column convention as FIND_REGION
+				int seedX = seeds[i].y;
+				int seedY = seeds[i].x;
+				Clear_Mask(m_regionMask, m_regionArea);
+				m_regionArea = cv::Rect();
+				Status val;
+				{
+					//fills on the candidate mask are counted by the rows they classified, the others as they go
+					StageTimer fillTimer(m_instrumentation, STAGE_FILL);
+					size_t rowsBefore = (mode != FillMode::FORREST_FIRE) ? std::count(m_isRowClassified.begin(), m_isRowClassified.end(), 1) : 0;
+					val = Flood_Fill(seedX, seedY, mode);
+					if (mode != FillMode::FORREST_FIRE)
+						m_testedPixels = (uint64_t)(std::count(m_isRowClassified.begin(), m_isRowClassified.end(), 1) - rowsBefore) * m_width;
+					fillTimer.Add_Pixels(m_testedPixels);
+					timer.Add_Pixels(m_testedPixels);
+				}
+				if ((val == Status::FAILURE) || (val == Status::OVER_MEMORY_BUDGET))
+				{
+					Discard_Region();
+					return val;
+				}
+
+				//a later seed of the group on the same pixel grows the same fill, and so does one inside this
+				//fill when neither seed is on row 0 or column 0 (those pixels are only entered from the seed)
+				bool isInterior = (seedX > 0) && (seedY > 0);
+				std::vector<int> sharing(1, i);
+				for (size_t n = k + 1; n < groupEnd; ++n)
+				{
+					int j = order[n];
+					if (owner[j] >= 0)
+						continue;
+					bool isSamePixel = (seeds[j].y == seedX) && (seeds[j].x == seedY);
+					bool isInside = isInterior && (seeds[j].y > 0) && (seeds[j].x > 0) && m_regionMask.Get(seeds[j].y, seeds[j].x);
+					if (isSamePixel || isInside)
+					{
+						owner[j] = i;
+						sharing.push_back(j);
+					}
+				}
+
+				{
+					StageTimer cleanupTimer(m_instrumentation, STAGE_CLEANUP);
+					val = Clean_Region();
+					cleanupTimer.Add_Pixels((uint64_t)m_regionArea.area());
+					timer.Add_Pixels((uint64_t)m_regionArea.area());
+				}
+				if ((val == Status::SUCCESS) && !Reserve_Stream_Memory())
+					val = Status::OVER_MEMORY_BUDGET;
+				if ((val == Status::FAILURE) || (val == Status::OVER_MEMORY_BUDGET))
+				{
+					Discard_Region();
+					return val;
+				}
+
+				//i is the smallest index sharing this region, the lowest seed index wins where regions overlap.
+				//Only the set bits are visited, a word at a time
+				int label = i + 1;
+				int firstWord = m_regionArea.x >> 6;
+				int lastWord = (m_regionArea.x + m_regionArea.width + 63) >> 6;
+				for (int r = m_regionArea.y; r < m_regionArea.y + m_regionArea.height; ++r)
+				{
+					const uint64_t *bits = m_regionMask.Row(r);
+					int *labelRow = labels.ptr<int>(r);
+					for (int w = firstWord; w < lastWord; ++w)
+						for (uint64_t word = bits[w]; word != 0; word &= word - 1)
+						{
+							int c = (w << 6) + Lowest_Set_Bit(word);
+							if ((labelRow[c] == 0) || (labelRow[c] > label))
+								labelRow[c] = label;
+						}
+				}
+
+				//each region is handed out cropped to its bounds, the seeds sharing it share the crop
+				if (regions != nullptr)
+				{
+					RegionCrop crop;
+					crop.bounds = m_regionMask.Bounding_Box(m_regionArea);
+					if (!crop.bounds.empty())
+					{
+						BinaryMask cropMask;
+						cropMask.Crop(m_regionMask, crop.bounds);
+						cropMask.To_Mat(crop.mask);
+					}
+					for (size_t n = 0; n < sharing.size(); ++n)
+						(*regions)[sharing[n]] = crop;
+				}
+			}
+			groupStart = groupEnd;
+		}
+
+		Clear_Mask(m_regionMask, m_regionArea);
+		m_regionArea = cv::Rect();
+		m_hasRegionRuns = false;
+		held.Release();
+		Reserve_Stream_Memory();
+		return Status::SUCCESS;
+	}
+	catch (...)
+	{
+		m_isRegionCalculated = false;
+		m_isPerimeterCalculated = false;
+		m_isContourCalculated = false;
+		return Status::FAILURE;
+	}
+}
+
+Status ImageAnalysisService::SWEEP_TOLERANCE(int seedX, int seedY, const std::vector<int> &tolerances, std::vector<int> &areas, std::vector<cv::Mat> *regions, FillMode mode)
+{
+	try
+	{
+		//a streamed image's budget has to have room for the region images as well
+		HeldBytes held(m_heldBytes, (m_stripImage && (regions != nullptr)) ? tolerances.size() * m_width * m_height : 0);
+		if (!Reserve_Stream_Memory())
+			return Status::OVER_MEMORY_BUDGET;
+
+		areas.assign(tolerances.size(), 0);
+		if (regions != nullptr)
+			regions->assign(tolerances.size(), cv::Mat());
+
+		//smallest tolerance first, each fill then resumes from the one before
+		std::vector<int> order(tolerances.size());
+		for (size_t i = 0; i < order.size(); ++i)
+			order[i] = (int)i;
+		std::stable_sort(order.begin(), order.end(), [&](int a, int b)
+		{
+			return tolerances[a] < tolerances[b];
+		});
+
+		for (size_t k = 0; k < order.size(); ++k)
+		{
+			int i = order[k];
+			Status val = FIND_REGION(seedX, seedY, tolerances[i], mode);
+			if (val != Status::SUCCESS)
+				return val;
+
+			areas[i] = (int)GetRegionArea();
+			if (regions != nullptr)
+			{
+				(*regions)[i] = cv::Mat::zeros(m_height, m_width, CV_8UC1);
+				m_regionMask.To_Mat((*regions)[i], m_regionArea);
+			}
+		}
+		held.Release();
+		Reserve_Stream_Memory();
+		return Status::SUCCESS;
+	}
+	catch (...)
+	{
+		m_isRegionCalculated = false;
+		m_isPerimeterCalculated = false;
+		m_isContourCalculated = false;
+		return Status::FAILURE;
+	}
+}
+
+Status ImageAnalysisService::BUILD_LEVEL_MAP(int seedX, int seedY)
+{
+	try
+	{
+		if ((seedX >= m_width) || (seedX < 0) || (seedY >= m_height) || (seedY < 0))
+			return Status::SEED_POINT_OUT_OF_RANGE;
+
+		//swap points for different conventions
+		int tmpPt = seedX;
+		seedX = seedY;
+		seedY = tmpPt;
+
+		ImageStrip strip;
+		Vec3b seed = Input_Row(seedX, strip)[seedY];
+		int colour = (seed[0] << 16) | (seed[1] << 8) | seed[2];
+
+		//the maps cover the whole image, a streamed image's budget needs room for those not allocated yet.
+		//The level map's buckets follow its frontier and are not counted
+		size_t pixels = (size_t)m_width * m_height;
+		size_t mapBytes = (m_distanceMap.empty() ? pixels : 0) + (m_levelMap.empty() ? 2 * pixels : 0);
+		HeldBytes held(m_heldBytes, m_stripImage ? mapBytes : 0);
+		if (!Reserve_Stream_Memory())
+			return Status::OVER_MEMORY_BUDGET;
+
+		if (colour != m_distanceColour)
+		{
+			m_distanceColour = -1;
+			if (m_stripImage)
+			{
+				//a strip at a time, each into its rows of the map
+				m_distanceMap.create(m_height, m_width, CV_8UC1);
+				for (int r = 0; r < m_height; r = strip.firstRow + strip.rows->rows)
+				{
+					Input_Row(r, strip);
+					cv::Mat rows = m_distanceMap(cv::Rect(0, strip.firstRow, m_width, strip.rows->rows));
+					Build_Distance_Map(*strip.rows, seed, rows, Get_Thread_Pool(), m_simdLevel);
+				}
+			}
+			else
+				Build_Distance_Map(m_inputImage, seed, m_distanceMap, Get_Thread_Pool(), m_simdLevel);
+			m_distanceColour = colour;
+		}
+
+		m_levelSeed = PointImg(-1, -1);
+		Build_Level_Map(m_distanceMap, seedX, seedY, m_levelMap);
+		m_levelSeed = PointImg(seedX, seedY);
+		return Status::SUCCESS;
+	}
+	catch (...)
+	{
+		m_distanceColour = -1;
+		m_levelSeed = PointImg(-1, -1);
+		return Status::FAILURE;
+	}
+}
+
+Status ImageAnalysisService::Flood_Fill(int seedX, int seedY, FillMode mode)
+{
+	if (mode == FillMode::FORREST_FIRE)
+		return Flood_Fill_Forrest_Fire(seedX, seedY);
+	else if (mode == FillMode::PARALLEL)
+		return Flood_Fill_Parallel(seedX, seedY);
+	else
+		return Flood_Fill_Scanline(seedX, seedY);
+}
+
+Status ImageAnalysisService::Clean_Region()
+{
+	//opening and closing can move the region by at most a kernel size, so they
+	//only need to work on the fill's bounding box padded by that much
+	m_regionArea = cv::Rect(m_regionBounds.x - m_kernelWidth, m_regionBounds.y - m_kernelHeight,
+		m_regionBounds.width + 2 * m_kernelWidth, m_regionBounds.height + 2 * m_kernelHeight);
+	m_regionArea &= cv::Rect(0, 0, m_width, m_height);
+	if (m_regionFormat == RegionFormat::RUN_LENGTH)
+		return Clean_Region_Runs();
+
+	//opening goes out to the second scratch mask and closing brings it back, so the scratch masks ping-pong
+	BinaryMask &openMask = Scratch_Mask(1, m_regionArea);
+	Status val = Apply_Opening(m_regionMask, openMask, m_regionArea);
+	if (val != Status::SUCCESS)
+		return val;
+	Report_Progress(0.75f);
+
+	return Apply_Closing(openMask, m_regionMask, m_regionArea);
+}
+
+Status ImageAnalysisService::Clean_Region_Runs()
+{
+	try
+	{
+		//runs come straight from the scanline fill, other fills are read back from the mask
+		RunRegion &fill = m_scratchRuns[0];
+		if (m_hasFillRuns)
+			fill.From_Runs(m_width, m_height, m_fillRuns);
+		else
+			fill.From_Mask(m_regionMask, m_regionBounds);
+		m_hasFillRuns = false;
+
+		//opening then closing, as on the masks
+		RunRegion &tmp = m_scratchRuns[1];
+		RunRegion &cleaned = m_scratchRuns[2];
+		Erode_Rect(fill, tmp, m_kernelWidth, m_kernelHeight, m_runScratch);
+		Dilate_Rect(tmp, cleaned, m_kernelWidth, m_kernelHeight, m_runScratch);
+		if (Is_Cancelled())
+			return Status::CANCELLED;
+		Report_Progress(0.75f);
+		Dilate_Rect(cleaned, tmp, m_kernelWidth, m_kernelHeight, m_runScratch);
+		Erode_Rect(tmp, cleaned, m_kernelWidth, m_kernelHeight, m_runScratch);
+
+		//the mask passes leave pixels whose window leaves the image as the fill had them
+		Cut_Region(fill, Interior_Area(m_width, m_height, m_kernelWidth, m_kernelHeight), tmp);
+		Union_Region(cleaned, tmp, m_regionRuns);
+		m_hasRegionRuns = true;
+
+		//the mask stays the output, only the fill's pixels need clearing before the region is drawn
+		Clear_Mask(m_regionMask, m_regionBounds);
+		m_regionRuns.To_Mask(m_regionMask);
+		return Status::SUCCESS;
+	}
+	catch (...)
+	{
+		return Status::FAILURE;
+	}
+}
+
+void ImageAnalysisService::Prepare_Region_Runs()
+{
+	//regions restored from the cache or grown by another fill are read back from the mask
+	if (!m_hasRegionRuns)
+	{
+		m_regionRuns.From_Mask(m_regionMask, m_regionArea);
+		m_hasRegionRuns = true;
+	}
+}
+
+void ImageAnalysisService::Finish_Region_Stats()
+{
+	//the fill gathered its moments as it went. Opening and closing only change pixels near its edges, so the
+	//cleaned region is compared with the kept fill a word at a time and only the pixels that differ are added or
+	//taken out. The same pass finds the region's exact bounding box
+	RegionMoments added, removed;
+	ImageStrip strip;
+	const BinaryMask &regionMask = m_regionMask;
+	const BinaryMask &fillMask = m_fillMask;
+	int top = -1, bottom = -1, left = m_width, right = -1;
+	if (!m_regionArea.empty())
+	{
+		int firstWord = m_regionArea.x >> 6;
+		int lastWord = (m_regionArea.x + m_regionArea.width - 1) >> 6;
+		for (int r = m_regionArea.y; r < m_regionArea.y + m_regionArea.height; ++r)
+		{
+			const uint64_t *region = regionMask.Row(r);
+			const uint64_t *fill = fillMask.Row(r);
+			for (int w = firstWord; w <= lastWord; ++w)
+			{
+				if (region[w] != 0)
+				{
+					if (top < 0)
+						top = r;
+					bottom = r;
+					left = std::min(left, (w << 6) + Lowest_Set_Bit(region[w]));
+					right = std::max(right, (w << 6) + Highest_Set_Bit(region[w]));
+				}
+				if (region[w] != fill[w])
+				{
+					const Vec3b *pixels = Input_Row(r, strip);
+					added.Add_Word(r, w << 6, region[w] & ~fill[w], pixels);
+					removed.Add_Word(r, w << 6, fill[w] & ~region[w], pixels);
+				}
+			}
+		}
+	}
+	m_regionMoments.Add(added);
+	m_regionMoments.Subtract(removed);
+	m_regionExtent = (top < 0) ? cv::Rect() : cv::Rect(left, top, right - left + 1, bottom - top + 1);
+}
+
+void ImageAnalysisService::Sum_Row_Moments(int first, int last)
+{
+	m_regionMoments.Clear();
+	for (int r = first; r < last; ++r)
+		m_regionMoments.Add(m_rowMoments[r]);
+}
+
+size_t ImageAnalysisService::Working_Bytes() const
+{
+	//the buffers a command may grow, what the running command holds besides them and a background save's copy
+	size_t bytes = m_heldBytes + m_saveBytes;
+	bytes += m_regionMask.Bytes() + m_perimeterMask.Bytes() + m_fillMask.Bytes() + m_candidateMask.Bytes()
+		+ m_scratchMasks[0].Bytes() + m_scratchMasks[1].Bytes() + m_regionRuns.Bytes() + m_perimeterRuns.Bytes()
+		+ m_scratchRuns[0].Bytes() + m_scratchRuns[1].Bytes() + m_scratchRuns[2].Bytes() + m_runScratch.Bytes();
+	const cv::Mat *images[] = { &m_perimeterImage, &m_smoothImage, &m_outputImage, &m_distanceMap, &m_levelMap };
+	for (int i = 0; i < 5; ++i)
+		bytes += images[i]->total() * images[i]->elemSize();
+	bytes += m_listPt.capacity() * sizeof(PointImg) + m_fillRuns.capacity() * sizeof(RowRun)
+		+ m_rowMoments.capacity() * sizeof(RegionMoments) + m_isRowClassified.capacity();
+	for (size_t c = 0; c < m_contours.size(); ++c)
+		bytes += m_contours[c].points.capacity() * sizeof(cv::Point2f);
+	return bytes + m_regionCache.Bytes();
+}
+
+ServiceUsage ImageAnalysisService::Service_Usage() const
+{
+	//the input image counts for every service sharing it, a streamed one by the strips loaded now
+	size_t bytes = m_inputImage.total() * m_inputImage.elemSize();
+	if (m_stripImage)
+		bytes += m_stripImage->Bytes();
+
+	ServiceUsage usage;
+	usage.workingBytes = bytes + Working_Bytes();
+	usage.cacheHits = m_regionCache.Hits();
+	usage.cacheMisses = m_regionCache.Misses();
+	return usage;
+}
+
+bool ImageAnalysisService::Prepare_Mask(BinaryMask &mask)
+{
+	//allocated on first use, and again only when the image size changes. A streamed image's masks are paged,
+	//they allocate the rows a region sets as it is grown
+	bool isPaged = (m_stripImage != nullptr);
+	if ((mask.Width() == m_width) && (mask.Height() == m_height) && (mask.Is_Paged() == isPaged))
+		return false;
+	if (isPaged)
+		mask.Create_Paged(m_width, m_height);
+	else
+		mask.Create(m_width, m_height);
+	return true;
+}
+
+void ImageAnalysisService::Clear_Mask(BinaryMask &mask, const cv::Rect &area)
+{
+	//only area can be set, so a paged mask gives all its pages back and holds nothing until the next region
+	if (mask.Is_Paged())
+		mask.Clear();
+	else
+		mask.Clear(area);
+}
+
+BinaryMask& ImageAnalysisService::Scratch_Mask(int index, const cv::Rect &area)
+{
+	BinaryMask &mask = m_scratchMasks[index];
+	if (!Prepare_Mask(mask))
+		Clear_Mask(mask, m_scratchAreas[index]);
+
+	//morphology writes whole words, so the area it may dirty is widened to word boundaries
+	cv::Rect bounds = area & cv::Rect(0, 0, m_width, m_height);
+	m_scratchAreas[index] = cv::Rect();
+	if (!bounds.empty())
+	{
+		int first = (bounds.x >> 6) << 6;
+		int last = std::min(m_width, (((bounds.x + bounds.width - 1) >> 6) + 1) << 6);
+		m_scratchAreas[index] = cv::Rect(first, bounds.y, last - first, bounds.height);
+	}
+	return mask;
+}
+
+void ImageAnalysisService::Prepare_Smooth_Images()
+{
+	//both smoothing images are allocated once per image size, after that only what the last smoothing spread over is cleared
+	if ((m_perimeterImage.rows != m_height) || (m_perimeterImage.cols != m_width) || (m_smoothImage.rows != m_height) || (m_smoothImage.cols != m_width))
+	{
+		m_perimeterImage = Mat::zeros(m_height, m_width, CV_8UC1);
+		m_smoothImage = Mat::zeros(m_height, m_width, CV_8UC1);
+	}
+	else if (!m_smoothArea.empty())
+	{
+		m_perimeterImage(m_smoothArea).setTo(0);
+		m_smoothImage(m_smoothArea).setTo(0);
+	}
+	m_smoothArea = m_perimeterArea;
+}
+
+RegionKey ImageAnalysisService::Region_Key()
+{
+	RegionKey key;
+	key.generation = m_imageGeneration;
+	key.colour = (m_seedPixel.red << 16) | (m_seedPixel.green << 8) | m_seedPixel.blue;
+	key.tolerance = m_tolerence;
+	key.kernelWidth = m_kernelWidth;
+	key.kernelHeight = m_kernelHeight;
+	return key;
+}
+
+void ImageAnalysisService::Restore_Region(const CachedRegion &entry, int seedX, int seedY)
+{
+	//the masks were cleared by the caller, only the cached areas need writing
+	m_regionBounds = entry.fillBounds;
+	m_regionArea = entry.regionArea;
+	m_regionMask.Copy_Rect(entry.region, cv::Rect(0, 0, m_regionArea.width, m_regionArea.height), m_regionArea.x, m_regionArea.y);
+	m_regionMoments = entry.regionMoments;
+	m_regionExtent = entry.regionExtent;
+	m_cacheEntryId = entry.id;
+
+	//the cached raw fill becomes the kept fill, so a larger tolerance can still resume
+	Clear_Mask(m_fillMask, m_fillBounds);
+	m_fillMask.Copy_Rect(entry.fill, cv::Rect(0, 0, m_regionBounds.width, m_regionBounds.height), m_regionBounds.x, m_regionBounds.y);
+	m_fillBounds = m_regionBounds;
+	m_fillMoments = entry.fillMoments;
+	m_fillSeed = PointImg(seedX, seedY);
+	m_fillColour = entry.key.colour;
+	m_fillTolerance = entry.key.tolerance;
+	m_hasFill = true;
+}
+
+Status ImageAnalysisService::Apply_Erosion(const BinaryMask &ipImage, BinaryMask &opImage, const cv::Rect &area)
+{
+	try
+	{
+		//both masks must be the same size
+		if ((ipImage.Width() != opImage.Width()) || (ipImage.Height() != opImage.Height()))
+			return Status::FAILURE;
+
+		//word wide AND over the structuring element, see Morphology.h
+		Erode_Rect(ipImage, opImage, m_kernelWidth, m_kernelHeight, area, Get_Thread_Pool(), Cancel_Flag());
+		return Is_Cancelled() ? Status::CANCELLED : Status::SUCCESS;
+	}
+	catch (...)
+	{
+		return Status::FAILURE;
+	}
+}
+
+Status ImageAnalysisService::Apply_Dialation(const BinaryMask &ipImage, BinaryMask &opImage, const cv::Rect &area)
+{
+	try
+	{
+		//both masks must be the same size
+		if ((ipImage.Width() != opImage.Width()) || (ipImage.Height() != opImage.Height()))
+			return Status::FAILURE;
+
+		//word wide OR over the structuring element, see Morphology.h
+		Dilate_Rect(ipImage, opImage, m_kernelWidth, m_kernelHeight, area, Get_Thread_Pool(), Cancel_Flag());
+		return Is_Cancelled() ? Status::CANCELLED : Status::SUCCESS;
+	}
+	catch (...)
+	{
+		return Status::FAILURE;
+	}
+}
+
+Status ImageAnalysisService::Apply_Opening(const BinaryMask &ipImage, BinaryMask &opImage, const cv::Rect &area)
+{
+	try
+	{
+		//both masks must be the same size
+		if ((ipImage.Width() != opImage.Width()) || (ipImage.Height() != opImage.Height()))
+			return Status::FAILURE;
+
+		//the intermediate goes to the first scratch mask, so neither image may be it
+		BinaryMask &tmpMask = Scratch_Mask(0, area);
+		Status val;
+
+		val = Apply_Erosion(ipImage, tmpMask, area);
+		if (val != Status::SUCCESS)
+			return val;
+
+		val = Apply_Dialation(tmpMask, opImage, area);
+		if (val != Status::SUCCESS)
+			return val;
+
+		return val;
+	}
+	catch (...)
+	{
+		return Status::FAILURE;
+	}
+}
+
+Status ImageAnalysisService::Apply_Closing(const BinaryMask &ipImage, BinaryMask &opImage, const cv::Rect &area)
+{
+	try
+	{
+		//both masks must be the same size
+		if ((ipImage.Width() != opImage.Width()) || (ipImage.Height() != opImage.Height()))
+			return Status::FAILURE;
+
+		//the intermediate goes to the first scratch mask, so neither image may be it
+		BinaryMask &tmpMask = Scratch_Mask(0, area);
+		Status val;
+
+		val = Apply_Dialation(ipImage, tmpMask, area);
+		if (val != Status::SUCCESS)
+			return val;
+
+		val = Apply_Erosion(tmpMask, opImage, area);
+		if (val != Status::SUCCESS)
+			return val;
+
+		return val;
+	}
+	catch (...)
+	{
+		return Status::FAILURE;
+	}
+}
+
+Status ImageAnalysisService::Apply_Gaussian_Smoothing(cv::Mat ipImage, cv::Mat opImage, const cv::Rect &area)
+{
+	try
+	{
+		//should only work with grayscale images
+		if ((ipImage.type() != CV_8UC1) || (opImage.type() != CV_8UC1))
+			return Status::FAILURE;
+
+		//separable fixed point passes, see Smoothing.h. Only the pixels inside area (and a kernel radius
+		//away from the image border) are filtered
+		Gaussian_Smooth(ipImage, opImage, m_smoothingKernel, area, Get_Thread_Pool(), Cancel_Flag(), m_simdLevel);
+		return Is_Cancelled() ? Status::CANCELLED : Status::SUCCESS;
+	}
+	catch (...)
+	{
+		return Status::FAILURE;
+	}
+}
+
+Status ImageAnalysisService::FIND_PERIMETER()
+{
+	try
+	{
+		if (!m_isRegionCalculated)
+			return Status::FAILURE;
+
+		StageTimer timer(m_instrumentation, STAGE_PERIMETER);
+		//reset perimeter image
+		Prepare_Mask(m_perimeterMask);
+		Clear_Mask(m_perimeterMask, m_perimeterArea);
+		m_isPerimeterSmoothed = false;
+		m_isPerimeterCalculated = false;
+		Release_Stream_Images();
+
+		//a cached region may already know its perimeter
+		const CachedRegion *cached = (m_cacheEntryId != 0) ? m_regionCache.Get(m_cacheEntryId) : nullptr;
+		if ((cached != nullptr) && cached->hasPerimeter)
+		{
+			m_perimeterArea = cached->perimeterArea;
+			m_perimeterMask.Copy_Rect(cached->perimeter, cv::Rect(0, 0, m_perimeterArea.width, m_perimeterArea.height), m_perimeterArea.x, m_perimeterArea.y);
+			m_perimeterLength = cached->perimeterLength;
+			timer.Add_Pixels((uint64_t)m_perimeterArea.area());
+			m_isPerimeterCalculated = true;
+			return Status::SUCCESS;
+		}
+
+		if (m_regionFormat == RegionFormat::RUN_LENGTH)
+		{
+			//erosion and subtraction on the region's runs, then drawn into the mask
+			Prepare_Region_Runs();
+			Boundary_Rect(m_regionRuns, m_perimeterRuns, m_kernelWidth, m_kernelHeight, m_runScratch);
+			m_perimeterArea = m_regionExtent;
+			m_perimeterRuns.To_Mask(m_perimeterMask);
+			m_perimeterLength = m_perimeterRuns.Area();
+		}
+		else
+		{
+			//erosion and subtraction fused into one pass over the region's exact bounding box, which also counts the perimeter
+			m_perimeterArea = m_regionExtent;
+			m_perimeterLength = Boundary_Rect(m_regionMask, m_perimeterMask, m_kernelWidth, m_kernelHeight, m_perimeterArea, Get_Thread_Pool(), Cancel_Flag());
+		}
+		if (Is_Cancelled())
+			return Status::CANCELLED;
+		if (!Reserve_Stream_Memory())
+		{
+			Clear_Mask(m_perimeterMask, m_perimeterArea);
+			m_perimeterArea = cv::Rect();
+			Reserve_Stream_Memory();
+			return Status::OVER_MEMORY_BUDGET;
+		}
+		//the entry is looked up again by id, making room may have evicted it
+		if ((cached != nullptr) && Reserve_Stream_Memory(Crop_Bytes(m_perimeterArea)))
+			m_regionCache.Store_Perimeter(m_cacheEntryId, m_perimeterMask, m_perimeterArea, m_perimeterLength);
+
+		timer.Add_Pixels((uint64_t)m_perimeterArea.area());
+		m_isPerimeterCalculated = true;
+		return Status::SUCCESS;
+	}
+	catch (...)
+	{
+		m_isPerimeterCalculated = false;
+		return Status::FAILURE;
+	}
+}
+
+
+Status ImageAnalysisService::DISPLAY_IMAGE()
+{
+	try
+	{
+		//a streamed image is never loaded as a whole
+		if (m_stripImage)
+			return Status::FAILURE;
+
+		SHOW_MAT(m_inputImage, "Input Image");
+		return Status::SUCCESS;
+	}
+	catch (...)
+	{
+		return Status::FAILURE;
+	}
+}
+
+Status ImageAnalysisService::DISPLAY_PIXELS(OutputImageType type)
+{
+	try
+	{
+		cv::Mat opImage;
+		Status val = Get_Output_Image(type, opImage);
+		if (val != Status::SUCCESS)
+			return val;
+
+		switch (type)
+		{
+		case REGION:
+			SHOW_MAT(opImage, "Region Image");
+			break;
+		case PERIMETER:
+			SHOW_MAT(opImage, "Perimeter Image");
+			break;
+		default:
+			return Status::FAILURE;
+			break;
+		}
+		//as for GET_PIXELS, a streamed image's budget only held the 8 bit image while it was shown
+		if (m_stripImage)
+		{
+			m_outputImage.release();
+			Reserve_Stream_Memory();
+		}
+		return Status::SUCCESS;
+	}
+	catch (...)
+	{
+		return Status::FAILURE;
+	}
+}
+
+Status ImageAnalysisService::SAVE_PIXELS(OutputImageType type, std::string& filename)
+{
+	return SAVE_PIXELS(type, filename, SaveOptions());
+}
+
+Status ImageAnalysisService::SAVE_PIXELS(OutputImageType type, std::string& filename, const SaveOptions &options)
+{
+	try
+	{
+		//a background save is timed up to handing it to the writer thread
+		StageTimer timer(m_instrumentation, STAGE_SAVE);
+		timer.Add_Pixels((uint64_t)m_width * m_height);
+
+		//a streamed image's budget holds the copy a save encodes until it is written, so earlier saves are finished first
+		bool isImage = (options.format == IMAGE_FILE) || (options.format == PNG_1BIT);
+		size_t copyBytes = 0;
+		if (m_stripImage)
+		{
+			Collect_Saves(true);
+			if (isImage)
+				copyBytes = options.isBackground ? (size_t)m_width * m_height : 0;
+			else if ((type == PERIMETER) && m_isPerimeterSmoothed)
+				copyBytes = Crop_Bytes(cv::Rect(0, 0, m_width, m_height));
+			else
+				copyBytes = (type == PERIMETER) ? m_perimeterMask.Bytes() : m_regionMask.Bytes();
+		}
+		HeldBytes held(m_heldBytes, copyBytes);
+		if (!Reserve_Stream_Memory())
+			return Status::OVER_MEMORY_BUDGET;
+
+		//1 bit formats are written from the mask bits, the 8 bit image is only built for imwrite
+		std::shared_ptr<cv::Mat> image;
+		std::shared_ptr<BinaryMask> mask;
+		Status val;
+		if (isImage)
+		{
+			cv::Mat opImage;
+			val = Get_Output_Image(type, opImage);
+			if (val != Status::SUCCESS)
+				return val;
+			//a background save gets its own copy, the output buffers are reused by the next command
+			image = std::make_shared<cv::Mat>(options.isBackground ? opImage.clone() : opImage);
+		}
+		else
+		{
+			mask = std::make_shared<BinaryMask>();
+			val = Get_Output_Mask(type, *mask);
+			if (val != Status::SUCCESS)
+				return val;
+		}
+
+		std::string path = filename;
+		SaveOptions settings = options;
+		std::shared_ptr<ThreadPool> pool = m_threadPool;
+		auto write = [image, mask, path, settings, pool]() -> bool
+		{
+			ThreadPool *bands = pool ? pool.get() : &ThreadPool::Shared();
+			std::vector<int> params;
+			if (settings.compression >= 0)
+			{
+				params.push_back(IMWRITE_PNG_COMPRESSION);
+				params.push_back(std::min(settings.compression, 9));
+			}
+			switch (settings.format)
+			{
+			case PNG_1BIT:
+				params.push_back(IMWRITE_PNG_BILEVEL);
+				params.push_back(1);
+				return imwrite(path, *image, params);
+			case TIFF_1BIT:
+				return Write_Tiff_Mask(path, *mask, settings.compression != 0, bands);
+			case RLE_MASK:
+				return Write_Rle_Mask(path, *mask, bands);
+			default:
+				return imwrite(path, *image, params);
+			}
+		};
+
+		if (!options.isBackground)
+		{
+			bool isWritten = write();
+			if (m_stripImage)
+				m_outputImage.release();
+			held.Release();
+			Reserve_Stream_Memory();
+			return isWritten ? Status::SUCCESS : Status::FAILURE;
+		}
+
+		//a pool of two threads has one worker, so saves are written in the order they were asked for
+		if (!m_saveWorker)
+			m_saveWorker.reset(new ThreadPool(2));
+		Collect_Saves(false);
+		auto task = std::make_shared<std::packaged_task<bool()>>(write);
+		m_pendingSaves.push_back(task->get_future());
+		m_saveWorker->Submit([task] { (*task)(); });
+		if (m_stripImage)
+		{
+			m_saveBytes = copyBytes;
+			m_outputImage.release();
+		}
+		held.Release();
+		Reserve_Stream_Memory();
+		return Status::SUCCESS;
+	}
+	catch (...)
+	{
+		return Status::FAILURE;
+	}
+}
+
+Status ImageAnalysisService::FLUSH_SAVES()
+{
+	try
+	{
+		Collect_Saves(true);
+		bool isFailed = m_isSaveFailed;
+		m_isSaveFailed = false;
+		return isFailed ? Status::FAILURE : Status::SUCCESS;
+	}
+	catch (...)
+	{
+		return Status::FAILURE;
+	}
+}
+
+Status ImageAnalysisService::GET_PIXELS(OutputImageType type, cv::Mat &opImage)
+{
+	try
+	{
+		//the service reuses its output buffers, so the caller gets its own copy
+		cv::Mat image;
+		Status val = Get_Output_Image(type, image);
+		if (val != Status::SUCCESS)
+			return val;
+
+		opImage = image.clone();
+		//a streamed image's budget only held the 8 bit image while it was built
+		if (m_stripImage)
+		{
+			m_outputImage.release();
+			Reserve_Stream_Memory();
+		}
+		return Status::SUCCESS;
+	}
+	catch (...)
+	{
+		return Status::FAILURE;
+	}
+}
+
+Status ImageAnalysisService::FIND_CONTOURS()
+{
+	try
+	{
+		if (!m_isRegionCalculated)
+			return Status::FAILURE;
+
+		//borders only start at the ends of runs, so the scan goes over the region's runs and the tracing
+		//over its border pixels. The scratch masks remember which pixels the tracing went through
+		StageTimer timer(m_instrumentation, STAGE_CONTOURS);
+		m_isContourCalculated = false;
+		Prepare_Region_Runs();
+		BinaryMask &marked = Scratch_Mask(0, m_regionArea);
+		BinaryMask &negative = Scratch_Mask(1, m_regionArea);
+		Trace_Contours(m_regionMask, m_regionRuns, marked, negative, m_contours);
+		for (size_t c = 0; c < m_contours.size(); ++c)
+			timer.Add_Pixels(m_contours[c].points.size());
+		m_isContourCalculated = true;
+		return Status::SUCCESS;
+	}
+	catch (...)
+	{
+		m_isContourCalculated = false;
+		return Status::FAILURE;
+	}
+}
+
+Status ImageAnalysisService::SMOOTH_CONTOURS(ContourSmoothing method, double amount)
+{
+	try
+	{
+		if (!m_isContourCalculated)
+			return Status::FAILURE;
+		//each Chaikin pass doubles the points, and the counts are cast to int below
+		if (!(amount >= 0) || ((method == CHAIKIN) && (amount > MAX_CHAIKIN_PASSES)) || ((method == MOVING_AVERAGE) && (amount > INT_MAX)))
+			return Status::AMOUNT_OUT_OF_RANGE;
+
+		for (size_t c = 0; c < m_contours.size(); ++c)
+		{
+			switch (method)
+			{
+			case MOVING_AVERAGE:
+				Smooth_Moving_Average(m_contours[c], (int)amount);
+				break;
+			case CHAIKIN:
+				Smooth_Chaikin(m_contours[c], (int)amount);
+				break;
+			case DOUGLAS_PEUCKER:
+				Simplify_Douglas_Peucker(m_contours[c], amount);
+				break;
+			default:
+				return Status::FAILURE;
+			}
+		}
+		return Status::SUCCESS;
+	}
+	catch (...)
+	{
+		return Status::FAILURE;
+	}
+}
+
+Status ImageAnalysisService::GET_CONTOURS(std::vector<Contour> &contours)
+{
+	try
+	{
+		if (!m_isContourCalculated)
+			return Status::FAILURE;
+
+		contours = m_contours;
+		return Status::SUCCESS;
+	}
+	catch (...)
+	{
+		return Status::FAILURE;
+	}
+}
+
+Status ImageAnalysisService::SAVE_CONTOURS(std::string& filename)
+{
+	try
+	{
+		if (!m_isContourCalculated)
+			return Status::FAILURE;
+
+		return Write_Contours(filename, m_contours, m_width, m_height) ? Status::SUCCESS : Status::FAILURE;
+	}
+	catch (...)
+	{
+		return Status::FAILURE;
+	}
+}
+
+Status ImageAnalysisService::FIND_SMOOTH_PERIMETER()
+{
+	try
+	{
+		if (!m_isPerimeterCalculated)
+			return Status::FAILURE;
+
+		//a streamed image's budget has to have room for the two smoothing images
+		bool isAllocated = (m_perimeterImage.rows == m_height) && (m_perimeterImage.cols == m_width)
+			&& (m_smoothImage.rows == m_height) && (m_smoothImage.cols == m_width);
+		HeldBytes held(m_heldBytes, (m_stripImage && !isAllocated) ? 2 * (size_t)m_width * m_height : 0);
+		if (!Reserve_Stream_Memory())
+			return Status::OVER_MEMORY_BUDGET;
+
+		StageTimer timer(m_instrumentation, STAGE_SMOOTHING);
+		//the first smoothing starts from the binary perimeter, later ones smooth the result again
+		if (!m_isPerimeterSmoothed)
+		{
+			Prepare_Smooth_Images();
+			m_perimeterMask.To_Mat(m_perimeterImage, m_perimeterArea);
+		}
+
+		//every pass spreads the perimeter by the filter radius
+		const int radius = m_smoothingKernel.radius;
+		m_perimeterArea = cv::Rect(m_perimeterArea.x - radius, m_perimeterArea.y - radius, m_perimeterArea.width + 2 * radius, m_perimeterArea.height + 2 * radius);
+		m_perimeterArea &= cv::Rect(0, 0, m_width, m_height);
+		m_smoothArea |= m_perimeterArea;
+
+		//the two smoothing images ping-pong, the filter skips the image border so that is cleared here
+		Status val = Apply_Gaussian_Smoothing(m_perimeterImage, m_smoothImage, m_perimeterArea);
+		timer.Add_Pixels((uint64_t)m_perimeterArea.area());
+		if (val == Status::CANCELLED)
+		{
+			//a cancelled command leaves no perimeter behind, FIND_PERIMETER has to run again
+			Clear_Mask(m_perimeterMask, m_perimeterArea);
+			m_perimeterArea = cv::Rect();
+			m_isPerimeterSmoothed = false;
+			m_isPerimeterCalculated = false;
+			return val;
+		}
+		if (val != Status::SUCCESS)
+		{
+			//the next smoothing starts over from the binary perimeter
+			m_isPerimeterSmoothed = false;
+			return val;
+		}
+		cv::Rect edges[4] =
+		{
+			cv::Rect(0, 0, m_width, radius), cv::Rect(0, m_height - radius, m_width, radius),
+			cv::Rect(0, 0, radius, m_height), cv::Rect(m_width - radius, 0, radius, m_height)
+		};
+		for (int e = 0; e < 4; ++e)
+			if (!(edges[e] & m_perimeterArea).empty())
+				m_smoothImage(edges[e] & m_perimeterArea).setTo(0);
+		std::swap(m_perimeterImage, m_smoothImage);
+		m_isPerimeterSmoothed = true;
+		return Status::SUCCESS;
+	}
+	catch (...)
+	{
+		return Status::FAILURE;
+	}
+}
+
+Status ImageAnalysisService::Flood_Fill_Forrest_Fire(int seedX, int seedY)
+{
+	try
+	{
+		const Vec3b* tmp;
+		ImageStrip strip;
+		Pixel currentPixel;
+
+		PointImg pnt(seedX, seedY);
+
+		int top = m_height, bottom = -1, left = m_width, right = -1;
+		m_regionMoments.Clear();
+
+		//maintain a list of node
+		m_listPt.clear();
+		m_listPt.push_back(pnt);
+		int steps = 0;
+		size_t listPeak = 1;
+		m_testedPixels = 0;
+		while (!m_listPt.empty())
+		{
+			if ((++steps % CANCEL_CHECK_STEPS == 0) && Is_Cancelled())
+				return Status::CANCELLED;
+			listPeak = std::max(listPeak, m_listPt.size());
+			++m_testedPixels;
+
+			PointImg pnt = m_listPt.back();
+			seedX = pnt.X;
+			seedY = pnt.Y;
+
+			//get last node
+			m_listPt.pop_back();
+
+			tmp = Input_Row(seedX, strip);
+			currentPixel.red = tmp[seedY][0];
+			currentPixel.green = tmp[seedY][1];
+			currentPixel.blue = tmp[seedY][2];
+
+			//if already visited continue
+			if (m_regionMask.Get(seedX, seedY))
+				continue;
+
+			if ((abs(currentPixel.red - m_seedPixel.red) < m_tolerence) && (abs(currentPixel.green - m_seedPixel.green) < m_tolerence) && (abs(currentPixel.blue - m_seedPixel.blue) < m_tolerence))
+			{
+				m_regionMask.Set(seedX, seedY);
+				m_regionMoments.Add_Pixel(seedX, seedY, tmp[seedY]);
+				top = std::min(top, seedX);
+				bottom = std::max(bottom, seedX);
+				left = std::min(left, seedY);
+				right = std::max(right, seedY);
+
+				if ((seedX + 1) < m_height)
 				{
 					m_listPt.push_back(PointImg((seedX + 1), seedY));
 				}
@@ -491,7 +1848,7 @@ Status ImageAnalysisService::Flood_Fill_Forrest_Fire(int seedX, int seedY)
 				{
 					m_listPt.push_back(PointImg((seedX - 1), seedY));
 				}
-				if ((seedY + 1) < m_height)
+				if ((seedY + 1) < m_width)
 				{
 					m_listPt.push_back(PointImg(seedX, (seedY + 1)));
 				}
@@ -505,13 +1862,621 @@ Status ImageAnalysisService::Flood_Fill_Forrest_Fire(int seedX, int seedY)
 				continue;
 			}
 		}
+
+		m_regionBounds = (bottom < 0) ? cv::Rect() : cv::Rect(left, top, right - left + 1, bottom - top + 1);
+		m_instrumentation.Record_List_Peak(listPeak);
+		return Status::SUCCESS;
+	}
+	catch (...)
+	{
+		return Status::FAILURE;
+	}
+
+}
+
+//last column of the run of set bits in (candidate & ~visited) that starts at column j
+static int Find_Run_End(const uint64_t *candidate, const uint64_t *visited, int j, int last)
+{
+	int w = j >> 6;
+	uint64_t stop = ~(candidate[w] & ~visited[w]) & (~0ULL << (j & 63));
+	while (stop == 0)
+	{
+		++w;
+		if ((w << 6) > last)
+			return last;
+		stop = ~(candidate[w] & ~visited[w]);
+	}
+	int end = (w << 6) + Lowest_Set_Bit(stop) - 1;
+	return (end < last) ? end : last;
+}
+
+//first column of the run of set bits in (candidate & ~visited) that ends at column j
+static int Find_Run_Start(const uint64_t *candidate, const uint64_t *visited, int j, int first)
+{
+	int w = j >> 6;
+	uint64_t stop = ~(candidate[w] & ~visited[w]) & ((2ULL << (j & 63)) - 1);
+	while (stop == 0)
+	{
+		if ((w << 6) <= first)
+			return first;
+		--w;
+		stop = ~(candidate[w] & ~visited[w]);
+	}
+	int start = (w << 6) + Highest_Set_Bit(stop) + 1;
+	return (start > first) ? start : first;
+}
+
+Status ImageAnalysisService::Flood_Fill_Scanline(int seedX, int seedY)
+{
+	try
+	{
+		//the stack only holds the first pixel of each candidate run
+		m_listPt.clear();
+		m_listPt.push_back(PointImg(seedX, seedY));
+		m_regionBounds = cv::Rect();
+		m_regionMoments.Clear();
+
+		//a RUN_LENGTH region is built from the runs as they are found
+		m_fillRuns.clear();
+		m_isCollectingRuns = (m_regionFormat == RegionFormat::RUN_LENGTH);
+		Status val = Grow_Runs();
+		m_isCollectingRuns = false;
+		m_hasFillRuns = (val == Status::SUCCESS) && (m_regionFormat == RegionFormat::RUN_LENGTH);
+		return val;
+	}
+	catch (...)
+	{
+		return Status::FAILURE;
+	}
+}
+
+Status ImageAnalysisService::Grow_Runs()
+{
+	try
+	{
+		//same X = row, Y = column convention and the same neighbour rules as Flood_Fill_Forrest_Fire,
+		//row 0 and column 0 are only entered from the seed itself, so both fills give the same mask
+		const uint64_t *candidate;
+		uint64_t *visited;
+		ImageStrip strip;
+		int left, right;
+		int top = m_height, bottom = -1, regionLeft = m_width, regionRight = -1;
+		if (!m_regionBounds.empty())
+		{
+			top = m_regionBounds.y;
+			bottom = m_regionBounds.y + m_regionBounds.height - 1;
+			regionLeft = m_regionBounds.x;
+			regionRight = m_regionBounds.x + m_regionBounds.width - 1;
+		}
+
+		//rows come from the candidate mask set up by Prepare_Candidates, the fill itself only looks at bits
+		//and the region mask doubles as the visited set
+		int steps = 0;
+		size_t listPeak = m_listPt.size();
+		while (!m_listPt.empty())
+		{
+			if (++steps % CANCEL_CHECK_STEPS == 0)
+			{
+				if (Is_Cancelled())
+					return Status::CANCELLED;
+				//a streamed image's reservation follows the pages and stack the fill has grown
+				if (!Reserve_Stream_Memory())
+					return Status::OVER_MEMORY_BUDGET;
+			}
+			listPeak = std::max(listPeak, m_listPt.size());
+
+			PointImg pnt = m_listPt.back();
+			m_listPt.pop_back();
+
+			candidate = Candidate_Row(pnt.X);
+			visited = m_regionMask.Row(pnt.X);
+
+			//if already visited or out of tolerance continue
+			if (((candidate[pnt.Y >> 6] & ~visited[pnt.Y >> 6]) & (1ULL << (pnt.Y & 63))) == 0)
+				continue;
+
+			//extend the run to the left and right as far as it goes
+			left = Find_Run_Start(candidate, visited, pnt.Y, (pnt.Y > 0) ? 1 : 0);
+			right = Find_Run_End(candidate, visited, pnt.Y, m_width - 1);
+
+			m_regionMask.Set_Run(pnt.X, left, right);
+			m_regionMoments.Add_Run(pnt.X, left, right, Input_Row(pnt.X, strip));
+			if (m_isCollectingRuns)
+				m_fillRuns.push_back(RowRun{ pnt.X, left, right });
+			top = std::min(top, pnt.X);
+			bottom = std::max(bottom, pnt.X);
+			regionLeft = std::min(regionLeft, left);
+			regionRight = std::max(regionRight, right);
+
+			//queue the runs touching this one in the rows below and above
+			if ((pnt.X + 1) < m_height)
+				Push_Span_Seeds(pnt.X + 1, left, right);
+			if ((pnt.X - 1) > 0)
+				Push_Span_Seeds(pnt.X - 1, left, right);
+		}
+
+		m_regionBounds = (bottom < 0) ? cv::Rect() : cv::Rect(regionLeft, top, regionRight - regionLeft + 1, bottom - top + 1);
+		m_instrumentation.Record_List_Peak(listPeak);
+		return Status::SUCCESS;
+	}
+	catch (...)
+	{
+		return Status::FAILURE;
+	}
+}
+
+Status ImageAnalysisService::Flood_Fill_Levels()
+{
+	try
+	{
+		//the fill at any tolerance is every pixel whose flood level is below it
+		std::vector<int> rowLeft(m_height), rowRight(m_height);
+		m_rowMoments.resize(m_height);
+
+		//every row is written at the same time, so a paged mask has them allocated first
+		{
+			HeldBytes held(m_heldBytes, m_regionMask.Is_Paged() ? Crop_Bytes(cv::Rect(0, 0, m_width, m_height)) : 0);
+			if (!Reserve_Stream_Memory())
+				return Status::OVER_MEMORY_BUDGET;
+		}
+		m_regionMask.Allocate(cv::Rect(0, 0, m_width, m_height));
+		Get_Thread_Pool()->Parallel_For(0, m_height, 16, [&](int first, int last)
+		{
+			ImageStrip strip;
+			for (int i = first; (i < last) && !Is_Cancelled(); ++i)
+			{
+				uint64_t *words = m_regionMask.Row(i);
+				Threshold_Level_Row(m_levelMap.ptr<uint16_t>(i), m_width, m_tolerence, words);
+
+				rowLeft[i] = m_width;
+				rowRight[i] = -1;
+				m_rowMoments[i].Clear();
+				for (int w = 0; w < m_regionMask.Words_Per_Row(); ++w)
+					if (words[w] != 0)
+					{
+						rowLeft[i] = std::min(rowLeft[i], (w << 6) + Lowest_Set_Bit(words[w]));
+						rowRight[i] = (w << 6) + Highest_Set_Bit(words[w]);
+						m_rowMoments[i].Add_Word(i, w << 6, words[w], Input_Row(i, strip));
+					}
+			}
+		});
+		if (Is_Cancelled())
+			return Status::CANCELLED;
+		Sum_Row_Moments(0, m_height);
+		m_testedPixels = (uint64_t)m_width * m_height;
+
+		int top = -1, bottom = -1, left = m_width, right = -1;
+		for (int i = 0; i < m_height; ++i)
+		{
+			if (rowRight[i] < 0)
+				continue;
+			if (top < 0)
+				top = i;
+			bottom = i;
+			left = std::min(left, rowLeft[i]);
+			right = std::max(right, rowRight[i]);
+		}
+		m_regionBounds = (top < 0) ? cv::Rect() : cv::Rect(left, top, right - left + 1, bottom - top + 1);
+		return Status::SUCCESS;
+	}
+	catch (...)
+	{
+		return Status::FAILURE;
+	}
+}
+
+bool ImageAnalysisService::Has_Level_Map(int seedX, int seedY)
+{
+	//an interior seed inside the level seed's fill grows the same fill
+	if ((m_levelSeed.X < 0) || (Region_Key().colour != m_distanceColour))
+		return false;
+
+	bool isSamePixel = (m_levelSeed.X == seedX) && (m_levelSeed.Y == seedY);
+	bool isInside = (seedX > 0) && (seedY > 0) && (m_levelSeed.X > 0) && (m_levelSeed.Y > 0)
+		&& (m_levelMap.ptr<uint16_t>(seedX)[seedY] < m_tolerence);
+	return isSamePixel || isInside;
+}
+
+Status ImageAnalysisService::Resume_Fill(int seedX, int seedY)
+{
+	try
+	{
+		//the previous fill is part of the region at a larger tolerance and is the visited set to start from,
+		//only the pixels it rejected can let the fill go further
+		m_regionMask.Copy_Rect(m_fillMask, m_fillBounds, m_fillBounds.x, m_fillBounds.y);
+		m_regionBounds = m_fillBounds;
+		m_regionMoments = m_fillMoments;
+
+		m_listPt.clear();
+		m_listPt.push_back(PointImg(seedX, seedY));
+		Push_Frontier();
+		return Grow_Runs();
+	}
+	catch (...)
+	{
+		return Status::FAILURE;
+	}
+}
+
+void ImageAnalysisService::Push_Frontier()
+{
+	//pixels one step out of the previous fill under the fill's neighbour rules that are candidates now
+	cv::Rect area(m_fillBounds.x - 1, m_fillBounds.y - 1, m_fillBounds.width + 2, m_fillBounds.height + 2);
+	area &= cv::Rect(0, 0, m_width, m_height);
+	if (m_fillBounds.empty() || area.empty())
+		return;
+
+	const BinaryMask &fillMask = m_fillMask;
+	int wordsPerRow = fillMask.Words_Per_Row();
+	int firstWord = area.x >> 6;
+	int lastWord = (area.x + area.width - 1) >> 6;
+	for (int r = area.y; r < area.y + area.height; ++r)
+	{
+		const uint64_t *fill = fillMask.Row(r);
+		const uint64_t *above = (r > 0) ? fillMask.Row(r - 1) : nullptr;
+		//steps up into row 0 are not allowed
+		const uint64_t *below = ((r > 0) && (r + 1 < m_height)) ? fillMask.Row(r + 1) : nullptr;
+		const uint64_t *candidate = Candidate_Row(r);
+
+		for (int w = firstWord; w <= lastWord; ++w)
+		{
+			uint64_t fromLeft = (fill[w] << 1) | ((w > 0) ? (fill[w - 1] >> 63) : 0);
+			uint64_t fromRight = (fill[w] >> 1) | ((w + 1 < wordsPerRow) ? (fill[w + 1] << 63) : 0);
+			//steps left into column 0 are not allowed
+			if (w == 0)
+				fromRight &= ~1ULL;
+
+			uint64_t reach = fromLeft | fromRight;
+			if (above != nullptr)
+				reach |= above[w];
+			if (below != nullptr)
+				reach |= below[w];
+
+			uint64_t front = reach & candidate[w] & ~fill[w];
+			while (front != 0)
+			{
+				m_listPt.push_back(PointImg(r, (w << 6) + Lowest_Set_Bit(front)));
+				front &= front - 1;
+			}
+		}
+	}
+}
+
+bool ImageAnalysisService::Can_Resume(int seedX, int seedY)
+{
+	//a seed that grows the kept fill at its tolerance grows a superset of it at any larger one
+	if (!m_isFillResumed || !m_hasFill || (Region_Key().colour != m_fillColour) || (m_tolerence < m_fillTolerance))
+		return false;
+
+	bool isSamePixel = (m_fillSeed.X == seedX) && (m_fillSeed.Y == seedY);
+	bool isInside = (seedX > 0) && (seedY > 0) && (m_fillSeed.X > 0) && (m_fillSeed.Y > 0) && m_fillMask.Get(seedX, seedY);
+	return isSamePixel || isInside;
+}
+
+void ImageAnalysisService::Keep_Fill(int seedX, int seedY)
+{
+	Clear_Mask(m_fillMask, m_fillBounds);
+	m_fillMask.Copy_Rect(m_regionMask, m_regionBounds, m_regionBounds.x, m_regionBounds.y);
+	m_fillBounds = m_regionBounds;
+	m_fillMoments = m_regionMoments;
+	m_fillSeed = PointImg(seedX, seedY);
+	m_fillColour = Region_Key().colour;
+	m_fillTolerance = m_tolerence;
+	m_hasFill = true;
+}
+
+Status ImageAnalysisService::Flood_Fill_Parallel(int seedX, int seedY)
+{
+	try
+	{
+		//pixels in row 0 and column 0 are never entered from a neighbour, so a seed anywhere else
+		//grows exactly the 4-connected component of rows 1.. and columns 1.. that holds it.
+		//seeds on the first row or column are left to the scanline fill
+		if ((seedX == 0) || (seedY == 0))
+			return Flood_Fill_Scanline(seedX, seedY);
+
+		//every row is needed here, so classify the rest of the image up front
+		ThreadPool *pool = Get_Thread_Pool();
+		pool->Parallel_For(0, m_height, 16, [&](int first, int last)
+		{
+			for (int r = first; (r < last) && !Is_Cancelled(); ++r)
+				Candidate_Row(r);
+		});
+		if (Is_Cancelled())
+			return Status::CANCELLED;
+		Report_Progress(0.25f);
+
+		//the moments are gathered per row as the component's runs are written
+		m_rowMoments.resize(m_height);
+		for (int r = 0; r < m_height; ++r)
+			m_rowMoments[r].Clear();
+		m_regionBounds = Extract_Component(m_candidateMask, cv::Rect(1, 1, m_width - 1, m_height - 1), seedX, seedY, m_regionMask, pool,
+			[this](int row, int first, int last)
+		{
+			ImageStrip strip;
+			m_rowMoments[row].Add_Run(row, first, last, Input_Row(row, strip));
+		});
+		Sum_Row_Moments(m_regionBounds.y, m_regionBounds.y + m_regionBounds.height);
 		return Status::SUCCESS;
 	}
 	catch (...)
 	{
 		return Status::FAILURE;
 	}
+}
+
+void ImageAnalysisService::Push_Span_Seeds(int row, int left, int right)
+{
+	const uint64_t *candidate = Candidate_Row(row);
+	const uint64_t *visited = m_regionMask.Row(row);
+	uint64_t carry = 0;
+
+	for (int w = left >> 6; w <= (right >> 6); ++w)
+	{
+		uint64_t open = candidate[w] & ~visited[w];
+		if (w == (left >> 6))
+			open &= ~0ULL << (left & 63);
+		if (w == (right >> 6))
+			open &= (2ULL << (right & 63)) - 1;
+
+		//one seed per run, the popped seed extends over the rest of it
+		uint64_t starts = open & ~((open << 1) | carry);
+		carry = open >> 63;
+		while (starts != 0)
+		{
+			m_listPt.push_back(PointImg(row, (w << 6) + Lowest_Set_Bit(starts)));
+			starts &= starts - 1;
+		}
+	}
+}
+
+void ImageAnalysisService::Prepare_Candidates()
+{
+	//pixels are classified against m_seedPixel a whole row at a time into a bit mask, lazily on first use.
+	//Rows are overwritten when they are classified again, a paged mask gives its pages back instead
+	if (!Prepare_Mask(m_candidateMask) && m_candidateMask.Is_Paged())
+		m_candidateMask.Clear();
+	m_isRowClassified.assign(m_height, 0);
+
+	Vec3b seed;
+	seed[0] = (uchar)m_seedPixel.red;
+	seed[1] = (uchar)m_seedPixel.green;
+	seed[2] = (uchar)m_seedPixel.blue;
+	m_classifier.Set_Seed(seed, m_tolerence);
+
+	//with a distance map of this colour a row is a single compare
+	m_isDistanceUsed = (m_distanceColour == Region_Key().colour);
+}
+
+const uint64_t* ImageAnalysisService::Candidate_Row(int row)
+{
+	uint64_t *candidate = m_candidateMask.Row(row);
+	if (!m_isRowClassified[row])
+	{
+		if (m_isDistanceUsed)
+			Threshold_Distance_Row(m_distanceMap.ptr<uchar>(row), m_width, m_tolerence, candidate);
+		else
+		{
+			ImageStrip strip;
+			m_classifier.Classify_Row(Input_Row(row, strip), m_width, candidate);
+		}
+		m_isRowClassified[row] = 1;
+	}
+	return candidate;
+}
+
+void ImageAnalysisService::Load_Raw_Cache(std::string& filename)
+{
+	//the decoded image is kept next to the source as a raw file, written on the first load and
+	//mapped without a copy on every load after that
+	uint64_t size, time;
+	bool isStamped = Get_File_Stamp(filename, size, time);
+	std::string cachePath = filename + RAW_IMAGE_EXTENSION;
+	if (isStamped && Map_Raw_Image(cachePath, size, time))
+		return;
+
+	cv::Mat decoded = imread(filename, 1);
+	if (!decoded.data)
+		return;
+
+	//without a stamp or a usable cache file the decoded image is used as it is, IsRawCacheMissed tells the caller
+	if (!isStamped || !Write_Raw_Image(cachePath, decoded, size, time) || !Map_Raw_Image(cachePath, size, time))
+	{
+		m_inputImage = decoded;
+		m_isRawCacheMissed = true;
+	}
+}
+
+bool ImageAnalysisService::Map_Raw_Image(const std::string &path, uint64_t sourceSize, uint64_t sourceTime)
+{
+	std::shared_ptr<MappedFile> mapped = std::make_shared<MappedFile>();
+	if (!mapped->Open(path))
+		return false;
+
+	//a cache made from another version of the source is stale
+	RawImageHeader header;
+	bool isValid = mapped->Size() >= sizeof(header);
+	if (isValid)
+	{
+		memcpy(&header, mapped->Data(), sizeof(header));
+		isValid = Is_Valid_Raw_Header(header) && (header.sourceSize == sourceSize) && (header.sourceTime == sourceTime)
+			&& (mapped->Size() >= header.dataOffset + (uint64_t)header.rowBytes * header.height);
+	}
+	if (!isValid)
+		return false;
+
+	//the Mat only points into the mapping, the pages are read only
+	m_mappedImage = mapped;
+	m_inputImage = cv::Mat((int)header.height, (int)header.width, CV_8UC3,
+		(void*)(m_mappedImage->Data() + header.dataOffset), header.rowBytes);
+	return true;
+}
+
+const Vec3b* ImageAnalysisService::Input_Row(int row, ImageStrip &strip)
+{
+	if (!m_stripImage)
+		return m_inputImage.ptr<Vec3b>(row);
+
+	//strip keeps the rows alive and saves a cache lookup while the caller stays inside it
+	if (!strip.Contains(row))
+		strip = m_stripImage->Strip_For_Row(row);
+	return strip.rows->ptr<Vec3b>(row - strip.firstRow);
+}
+
+Status ImageAnalysisService::Get_Output_Image(OutputImageType type, cv::Mat &opImage)
+{
+	//masks are only expanded to 8 bit images here, for showing and saving. A streamed image's memory
+	//budget has to have room for the image
+	bool isSmoothed = (type == PERIMETER) && m_isPerimeterSmoothed;
+	if (m_stripImage && !isSmoothed && ((m_outputImage.rows != m_height) || (m_outputImage.cols != m_width)))
+	{
+		HeldBytes held(m_heldBytes, (size_t)m_width * m_height);
+		if (!Reserve_Stream_Memory())
+			return Status::OVER_MEMORY_BUDGET;
+		m_outputImage.create(m_height, m_width, CV_8UC1);
+	}
+
+	switch (type)
+	{
+	case REGION:
+		Prepare_Mask(m_regionMask);
+		m_regionMask.To_Mat(m_outputImage);
+		opImage = m_outputImage;
+		break;
+	case PERIMETER:
+		if (m_isPerimeterSmoothed)
+			opImage = m_perimeterImage;
+		else
+		{
+			Prepare_Mask(m_perimeterMask);
+			m_perimeterMask.To_Mat(m_outputImage);
+			opImage = m_outputImage;
+		}
+		break;
+	default:
+		return Status::FAILURE;
+	}
+	return Status::SUCCESS;
+}
+
+Status ImageAnalysisService::Get_Output_Mask(OutputImageType type, BinaryMask &mask)
+{
+	switch (type)
+	{
+	case REGION:
+		Prepare_Mask(m_regionMask);
+		mask = m_regionMask;
+		break;
+	case PERIMETER:
+		//a smoothed perimeter is grey, every pixel it reaches is set
+		if (m_isPerimeterSmoothed)
+			mask.From_Mat(m_perimeterImage);
+		else
+		{
+			Prepare_Mask(m_perimeterMask);
+			mask = m_perimeterMask;
+		}
+		break;
+	default:
+		return Status::FAILURE;
+	}
+	return Status::SUCCESS;
+}
+
+void ImageAnalysisService::Collect_Saves(bool isWaiting)
+{
+	//finished saves are dropped, remembering whether any failed for FLUSH_SAVES
+	size_t kept = 0;
+	for (size_t i = 0; i < m_pendingSaves.size(); ++i)
+	{
+		std::future<bool> &save = m_pendingSaves[i];
+		if (!isWaiting && (save.wait_for(std::chrono::seconds(0)) != std::future_status::ready))
+		{
+			m_pendingSaves[kept++] = std::move(save);
+			continue;
+		}
+		try
+		{
+			if (!save.get())
+				m_isSaveFailed = true;
+		}
+		catch (...)
+		{
+			m_isSaveFailed = true;
+		}
+	}
+	m_pendingSaves.resize(kept);
+	//a streamed image has at most one save pending, its copy is gone once it is
+	if (m_pendingSaves.empty())
+		m_saveBytes = 0;
+}
+
+std::future<Status> ImageAnalysisService::Run_Async(const std::function<Status()> &command)
+{
+	//a pool of two threads has one worker, so queued commands run in order and never overlap
+	if (!m_asyncWorker)
+		m_asyncWorker.reset(new ThreadPool(2));
+
+	unsigned int generation = m_cancelGeneration;
+	auto task = std::make_shared<std::packaged_task<Status()>>([this, command, generation]
+	{
+		//the flag is cleared before the generation is checked, so a CANCEL from here on is not missed
+		m_isCancelled = false;
+		if (m_cancelGeneration != generation)
+			return Status::CANCELLED;
+
+		m_progress = 0;
+		m_isCancellable = true;
+		Status val = command();
+		m_isCancellable = false;
+		if (val == Status::SUCCESS)
+			m_progress = 1;
+		return val;
+	});
+	std::future<Status> result = task->get_future();
+	m_asyncWorker->Submit([task] { (*task)(); });
+	return result;
+}
+
+bool ImageAnalysisService::Is_Cancelled()
+{
+	//only asynchronous commands can be cancelled
+	return m_isCancellable && m_isCancelled.load(std::memory_order_relaxed);
+}
+
+const std::atomic<bool>* ImageAnalysisService::Cancel_Flag()
+{
+	return m_isCancellable ? &m_isCancelled : nullptr;
+}
 
+void ImageAnalysisService::Report_Progress(float progress)
+{
+	m_progress = progress;
+}
+
+void ImageAnalysisService::Discard_Region()
+{
+	//an unfinished fill can have set bits anywhere, so the region mask is cleared as a whole
+	m_regionMask.Clear();
+	m_regionArea = cv::Rect();
+	m_regionBounds = cv::Rect();
+	m_hasFillRuns = false;
+	m_hasRegionRuns = false;
+	m_cacheEntryId = 0;
+	m_isRegionCalculated = false;
+	m_isPerimeterCalculated = false;
+	m_isContourCalculated = false;
+
+	//a streamed image's budget gets back what the region held
+	Reserve_Stream_Memory();
+}
+
+ThreadPool* ImageAnalysisService::Get_Thread_Pool()
+{
+	//services without their own pool share one thread per core
+	if (m_threadPool)
+		return m_threadPool.get();
+	return &ThreadPool::Shared();
 }
 
 void ImageAnalysisService::SHOW_MAT(const cv::Mat &image, std::string const &win_name)
@@ -530,6 +2495,13 @@ void ImageAnalysisService::SHOW_MAT(const cv::Mat &image, std::string const &win
 
 ImageAnalysisService::~ImageAnalysisService()
 {
+	//pending commands are dropped and the worker is joined before any member goes away
+	CANCEL();
+	m_asyncWorker.reset();
+	//background saves are still written
+	m_saveWorker.reset();
+	Release_Image();
+
 	//no need as cv::Mat will deallocate itself
 	//http://docs.opencv.org/2.4/modules/core/doc/intro.html#automatic-memory-management
 }
@@ -4,12 +4,49 @@
 #include <stdio.h>
 #include <opencv2/opencv.hpp>
 #include <cmath>
+#include "BinaryMask.h"
+#include "RunRegion.h"
+#include "Smoothing.h"
+#include "Contour.h"
+#include "PixelClassifier.h"
+#include "ThreadPool.h"
+#include "ConnectedComponents.h"
+#include "RegionCache.h"
+#include "RegionStats.h"
+#include "Instrumentation.h"
+#include "DistanceMap.h"
+#include "StripImage.h"
+#include "MappedFile.h"
+#include <memory>
+#include <atomic>
+#include <future>
 using namespace cv;
 using namespace std;
 
 enum OutputImageType { REGION, PERIMETER };
 
-enum Status {SUCCESS, FAILURE,INVALID_IMAGE, SEED_POINT_OUT_OF_RANGE};
+enum FillMode { FORREST_FIRE, SCANLINE, PARALLEL };
+
+//how the region is worked on after the fill: bit packed masks, or the runs of each row (RunRegion.h)
+enum RegionFormat { PACKED_MASK, RUN_LENGTH };
+
+//IMAGE_FILE leaves the format to the file extension, the others write the mask bits at one bit per pixel
+enum OutputFormat { IMAGE_FILE, PNG_1BIT, TIFF_1BIT, RLE_MASK };
+
+//how SAVE_PIXELS writes its output
+struct SaveOptions
+{
+	OutputFormat format = IMAGE_FILE;
+	//PNG zlib level 0 to 9, -1 keeps the default. For TIFF_1BIT 0 writes uncompressed rows, anything else PackBits
+	int compression = -1;
+	//encode and write on the service's writer thread so SAVE_PIXELS returns at once, FLUSH_SAVES waits for them
+	bool isBackground = false;
+};
+
+//how SMOOTH_CONTOURS works on the traced polylines
+enum ContourSmoothing { MOVING_AVERAGE, CHAIKIN, DOUGLAS_PEUCKER };
+
+enum Status {SUCCESS, FAILURE,INVALID_IMAGE, SEED_POINT_OUT_OF_RANGE, CANCELLED, AMOUNT_OUT_OF_RANGE, OVER_MEMORY_BUDGET};
 
 struct Pixel
 {
@@ -18,6 +55,30 @@ struct Pixel
 	int blue;
 };
 
+struct CacheStats
+{
+	size_t hits;
+	size_t misses;
+	size_t entries;
+	size_t bytes;
+	size_t limit;
+};
+
+//what GetRegionStats reports about the current region, x is the column and y the row as in FIND_REGION.
+//The mean colours are of the red, green and blue channels of the image (stored as BGR)
+struct RegionStats
+{
+	size_t area;
+	cv::Rect bounds;
+	double centroidX;
+	double centroidY;
+	double meanRed;
+	double meanGreen;
+	double meanBlue;
+	//number of perimeter pixels, 0 until FIND_PERIMETER has run
+	size_t perimeterLength;
+};
+
 struct PointImg
 {
 public:
@@ -30,47 +91,294 @@ public:
 	int Y;
 };
 
+//one seed of a FIND_REGIONS batch, x and y as in FIND_REGION
+struct RegionSeed
+{
+	int x;
+	int y;
+	int tolerance;
+};
+
+//one seed's region from FIND_REGIONS, mask (CV_8UC1) covers only bounds of the image.
+//Seeds that share a region share the same mask data
+struct RegionCrop
+{
+	cv::Rect bounds;
+	cv::Mat mask;
+};
+
 class ImageAnalysisService
 {
 private:
 	//private variables
+	//the loaded image, shared read only with every service given it by SHARE_IMAGE
 	Mat m_inputImage;
-	Mat m_regionImage;
+	std::shared_ptr<StripImage> m_stripImage;
+	std::shared_ptr<MappedFile> m_mappedImage;
+	bool m_isRawCacheUsed = false;
+	bool m_isRawCacheMissed = false;
+	size_t m_memoryBudget = 256 * 1024 * 1024;
+	//bytes of a streamed image's budget held for this service's buffers and region cache, what they hold now
+	//(see Working_Bytes) as of the last check. m_heldBytes are what the running command holds besides them,
+	//m_saveBytes the copy a background save of a streamed image is writing
+	size_t m_streamReserved = 0;
+	size_t m_heldBytes = 0;
+	size_t m_saveBytes = 0;
+	BinaryMask m_regionMask;
+	BinaryMask m_perimeterMask;
 	Mat m_perimeterImage;
+	//working buffers, allocated on first use and kept while the image size stays the same;
+	//each remembers the area it may be dirty in so only that is cleared before it is reused
+	BinaryMask m_scratchMasks[2];
+	cv::Rect m_scratchAreas[2];
+	Mat m_smoothImage;
+	cv::Rect m_smoothArea;
+	Mat m_outputImage;
 	int m_rgbChannels;
 	int m_width;
 	int m_height;
 	Pixel m_seedPixel;
 	int m_tolerence;
+	int m_kernelWidth = 3;
+	int m_kernelHeight = 3;
+	//FIND_SMOOTH_PERIMETER's filter, the original 3 x 3 one until SET_SMOOTHING_KERNEL
+	SmoothingKernel m_smoothingKernel = Make_Smoothing_Kernel(3, 0);
+	std::shared_ptr<ThreadPool> m_threadPool;
 	bool m_isRegionCalculated = false;
 	bool m_imageLoaded = false;
 	bool m_isPerimeterCalculated = false;
+	bool m_isPerimeterSmoothed = false;
 	std::vector<PointImg> m_listPt;
+	PixelClassifier m_classifier;
+	//level of the classifier, smoothing and distance map kernels
+	SimdLevel m_simdLevel = Detect_Simd_Level();
+	BinaryMask m_candidateMask;
+	cv::Rect m_regionBounds;
+	cv::Rect m_regionArea;
+	cv::Rect m_perimeterArea;
+	std::vector<unsigned char> m_isRowClassified;
+	RegionCache m_regionCache;
+	unsigned int m_imageGeneration = 0;
+	size_t m_cacheEntryId = 0;
+	//raw fill of the current region (before opening and closing) and what grew it
+	BinaryMask m_fillMask;
+	cv::Rect m_fillBounds;
+	bool m_hasFill = false;
+	bool m_isFillResumed = true;
+	PointImg m_fillSeed = PointImg(0, 0);
+	int m_fillColour = 0;
+	int m_fillTolerance = 0;
+	//distance map of one seed colour and level map of one seed pixel, built by BUILD_LEVEL_MAP
+	cv::Mat m_distanceMap;
+	int m_distanceColour = -1;
+	bool m_isDistanceUsed = false;
+	cv::Mat m_levelMap;
+	PointImg m_levelSeed = PointImg(-1, -1);
+	//RUN_LENGTH regions, the scanline fill's runs and the cleaned region and perimeter as runs
+	RegionFormat m_regionFormat = RegionFormat::PACKED_MASK;
+	std::vector<RowRun> m_fillRuns;
+	bool m_isCollectingRuns = false;
+	bool m_hasFillRuns = false;
+	RunRegion m_regionRuns;
+	bool m_hasRegionRuns = false;
+	RunRegion m_perimeterRuns;
+	//the fill's runs and the opening and closing steps, kept with the morphology's own scratch so cleaning reuses them
+	RunRegion m_scratchRuns[3];
+	RunScratch m_runScratch;
+	//statistics gathered while the region is grown and cleaned, see GetRegionStats. m_fillMoments belong to the kept fill
+	RegionMoments m_regionMoments;
+	RegionMoments m_fillMoments;
+	std::vector<RegionMoments> m_rowMoments;
+	cv::Rect m_regionExtent;
+	size_t m_perimeterLength = 0;
+	//borders of the current region as polylines, see FIND_CONTOURS
+	std::vector<Contour> m_contours;
+	bool m_isContourCalculated = false;
+	//asynchronous commands, see Run_Async
+	std::unique_ptr<ThreadPool> m_asyncWorker;
+	std::atomic<unsigned int> m_cancelGeneration{ 0 };
+	std::atomic<bool> m_isCancelled{ false };
+	bool m_isCancellable = false;
+	std::atomic<float> m_progress{ 0 };
+	//background saves, see SAVE_PIXELS
+	std::unique_ptr<ThreadPool> m_saveWorker;
+	std::vector<std::future<bool>> m_pendingSaves;
+	bool m_isSaveFailed = false;
+	//per stage counters and the trace, see GetServiceStats. m_testedPixels is what the last fill compared
+	Instrumentation m_instrumentation{ [this]() { return Service_Usage(); } };
+	uint64_t m_testedPixels = 0;
 	const unsigned char WHITE = 255;
 	const unsigned char BLACK = 0;
 
 	//private methods
 	void SHOW_MAT(const cv::Mat &image, std::string const &win_name);
+	Status Flood_Fill(int seedX, int seedY, FillMode mode);
 	Status Flood_Fill_Forrest_Fire(int seedX, int seedY);
-	Status Apply_Erosion(cv::Mat ipImage, cv::Mat opImage);
-	Status Apply_Dialation(cv::Mat ipImage, cv::Mat opImage);
-	Status Apply_Opening(cv::Mat ipImage, cv::Mat opImage);
-	Status Apply_Closing(cv::Mat ipImage, cv::Mat opImage);
-	Status Subtract_Image(cv::Mat firstImage, cv::Mat secondImage, cv::Mat opImage);
-	Status Apply_Gaussian_Smoothing(cv::Mat ipImage, cv::Mat opImage);
+	Status Flood_Fill_Scanline(int seedX, int seedY);
+	Status Flood_Fill_Parallel(int seedX, int seedY);
+	Status Grow_Runs();
+	Status Flood_Fill_Levels();
+	bool Has_Level_Map(int seedX, int seedY);
+	Status Resume_Fill(int seedX, int seedY);
+	void Push_Frontier();
+	bool Can_Resume(int seedX, int seedY);
+	void Keep_Fill(int seedX, int seedY);
+	void Push_Span_Seeds(int row, int left, int right);
+	void Prepare_Candidates();
+	const uint64_t* Candidate_Row(int row);
+	const Vec3b* Input_Row(int row, ImageStrip &strip);
+	void Load_Raw_Cache(std::string& filename);
+	void Reset_Image_State();
+	void Release_Image();
+	void Release_Stream_Images();
+	size_t Working_Bytes() const;
+	bool Reserve_Stream_Memory();
+	bool Reserve_Stream_Memory(size_t extraBytes);
+	bool Map_Raw_Image(const std::string &path, uint64_t sourceSize, uint64_t sourceTime);
+	Status Apply_Erosion(const BinaryMask &ipImage, BinaryMask &opImage, const cv::Rect &area);
+	Status Apply_Dialation(const BinaryMask &ipImage, BinaryMask &opImage, const cv::Rect &area);
+	Status Apply_Opening(const BinaryMask &ipImage, BinaryMask &opImage, const cv::Rect &area);
+	Status Apply_Closing(const BinaryMask &ipImage, BinaryMask &opImage, const cv::Rect &area);
+	Status Clean_Region();
+	Status Clean_Region_Runs();
+	void Prepare_Region_Runs();
+	void Finish_Region_Stats();
+	ServiceUsage Service_Usage() const;
+	void Sum_Row_Moments(int first, int last);
+	bool Prepare_Mask(BinaryMask &mask);
+	void Clear_Mask(BinaryMask &mask, const cv::Rect &area);
+	BinaryMask& Scratch_Mask(int index, const cv::Rect &area);
+	void Prepare_Smooth_Images();
+	RegionKey Region_Key();
+	void Restore_Region(const CachedRegion &entry, int seedX, int seedY);
+	Status Apply_Gaussian_Smoothing(cv::Mat ipImage, cv::Mat opImage, const cv::Rect &area);
+	Status Get_Output_Image(OutputImageType type, cv::Mat &opImage);
+	Status Get_Output_Mask(OutputImageType type, BinaryMask &mask);
+	void Collect_Saves(bool isWaiting);
+	ThreadPool* Get_Thread_Pool();
+	std::future<Status> Run_Async(const std::function<Status()> &command);
+	bool Is_Cancelled();
+	const std::atomic<bool>* Cancel_Flag();
+	void Report_Progress(float progress);
+	void Discard_Region();
 
 public:
 	//publically exposed properties
+	//OVER_MEMORY_BUDGET when a streamed image's memory budget has no room for one strip
 	Status INITIALIZE(string& filename);
-	Status FIND_REGION(int x, int y, int tolerance = 5);
+	//uses the image source has loaded without copying it. Both services only read the image, so they
+	//can run on different threads, each with its own region, perimeter and scratch state
+	Status SHARE_IMAGE(const ImageAnalysisService &source);
+	//uses a CV_8UC3 BGR image already in memory without copying it, it must not change while it is loaded
+	Status LOAD_IMAGE(const cv::Mat &image);
+	//streamed images are grown with the scanline fill in place of FORREST_FIRE and PARALLEL, the region is the same but
+	//its stack stays small and only the rows it reaches are classified. Their masks only hold the rows the region sets,
+	//out of the image's memory budget, OVER_MEMORY_BUDGET when the region does not fit
+	Status FIND_REGION(int x, int y, int tolerance = 5, FillMode mode = SCANLINE);
+	//only the fill of FIND_REGION, without the cache, cleanup and statistics, for timing the fills on their own.
+	//The raw fill is left in the region mask and there is no current region afterwards
+	Status GROW_FILL(int x, int y, int tolerance = 5, FillMode mode = SCANLINE);
+	//grows the region of every seed. seeds with the same colour and tolerance share one classification,
+	//and a seed landing in a fill already grown for its group reuses that region.
+	//labels (CV_32SC1) holds 1 + the index of the lowest seed whose region covers each pixel, 0 elsewhere.
+	//regions, if given, receives each seed's mask cropped to its region's bounds. No current region is left behind.
+	//A streamed image's memory budget needs room for the labels (4 bytes a pixel) while the batch runs
+	Status FIND_REGIONS(const std::vector<RegionSeed> &seeds, cv::Mat &labels, std::vector<RegionCrop> *regions = nullptr, FillMode mode = SCANLINE);
+	//grows the region of one seed for every tolerance, smallest first so each fill resumes from the one before.
+	//areas gets each region's pixel count and regions, if given, each mask. The region of the largest
+	//tolerance is left as the current region. A streamed image's memory budget needs room for the masks asked for
+	Status SWEEP_TOLERANCE(int x, int y, const std::vector<int> &tolerances, std::vector<int> &areas, std::vector<cv::Mat> *regions = nullptr, FillMode mode = SCANLINE);
+	//precomputes the seed colour's distance map and the seed's flood level map. Afterwards FIND_REGION for
+	//that seed (or a seed inside its fill) at any tolerance is one compare pass, and other seeds of the same
+	//colour classify pixels from the distance map. On a streamed image the maps (3 bytes a pixel) are kept in its
+	//memory budget, OVER_MEMORY_BUDGET when they do not fit
+	Status BUILD_LEVEL_MAP(int x, int y);
 	Status FIND_PERIMETER();
 	Status DISPLAY_IMAGE();
+	//as GET_PIXELS, OVER_MEMORY_BUDGET when a streamed image's memory budget has no room for the 8 bit image
 	Status DISPLAY_PIXELS(OutputImageType type);
 	Status SAVE_PIXELS(OutputImageType type, std::string& filename);
+	//on a streamed image what a save encodes comes out of its memory budget: the rows the mask holds for TIFF_1BIT
+	//and RLE_MASK, an 8 bit image for the others. OVER_MEMORY_BUDGET when it does not fit
+	Status SAVE_PIXELS(OutputImageType type, std::string& filename, const SaveOptions &options);
+	//waits for every background save, FAILURE if any of them since the last flush could not be written
+	Status FLUSH_SAVES();
+	//copy of the region or perimeter image as SAVE_PIXELS would write it, for callers encoding it themselves.
+	//A streamed image's memory budget needs room for the 8 bit image while it is built, OVER_MEMORY_BUDGET when it does not fit
+	Status GET_PIXELS(OutputImageType type, cv::Mat &opImage);
+	//a streamed image's memory budget needs room for the two 8 bit smoothing images, OVER_MEMORY_BUDGET when they do not fit
 	Status FIND_SMOOTH_PERIMETER();
+	//traces every outer and hole border of the current region as a closed polyline, without building a perimeter image
+	Status FIND_CONTOURS();
+	//smooths the current contours again: MOVING_AVERAGE over amount points on each side, amount CHAIKIN passes,
+	//or DOUGLAS_PEUCKER dropping points that stay within amount pixels of the simplified outline.
+	//AMOUNT_OUT_OF_RANGE for a negative amount, more than MAX_CHAIKIN_PASSES or a radius past the int range
+	Status SMOOTH_CONTOURS(ContourSmoothing method, double amount);
+	Status GET_CONTOURS(std::vector<Contour> &contours);
+	//writes the contours as polygons, an svg file or a text file (see Write_Contours)
+	Status SAVE_CONTOURS(std::string& filename);
+	Status SET_KERNEL_SIZE(int width, int height);
+	//Gaussian used by FIND_SMOOTH_PERIMETER, size odd. sigma 0 takes binomial weights (size 3 is the default filter),
+	//sizes over BOX_KERNEL_SIZE are approximated by box passes whose cost does not depend on the size.
+	//sigma, or the binomial one of the size, must not be over MAX_SMOOTHING_SIGMA
+	Status SET_SMOOTHING_KERNEL(int size, double sigma = 0);
+	Status SET_THREAD_COUNT(int count);
+	//RUN_LENGTH keeps the region as runs from the scanline fill on, so cleaning it and finding its perimeter
+	//cost what its outline does rather than its pixel count. The masks shown and saved are the same either way
+	Status SET_REGION_FORMAT(RegionFormat format);
+	//SIMD level of the row classifier, smoothing and distance map kernels, capped at what the cpu runs.
+	//Detect_Simd_Level() by default
+	Status SET_SIMD_LEVEL(SimdLevel level);
+	SimdLevel GetSimdLevel();
+	//when off FIND_REGION always grows its fill from the seed instead of resuming the kept one
+	Status SET_FILL_RESUME(bool enabled);
+	//pixel count and bounding box of the current region, 0 and empty when there is none
+	size_t GetRegionArea();
+	cv::Rect GetRegionBounds();
+	//area, bounds, centroid and mean colour of the current region and its perimeter length, all zero when there is none.
+	//They are summed up while the region is filled, cleaned and its perimeter found, so asking costs nothing
+	RegionStats GetRegionStats();
+	//time, pixels and allocations of every stage (Instrumentation.h) since the last RESET_STATS, with the fill's
+	//peak stack size and the region cache hits. Pixels are the ones a stage compared or worked on: for a fill the
+	//pixels tested against the seed colour, for the other stages the area they processed. Safe to call while a command
+	//runs: the cache counters and working bytes are the ones recorded when the last stage ended
+	ServiceStats GetServiceStats();
+	Status RESET_STATS();
+	//keeps every stage from now on as a Chrome trace event, SAVE_TRACE writes them as JSON and stops
+	Status START_TRACE();
+	Status SAVE_TRACE(std::string& filename);
+	//memory budget of the region cache in bytes, 0 turns it off. On a streamed image the entries come out of its
+	//budget as they are added, and the least recently used are evicted when a command needs the room
+	Status SET_CACHE_LIMIT(size_t bytes);
+	CacheStats GetCacheStats();
+	//when on, INITIALIZE keeps a raw copy of each decoded image next to it (name + .iasraw) and
+	//maps that copy instead of decoding the image again on later loads
+	Status SET_RAW_CACHE(bool enabled);
+	//true when RAW_CACHE is on but the last INITIALIZE could not stamp, write or map the raw cache and
+	//used the decoded image instead
+	bool IsRawCacheMissed();
+	//bytes a streamed (.iasraw) image may use, one budget for every service sharing the image. It holds the
+	//strips of rows loaded, and what the masks, runs, images and region cache of each service hold now (see the readme).
+	//OVER_MEMORY_BUDGET when that leaves no room for a strip
+	Status SET_MEMORY_BUDGET(size_t bytes);
+	//writes the loaded image in the raw format, which INITIALIZE then streams
+	Status SAVE_RAW_IMAGE(std::string& filename);
+	//asynchronous versions, queued on the service's own worker thread and run one after the other.
+	//The service is not thread safe, so no other method should be called while any are pending
+	std::future<Status> INITIALIZE_ASYNC(std::string filename);
+	std::future<Status> FIND_REGION_ASYNC(int x, int y, int tolerance = 5, FillMode mode = SCANLINE);
+	std::future<Status> FIND_PERIMETER_ASYNC();
+	std::future<Status> FIND_SMOOTH_PERIMETER_ASYNC();
+	std::future<Status> SAVE_PIXELS_ASYNC(OutputImageType type, std::string filename);
+	//the running asynchronous command and every one queued before this call finish with CANCELLED. A cancelled
+	//FIND_REGION leaves no region behind, a cancelled FIND_PERIMETER or FIND_SMOOTH_PERIMETER no perimeter
+	Status CANCEL();
+	//how far the running asynchronous command has got, 0 to 1
+	float GetProgress();
 	bool IsIntitialized();
 	bool IsRegionCalculated();
 	bool IsPerimeterCalculated();
+	bool IsContourCalculated();
 	~ImageAnalysisService();
 };
 
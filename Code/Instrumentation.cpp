@@ -0,0 +1,166 @@
+#include "Instrumentation.h"
+#include <algorithm>
+#include <fstream>
+
+//a trace left on keeps at most this many events, later ones are counted as dropped
+static const size_t MAX_TRACE_EVENTS = 1 << 20;
+
+const char* Stage_Name(Stage stage)
+{
+	static const char *names[STAGE_COUNT] = { "INITIALIZE", "FIND_REGION", "FIND_REGIONS", "FILL", "CLEANUP", "REGION_STATS", "PERIMETER",
+		"SMOOTHING", "CONTOURS", "SAVE" };
+	return ((stage >= 0) && (stage < STAGE_COUNT)) ? names[stage] : "UNKNOWN";
+}
+
+Instrumentation::Instrumentation(const std::function<ServiceUsage()> &usageProbe)
+	: m_usageProbe(usageProbe)
+{
+}
+
+ServiceUsage Instrumentation::Usage() const
+{
+	return m_usageProbe ? m_usageProbe() : ServiceUsage();
+}
+
+int Instrumentation::Thread_Index(std::thread::id id)
+{
+	//trace viewers want small thread numbers, so threads are numbered in the order they show up
+	for (size_t i = 0; i < m_threads.size(); ++i)
+		if (m_threads[i] == id)
+			return (int)i;
+	m_threads.push_back(id);
+	return (int)m_threads.size() - 1;
+}
+
+void Instrumentation::Record(Stage stage, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end, uint64_t pixels, uint64_t bytesAllocated, const ServiceUsage &usage)
+{
+	double ms = std::chrono::duration<double, std::milli>(end - start).count();
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	StageCounters &counters = m_stats.stages[stage];
+	++counters.calls;
+	counters.totalMs += ms;
+	counters.lastMs = ms;
+	counters.maxMs = std::max(counters.maxMs, ms);
+	counters.pixels += pixels;
+	counters.lastPixels = pixels;
+	counters.bytesAllocated += bytesAllocated;
+	counters.lastBytesAllocated = bytesAllocated;
+	m_lastUsage = usage;
+
+	if (!m_isTracing)
+		return;
+	if (m_events.size() >= MAX_TRACE_EVENTS)
+	{
+		++m_droppedEvents;
+		return;
+	}
+	TraceEvent event;
+	event.stage = stage;
+	event.thread = Thread_Index(std::this_thread::get_id());
+	event.startUs = std::chrono::duration<double, std::micro>(start - m_traceStart).count();
+	event.durationUs = std::chrono::duration<double, std::micro>(end - start).count();
+	event.pixels = pixels;
+	m_events.push_back(event);
+}
+
+void Instrumentation::Record_List_Peak(size_t peak)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_stats.lastListPeak = peak;
+	m_stats.listPeak = std::max(m_stats.listPeak, peak);
+}
+
+ServiceStats Instrumentation::Snapshot() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	ServiceStats stats = m_stats;
+	stats.cacheHits = m_lastUsage.cacheHits - m_resetUsage.cacheHits;
+	stats.cacheMisses = m_lastUsage.cacheMisses - m_resetUsage.cacheMisses;
+	stats.workingBytes = m_lastUsage.workingBytes;
+	return stats;
+}
+
+void Instrumentation::Reset()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_stats = ServiceStats();
+	m_resetUsage = m_lastUsage;
+}
+
+void Instrumentation::Start_Trace()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_events.clear();
+	m_threads.clear();
+	m_droppedEvents = 0;
+	m_traceStart = std::chrono::steady_clock::now();
+	m_isTracing = true;
+}
+
+bool Instrumentation::Save_Trace(const std::string &path)
+{
+	std::vector<TraceEvent> events;
+	size_t dropped;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_isTracing)
+			return false;
+		m_isTracing = false;
+		events.swap(m_events);
+		dropped = m_droppedEvents;
+	}
+
+	//complete ("X") events with times in microseconds, stages of one command nest by their times
+	std::ofstream file(path.c_str(), std::ios::out | std::ios::trunc);
+	if (!file)
+		return false;
+	file.setf(std::ios::fixed);
+	file.precision(3);
+	file << "{\"traceEvents\":[";
+	for (size_t i = 0; i < events.size(); ++i)
+	{
+		const TraceEvent &event = events[i];
+		file << ((i == 0) ? "\n" : ",\n") << "{\"name\":\"" << Stage_Name(event.stage) << "\",\"cat\":\"stage\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+			<< event.thread << ",\"ts\":" << event.startUs << ",\"dur\":" << event.durationUs
+			<< ",\"args\":{\"pixels\":" << event.pixels << "}}";
+	}
+	file << "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"droppedEvents\":" << dropped << "}}\n";
+	return file.good();
+}
+
+bool Instrumentation::Is_Tracing() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_isTracing;
+}
+
+StageTimer::StageTimer(Instrumentation &instrumentation, Stage stage)
+	: m_instrumentation(instrumentation), m_stage(stage), m_start(std::chrono::steady_clock::now()),
+	m_bytesBefore(instrumentation.Usage().workingBytes)
+{
+}
+
+StageTimer::~StageTimer()
+{
+	try
+	{
+		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+		ServiceUsage usage = m_instrumentation.Usage();
+		size_t bytesAfter = usage.workingBytes;
+		m_instrumentation.Record(m_stage, m_start, end, m_pixels, (bytesAfter > m_bytesBefore) ? bytesAfter - m_bytesBefore : 0, usage);
+	}
+	catch (...)
+	{
+	}
+}
+
+void StageTimer::Add_Pixels(uint64_t pixels)
+{
+	m_pixels += pixels;
+}
+
+void StageTimer::Restart_Bytes()
+{
+	m_bytesBefore = m_instrumentation.Usage().workingBytes;
+}
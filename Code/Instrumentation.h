@@ -0,0 +1,128 @@
+#ifndef INSTRUMENTATION_H
+#define INSTRUMENTATION_H
+
+#include <stdint.h>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//parts of the commands that are timed on their own, FIND_REGION covers FILL, CLEANUP and REGION_STATS,
+//FIND_REGIONS covers the FILL and CLEANUP of each of its seeds
+enum Stage { STAGE_INITIALIZE, STAGE_FIND_REGION, STAGE_FIND_REGIONS, STAGE_FILL, STAGE_CLEANUP, STAGE_REGION_STATS, STAGE_PERIMETER,
+	STAGE_SMOOTHING, STAGE_CONTOURS, STAGE_SAVE, STAGE_COUNT };
+
+const char* Stage_Name(Stage stage);
+
+//totals of one stage since the counters were last reset
+struct StageCounters
+{
+	uint64_t calls = 0;
+	double totalMs = 0;
+	double lastMs = 0;
+	double maxMs = 0;
+	//pixels the stage read or wrote, see GetServiceStats
+	uint64_t pixels = 0;
+	uint64_t lastPixels = 0;
+	//bytes the stage added to the input image and the service's working buffers. The buffers are reused, so once
+	//they have grown to the image this stays 0 for every stage but INITIALIZE
+	uint64_t bytesAllocated = 0;
+	uint64_t lastBytesAllocated = 0;
+};
+
+//what the owner of the counters holds, read at the end of every stage
+struct ServiceUsage
+{
+	size_t workingBytes = 0;
+	size_t cacheHits = 0;
+	size_t cacheMisses = 0;
+};
+
+struct ServiceStats
+{
+	StageCounters stages[STAGE_COUNT];
+	//largest number of points on the fill's stack, in the last fill and in any fill
+	size_t lastListPeak = 0;
+	size_t listPeak = 0;
+	size_t cacheHits = 0;
+	size_t cacheMisses = 0;
+	//bytes held by the input image, the working buffers and the region cache when the last stage ended
+	size_t workingBytes = 0;
+};
+
+//one finished stage as a Chrome trace event
+struct TraceEvent
+{
+	Stage stage;
+	int thread;
+	double startUs;
+	double durationUs;
+	uint64_t pixels;
+};
+
+//Always on counters of a service, a few clock reads and a lock per stage.
+//Stages are recorded from whichever thread runs the command, and can be read from any other.
+//While a trace is on every stage is also kept as an event, written out in the Chrome trace event
+//format (chrome://tracing or Perfetto) by Save_Trace.
+class Instrumentation
+{
+private:
+	mutable std::mutex m_mutex;
+	ServiceStats m_stats;
+	std::function<ServiceUsage()> m_usageProbe;
+	//cache counters at the last Reset, the stats count from there
+	ServiceUsage m_resetUsage;
+	ServiceUsage m_lastUsage;
+	bool m_isTracing = false;
+	std::vector<TraceEvent> m_events;
+	std::vector<std::thread::id> m_threads;
+	size_t m_droppedEvents = 0;
+	std::chrono::steady_clock::time_point m_traceStart;
+
+	int Thread_Index(std::thread::id id);
+
+public:
+	//usageProbe reads the owner's buffers and cache, it is only called from the thread running a stage
+	explicit Instrumentation(const std::function<ServiceUsage()> &usageProbe);
+
+	ServiceUsage Usage() const;
+	//usage is what the probe read at the end of the stage
+	void Record(Stage stage, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end, uint64_t pixels, uint64_t bytesAllocated, const ServiceUsage &usage);
+	void Record_List_Peak(size_t peak);
+	//safe from any thread, the usage is the one recorded by the last stage
+	ServiceStats Snapshot() const;
+	//clears the counters, the cache counters start again from the last recorded usage
+	void Reset();
+
+	//starts keeping events, dropping any kept before
+	void Start_Trace();
+	//writes the kept events as {"traceEvents": [...]} and stops the trace
+	bool Save_Trace(const std::string &path);
+	bool Is_Tracing() const;
+};
+
+//Times a stage from construction to destruction, so every return path is counted.
+//The usage is read at both ends, the growth of the working bytes is what the stage allocated
+class StageTimer
+{
+private:
+	Instrumentation &m_instrumentation;
+	Stage m_stage;
+	std::chrono::steady_clock::time_point m_start;
+	size_t m_bytesBefore;
+	uint64_t m_pixels = 0;
+
+public:
+	StageTimer(Instrumentation &instrumentation, Stage stage);
+	~StageTimer();
+	StageTimer(const StageTimer&) = delete;
+	StageTimer& operator=(const StageTimer&) = delete;
+
+	void Add_Pixels(uint64_t pixels);
+	//counts the bytes allocated from here on, for stages that first let go of what they replace
+	void Restart_Bytes();
+};
+
+#endif
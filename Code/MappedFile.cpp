@@ -0,0 +1,124 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile()
+{
+}
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+#ifdef _WIN32
+bool MappedFile::Open(const std::string &path)
+{
+	Close();
+
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	m_file = file;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || (size.QuadPart == 0))
+	{
+		Close();
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping == NULL)
+	{
+		Close();
+		return false;
+	}
+	m_mapping = mapping;
+
+	m_data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (m_data == nullptr)
+	{
+		Close();
+		return false;
+	}
+	m_size = (size_t)size.QuadPart;
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (m_data != nullptr)
+		UnmapViewOfFile(m_data);
+	if (m_mapping != nullptr)
+		CloseHandle((HANDLE)m_mapping);
+	if (m_file != nullptr)
+		CloseHandle((HANDLE)m_file);
+	m_data = nullptr;
+	m_mapping = nullptr;
+	m_file = nullptr;
+	m_size = 0;
+}
+#else
+bool MappedFile::Open(const std::string &path)
+{
+	Close();
+
+	m_file = open(path.c_str(), O_RDONLY);
+	if (m_file < 0)
+		return false;
+
+	struct stat info;
+	if ((fstat(m_file, &info) != 0) || (info.st_size == 0))
+	{
+		Close();
+		return false;
+	}
+
+	void *data = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_SHARED, m_file, 0);
+	if (data == MAP_FAILED)
+	{
+		Close();
+		return false;
+	}
+	m_data = (const unsigned char*)data;
+	m_size = (size_t)info.st_size;
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (m_data != nullptr)
+		munmap((void*)m_data, m_size);
+	if (m_file >= 0)
+		close(m_file);
+	m_data = nullptr;
+	m_file = -1;
+	m_size = 0;
+}
+#endif
+
+bool MappedFile::Is_Open() const
+{
+	return m_data != nullptr;
+}
+
+const unsigned char* MappedFile::Data() const
+{
+	return m_data;
+}
+
+size_t MappedFile::Size() const
+{
+	return m_size;
+}
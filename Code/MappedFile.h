@@ -0,0 +1,35 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <stddef.h>
+#include <string>
+
+//Read only memory mapping of a whole file. The pages are shared with the OS page cache,
+//so every process mapping the same file shares one copy.
+class MappedFile
+{
+private:
+	const unsigned char *m_data = nullptr;
+	size_t m_size = 0;
+#ifdef _WIN32
+	void *m_file = nullptr;
+	void *m_mapping = nullptr;
+#else
+	int m_file = -1;
+#endif
+
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+public:
+	MappedFile();
+	~MappedFile();
+
+	bool Open(const std::string &path);
+	void Close();
+	bool Is_Open() const;
+	const unsigned char* Data() const;
+	size_t Size() const;
+};
+
+#endif
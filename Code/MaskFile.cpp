@@ -0,0 +1,261 @@
+#include "MaskFile.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <vector>
+
+//rows per band of the parallel encoders
+static const int BAND_ROWS = 256;
+
+//bits of a byte in reverse order, mask words hold the leftmost pixel in the lowest bit and TIFF in the highest
+struct BitReverseTable
+{
+	uint8_t bytes[256];
+	BitReverseTable()
+	{
+		for (int i = 0; i < 256; ++i)
+		{
+			bytes[i] = 0;
+			for (int b = 0; b < 8; ++b)
+				if (i & (1 << b))
+					bytes[i] |= (uint8_t)(0x80 >> b);
+		}
+	}
+};
+
+static const BitReverseTable BIT_REVERSE_TABLE;
+
+//calls encode(band, first, last) for every band of BAND_ROWS rows, on the pool if there is one
+static void For_Each_Band(int height, ThreadPool *pool, const std::function<void(int, int, int)> &encode)
+{
+	int bands = (height + BAND_ROWS - 1) / BAND_ROWS;
+	auto run = [&](int first, int last)
+	{
+		for (int b = first; b < last; ++b)
+			encode(b, b * BAND_ROWS, std::min(height, (b + 1) * BAND_ROWS));
+	};
+	if (pool != nullptr)
+		pool->Parallel_For(0, bands, 1, run);
+	else
+		run(0, bands);
+}
+
+//appends the runs of set pixels of a row as first column and length pairs
+static void Append_Runs(const uint64_t *words, int wordCount, std::vector<uint32_t> &runs)
+{
+	int col = 0;
+	const int end = wordCount << 6;
+	while (col < end)
+	{
+		//next set pixel
+		int w = col >> 6;
+		uint64_t bits = words[w] & (~0ULL << (col & 63));
+		while ((bits == 0) && (++w < wordCount))
+			bits = words[w];
+		if (bits == 0)
+			return;
+		int first = (w << 6) + Lowest_Set_Bit(bits);
+
+		//next clear pixel, bits past the width are clear so a run always ends inside the row
+		w = first >> 6;
+		bits = ~words[w] & (~0ULL << (first & 63));
+		while ((bits == 0) && (++w < wordCount))
+			bits = ~words[w];
+		col = (bits == 0) ? end : (w << 6) + Lowest_Set_Bit(bits);
+
+		runs.push_back((uint32_t)first);
+		runs.push_back((uint32_t)(col - first));
+	}
+}
+
+bool Write_Rle_Mask(const std::string &path, const BinaryMask &mask, ThreadPool *pool)
+{
+	const int height = mask.Height();
+	std::vector<uint32_t> counts(height);
+	std::vector<std::vector<uint32_t>> bandRuns((height + BAND_ROWS - 1) / BAND_ROWS);
+	For_Each_Band(height, pool, [&](int band, int first, int last)
+	{
+		std::vector<uint32_t> &runs = bandRuns[band];
+		for (int i = first; i < last; ++i)
+		{
+			size_t before = runs.size();
+			Append_Runs(mask.Row(i), mask.Words_Per_Row(), runs);
+			counts[i] = (uint32_t)((runs.size() - before) / 2);
+		}
+	});
+
+	RleMaskHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, RLE_MASK_MAGIC, sizeof(header.magic));
+	header.width = (uint32_t)mask.Width();
+	header.height = (uint32_t)height;
+	for (size_t b = 0; b < bandRuns.size(); ++b)
+		header.runCount += bandRuns[b].size() / 2;
+
+	std::ofstream file(path, std::ios::binary);
+	if (!file)
+		return false;
+	file.write((const char*)&header, sizeof(header));
+	if (height > 0)
+		file.write((const char*)counts.data(), counts.size() * sizeof(uint32_t));
+	for (size_t b = 0; b < bandRuns.size(); ++b)
+		if (!bandRuns[b].empty())
+			file.write((const char*)bandRuns[b].data(), bandRuns[b].size() * sizeof(uint32_t));
+	return (bool)file;
+}
+
+bool Read_Rle_Mask(const std::string &path, BinaryMask &mask)
+{
+	std::ifstream file(path, std::ios::binary);
+	RleMaskHeader header;
+	if (!file.read((char*)&header, sizeof(header)) || (memcmp(header.magic, RLE_MASK_MAGIC, sizeof(header.magic)) != 0))
+		return false;
+
+	//the header is checked against the file before anything is allocated from it, so a corrupt one fails early
+	file.seekg(0, std::ios::end);
+	uint64_t fileSize = (uint64_t)file.tellg();
+	file.seekg(sizeof(header), std::ios::beg);
+	uint64_t countBytes = (uint64_t)header.height * sizeof(uint32_t);
+	if (!file || (header.width > INT_MAX) || (header.height > INT_MAX) || (sizeof(header) + countBytes > fileSize)
+		|| (header.runCount > (fileSize - sizeof(header) - countBytes) / (2 * sizeof(uint32_t)))
+		|| (sizeof(header) + countBytes + header.runCount * 2 * sizeof(uint32_t) != fileSize))
+		return false;
+
+	std::vector<uint32_t> counts(header.height);
+	if ((header.height > 0) && !file.read((char*)counts.data(), counts.size() * sizeof(uint32_t)))
+		return false;
+	uint64_t runCount = 0;
+	for (uint32_t i = 0; i < header.height; ++i)
+		runCount += counts[i];
+	if (runCount != header.runCount)
+		return false;
+
+	mask.Create((int)header.width, (int)header.height);
+	uint32_t run[2];
+	for (uint32_t i = 0; i < header.height; ++i)
+		for (uint32_t r = 0; r < counts[i]; ++r)
+		{
+			if (!file.read((char*)run, sizeof(run)) || (run[1] == 0) || ((uint64_t)run[0] + run[1] > header.width))
+				return false;
+			mask.Set_Run((int)i, (int)run[0], (int)(run[0] + run[1] - 1));
+		}
+	return true;
+}
+
+//one row packed 8 pixels to a byte, leftmost pixel in the highest bit
+static void Pack_Row(const uint64_t *words, int rowBytes, uint8_t *packed)
+{
+	const uint8_t *bytes = (const uint8_t*)words;
+	for (int k = 0; k < rowBytes; ++k)
+		packed[k] = BIT_REVERSE_TABLE.bytes[bytes[k]];
+}
+
+//PackBits: a header byte n >= 0 copies the next n + 1 bytes, n < 0 repeats the next byte 1 - n times
+static void Append_PackBits(const uint8_t *row, int count, std::vector<uint8_t> &out)
+{
+	int i = 0;
+	while (i < count)
+	{
+		int repeat = 1;
+		while ((i + repeat < count) && (repeat < 128) && (row[i + repeat] == row[i]))
+			++repeat;
+		if (repeat >= 2)
+		{
+			out.push_back((uint8_t)(1 - repeat));
+			out.push_back(row[i]);
+			i += repeat;
+			continue;
+		}
+
+		//literal bytes up to the next pair of equal ones
+		int literal = 1;
+		while ((i + literal < count) && (literal < 128)
+			&& !((i + literal + 1 < count) && (row[i + literal] == row[i + literal + 1])))
+			++literal;
+		out.push_back((uint8_t)(literal - 1));
+		out.insert(out.end(), row + i, row + i + literal);
+		i += literal;
+	}
+}
+
+static void Put_Entry(std::vector<uint8_t> &ifd, uint16_t tag, uint16_t type, uint32_t count, uint32_t value)
+{
+	uint8_t entry[12];
+	memcpy(entry, &tag, 2);
+	memcpy(entry + 2, &type, 2);
+	memcpy(entry + 4, &count, 4);
+	memcpy(entry + 8, &value, 4);
+	ifd.insert(ifd.end(), entry, entry + 12);
+}
+
+bool Write_Tiff_Mask(const std::string &path, const BinaryMask &mask, bool isCompressed, ThreadPool *pool)
+{
+	const int width = mask.Width();
+	const int height = mask.Height();
+	const int rowBytes = (width + 7) / 8;
+
+	std::vector<std::vector<uint8_t>> bandBytes((height + BAND_ROWS - 1) / BAND_ROWS);
+	For_Each_Band(height, pool, [&](int band, int first, int last)
+	{
+		std::vector<uint8_t> &out = bandBytes[band];
+		std::vector<uint8_t> packed(rowBytes);
+		if (!isCompressed)
+			out.resize((size_t)rowBytes * (last - first));
+		for (int i = first; i < last; ++i)
+		{
+			if (!isCompressed)
+				Pack_Row(mask.Row(i), rowBytes, &out[(size_t)rowBytes * (i - first)]);
+			else
+			{
+				//each row is packed on its own, as the TIFF spec asks
+				Pack_Row(mask.Row(i), rowBytes, packed.data());
+				Append_PackBits(packed.data(), rowBytes, out);
+			}
+		}
+	});
+
+	uint64_t dataBytes = 0;
+	for (size_t b = 0; b < bandBytes.size(); ++b)
+		dataBytes += bandBytes[b].size();
+
+	//header, then the IFD, then the two resolutions, then the strip
+	const uint16_t SHORT = 3, LONG = 4, RATIONAL = 5;
+	const uint16_t ENTRIES = 12;
+	const uint32_t ifdOffset = 8;
+	const uint32_t resolutionOffset = ifdOffset + 2 + ENTRIES * 12 + 4;
+	const uint32_t dataOffset = resolutionOffset + 16;
+	if (dataOffset + dataBytes > 0xFFFFFFFFULL)
+		return false;
+
+	std::vector<uint8_t> head = { 'I', 'I', 42, 0 };
+	head.insert(head.end(), (const uint8_t*)&ifdOffset, (const uint8_t*)&ifdOffset + 4);
+	head.insert(head.end(), (const uint8_t*)&ENTRIES, (const uint8_t*)&ENTRIES + 2);
+	Put_Entry(head, 256, LONG, 1, (uint32_t)width);
+	Put_Entry(head, 257, LONG, 1, (uint32_t)height);
+	Put_Entry(head, 258, SHORT, 1, 1);
+	Put_Entry(head, 259, SHORT, 1, isCompressed ? 32773 : 1);
+	//black is zero, so set pixels come out white as in the 8 bit outputs
+	Put_Entry(head, 262, SHORT, 1, 1);
+	Put_Entry(head, 273, LONG, 1, dataOffset);
+	Put_Entry(head, 277, SHORT, 1, 1);
+	Put_Entry(head, 278, LONG, 1, (uint32_t)std::max(height, 1));
+	Put_Entry(head, 279, LONG, 1, (uint32_t)dataBytes);
+	Put_Entry(head, 282, RATIONAL, 1, resolutionOffset);
+	Put_Entry(head, 283, RATIONAL, 1, resolutionOffset + 8);
+	Put_Entry(head, 296, SHORT, 1, 1);
+	const uint32_t nextIfd = 0;
+	head.insert(head.end(), (const uint8_t*)&nextIfd, (const uint8_t*)&nextIfd + 4);
+	const uint32_t resolution[4] = { 1, 1, 1, 1 };
+	head.insert(head.end(), (const uint8_t*)resolution, (const uint8_t*)resolution + sizeof(resolution));
+
+	std::ofstream file(path, std::ios::binary);
+	if (!file)
+		return false;
+	file.write((const char*)head.data(), head.size());
+	for (size_t b = 0; b < bandBytes.size(); ++b)
+		if (!bandBytes[b].empty())
+			file.write((const char*)bandBytes[b].data(), bandBytes[b].size());
+	return (bool)file;
+}
@@ -0,0 +1,30 @@
+#ifndef MASK_FILE_H
+#define MASK_FILE_H
+
+#include <stdint.h>
+#include <string>
+#include "BinaryMask.h"
+#include "ThreadPool.h"
+
+//Files written straight from the bit packed rows of a mask, without expanding it to 8 bit first.
+//Rows are encoded in bands on the pool and written out in order.
+
+//Run length encoded mask: an RleMaskHeader, then height uint32 run counts (one per row), then the runs of
+//every row in order as uint32 first column and length pairs. Everything is little endian.
+struct RleMaskHeader
+{
+	char magic[8];
+	uint32_t width;
+	uint32_t height;
+	uint64_t runCount;
+};
+
+static const char RLE_MASK_MAGIC[8] = { 'I', 'A', 'S', 'R', 'L', 'E', '1', '\0' };
+
+bool Write_Rle_Mask(const std::string &path, const BinaryMask &mask, ThreadPool *pool = nullptr);
+bool Read_Rle_Mask(const std::string &path, BinaryMask &mask);
+
+//baseline bilevel TIFF, set pixels white, one strip holding every row, optionally PackBits compressed
+bool Write_Tiff_Mask(const std::string &path, const BinaryMask &mask, bool isCompressed, ThreadPool *pool = nullptr);
+
+#endif
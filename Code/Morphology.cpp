@@ -0,0 +1,249 @@
+#include "Morphology.h"
+
+//below this many rows a band is not worth handing to another thread
+static const int MIN_BAND_ROWS = 64;
+
+//working rows of a band, kept per thread so repeated passes reuse them instead of allocating
+struct BandBuffers
+{
+	std::vector<uint64_t> ring;
+	std::vector<int> ringRow;
+	std::vector<uint64_t> tmp;
+	std::vector<uint64_t> eroded;
+	std::vector<uint64_t> inside;
+};
+
+static BandBuffers& Band_Buffers()
+{
+	static thread_local BandBuffers buffers;
+	return buffers;
+}
+
+static bool Is_Cancelled(const std::atomic<bool> *cancel)
+{
+	return (cancel != nullptr) && cancel->load(std::memory_order_relaxed);
+}
+
+//marks the bits of words firstWord.. that fall inside columns first..last
+static void Fill_Run_Words(std::vector<uint64_t> &bits, int firstWord, int words, int first, int last)
+{
+	bits.resize(words);
+	for (int w = 0; w < words; ++w)
+	{
+		int low = std::max(first, (firstWord + w) << 6);
+		int high = std::min(last, ((firstWord + w) << 6) + 63);
+		bits[w] = (low > high) ? 0 : ((~0ULL << (low & 63)) & ((2ULL << (high & 63)) - 1));
+	}
+}
+
+//dst bit j = src bit (j + shift), bits coming from outside the row are 0
+static void Shift_Bits(const uint64_t *src, uint64_t *dst, int words, int shift)
+{
+	int wordShift = (shift >= 0 ? shift : -shift) >> 6;
+	int bitShift = (shift >= 0 ? shift : -shift) & 63;
+
+	for (int w = 0; w < words; ++w)
+	{
+		uint64_t value = 0;
+		if (shift >= 0)
+		{
+			int from = w + wordShift;
+			if (from < words)
+				value = src[from] >> bitShift;
+			if ((bitShift != 0) && (from + 1 < words))
+				value |= src[from + 1] << (64 - bitShift);
+		}
+		else
+		{
+			int from = w - wordShift;
+			if (from >= 0)
+				value = src[from] << bitShift;
+			if ((bitShift != 0) && (from - 1 >= 0))
+				value |= src[from - 1] >> (64 - bitShift);
+		}
+		dst[w] = value;
+	}
+}
+
+template <bool IS_MAX>
+static inline uint64_t Combine_Word(uint64_t a, uint64_t b)
+{
+	return IS_MAX ? (a | b) : (a & b);
+}
+
+//dst bit j = AND (or OR) of src bits j - anchor .. j - anchor + length - 1,
+//the window is built by doubling so it costs log(length) shifts
+template <bool IS_MAX>
+static void Reduce_Bits_Row(const uint64_t *src, uint64_t *dst, uint64_t *tmp, int words, int length, int anchor)
+{
+	memcpy(tmp, src, words * sizeof(uint64_t));
+	int covered = 1;
+	while (covered * 2 <= length)
+	{
+		Shift_Bits(tmp, dst, words, covered);
+		for (int w = 0; w < words; ++w)
+			tmp[w] = Combine_Word<IS_MAX>(tmp[w], dst[w]);
+		covered *= 2;
+	}
+	if (covered < length)
+	{
+		Shift_Bits(tmp, dst, words, length - covered);
+		for (int w = 0; w < words; ++w)
+			tmp[w] = Combine_Word<IS_MAX>(tmp[w], dst[w]);
+	}
+	Shift_Bits(tmp, dst, words, -anchor);
+}
+
+template <bool IS_MAX>
+static void Apply_Rect(const BinaryMask &ipImage, BinaryMask &opImage, int kernelWidth, int kernelHeight, const cv::Rect &area, ThreadPool *pool, const std::atomic<bool> *cancel)
+{
+	const int width = ipImage.Width();
+	const int height = ipImage.Height();
+	if ((kernelWidth < 1) || (kernelHeight < 1) || (width < kernelWidth) || (height < kernelHeight))
+		return;
+
+	const int anchorX = kernelWidth / 2;
+	const int anchorY = kernelHeight / 2;
+
+	//only rows whose whole window is inside the image are written
+	cv::Rect bounds = area & cv::Rect(0, 0, width, height);
+	const int firstRow = std::max(bounds.y, anchorY);
+	const int lastRow = std::min(bounds.y + bounds.height - 1, height - kernelHeight + anchorY);
+	if (bounds.empty() || (firstRow > lastRow))
+		return;
+
+	//only the words covering the area are touched, the input is zero outside it
+	const int firstWord = bounds.x >> 6;
+	const int words = ((bounds.x + bounds.width - 1) >> 6) - firstWord + 1;
+
+	//each band of output rows reads its own halo of kernelHeight - 1 input rows, so bands are independent
+	auto band = [&](int bandFirst, int bandLast)
+	{
+		BandBuffers &buffers = Band_Buffers();
+		std::vector<uint64_t> &ring = buffers.ring;
+		std::vector<uint64_t> &tmp = buffers.tmp;
+		ring.resize((size_t)kernelHeight * words);
+		tmp.resize(words);
+
+		//only columns whose whole window is inside the image are written
+		Fill_Run_Words(buffers.inside, firstWord, words, anchorX, width - kernelWidth + anchorX);
+		const uint64_t *inside = &buffers.inside[0];
+
+		const int firstInput = bandFirst - anchorY;
+		for (int r = firstInput; r <= bandLast - 1 - anchorY + kernelHeight - 1; ++r)
+		{
+			if (Is_Cancelled(cancel))
+				return;
+
+			//row pass
+			Reduce_Bits_Row<IS_MAX>(ipImage.Row(r) + firstWord, &ring[(size_t)(r % kernelHeight) * words], &tmp[0], words, kernelWidth, anchorX);
+
+			//column pass once a full window of rows is in the ring
+			if (r < firstInput + kernelHeight - 1)
+				continue;
+
+			uint64_t *opWords = opImage.Row(r - kernelHeight + 1 + anchorY) + firstWord;
+			for (int w = 0; w < words; ++w)
+			{
+				uint64_t value = ring[(size_t)((r + 1) % kernelHeight) * words + w];
+				for (int k = 2; k <= kernelHeight; ++k)
+					value = Combine_Word<IS_MAX>(value, ring[(size_t)((r + k) % kernelHeight) * words + w]);
+				opWords[w] = (opWords[w] & ~inside[w]) | (value & inside[w]);
+			}
+		}
+	};
+
+	//the bands write their rows at the same time, so a paged output has them allocated first
+	opImage.Allocate(cv::Rect(bounds.x, firstRow, bounds.width, lastRow - firstRow + 1));
+	if (pool != nullptr)
+		pool->Parallel_For(firstRow, lastRow + 1, MIN_BAND_ROWS, band);
+	else
+		band(firstRow, lastRow + 1);
+}
+
+void Erode_Rect(const BinaryMask &ipImage, BinaryMask &opImage, int kernelWidth, int kernelHeight, const cv::Rect &area, ThreadPool *pool, const std::atomic<bool> *cancel)
+{
+	Apply_Rect<false>(ipImage, opImage, kernelWidth, kernelHeight, area, pool, cancel);
+}
+
+void Dilate_Rect(const BinaryMask &ipImage, BinaryMask &opImage, int kernelWidth, int kernelHeight, const cv::Rect &area, ThreadPool *pool, const std::atomic<bool> *cancel)
+{
+	Apply_Rect<true>(ipImage, opImage, kernelWidth, kernelHeight, area, pool, cancel);
+}
+
+size_t Boundary_Rect(const BinaryMask &region, BinaryMask &perimeter, int kernelWidth, int kernelHeight, const cv::Rect &area, ThreadPool *pool, const std::atomic<bool> *cancel)
+{
+	const int width = region.Width();
+	const int height = region.Height();
+	cv::Rect bounds = area & cv::Rect(0, 0, width, height);
+	if (bounds.empty() || (kernelWidth < 1) || (kernelHeight < 1))
+		return 0;
+
+	//only the words covering the area are touched, anything outside it is zero in the region
+	const int firstWord = bounds.x >> 6;
+	const int words = ((bounds.x + bounds.width - 1) >> 6) - firstWord + 1;
+	const int anchorX = kernelWidth / 2;
+	const int anchorY = kernelHeight / 2;
+
+	//bands of rows are independent, each keeps its own ring and count
+	std::atomic<size_t> count{ 0 };
+	auto band = [&](int bandFirst, int bandLast)
+	{
+		//horizontally reduced rows, each slot remembers which row it holds
+		BandBuffers &buffers = Band_Buffers();
+		std::vector<uint64_t> &ring = buffers.ring;
+		std::vector<int> &ringRow = buffers.ringRow;
+		std::vector<uint64_t> &tmp = buffers.tmp;
+		std::vector<uint64_t> &eroded = buffers.eroded;
+		ring.resize((size_t)kernelHeight * words);
+		ringRow.assign(kernelHeight, -1);
+		tmp.resize(words);
+		eroded.resize(words);
+
+		//pixels whose erosion window leaves the image are not eroded, so they stay on the perimeter
+		Fill_Run_Words(buffers.inside, firstWord, words, anchorX, width - kernelWidth + anchorX);
+		const uint64_t *inside = &buffers.inside[0];
+
+		size_t bandCount = 0;
+		for (int i = bandFirst; i < bandLast; ++i)
+		{
+			if (Is_Cancelled(cancel))
+				break;
+
+			std::fill(eroded.begin(), eroded.end(), 0);
+			if ((height >= kernelHeight) && (i >= anchorY) && (i <= height - kernelHeight + anchorY))
+			{
+				//erosion of this row, row pass then column pass
+				for (int k = 0; k < kernelHeight; ++k)
+				{
+					int r = i - anchorY + k;
+					uint64_t *reduced = &ring[(size_t)(r % kernelHeight) * words];
+					if (ringRow[r % kernelHeight] != r)
+					{
+						Reduce_Bits_Row<false>(region.Row(r) + firstWord, reduced, &tmp[0], words, kernelWidth, anchorX);
+						ringRow[r % kernelHeight] = r;
+					}
+					for (int w = 0; w < words; ++w)
+						eroded[w] = (k == 0) ? reduced[w] : (eroded[w] & reduced[w]);
+				}
+			}
+
+			//perimeter is the region minus its erosion, written straight out
+			const uint64_t *regionWords = region.Row(i) + firstWord;
+			uint64_t *perimeterWords = perimeter.Row(i) + firstWord;
+			for (int w = 0; w < words; ++w)
+			{
+				perimeterWords[w] = regionWords[w] & ~(eroded[w] & inside[w]);
+				bandCount += Count_Set_Bits(perimeterWords[w]);
+			}
+		}
+		count += bandCount;
+	};
+
+	perimeter.Allocate(bounds);
+	if (pool != nullptr)
+		pool->Parallel_For(bounds.y, bounds.y + bounds.height, MIN_BAND_ROWS, band);
+	else
+		band(bounds.y, bounds.y + bounds.height);
+	return count;
+}
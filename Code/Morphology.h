@@ -0,0 +1,28 @@
+#ifndef MORPHOLOGY_H
+#define MORPHOLOGY_H
+
+#include <atomic>
+#include <opencv2/opencv.hpp>
+#include "BinaryMask.h"
+#include "ThreadPool.h"
+
+//Erosion and dilation of bit packed masks with a kernelWidth x kernelHeight rectangle, done a word at a
+//time with shifts and ANDs (erosion) or ORs (dilation). Each input row is reduced horizontally once (row pass),
+//then kernelHeight reduced rows are combined into the output row (column pass). The horizontal window is built
+//by doubling, so wide kernels cost log(kernelWidth) shifts per word.
+//As with the original 3x3 passes only pixels whose whole window is inside the image are written,
+//the border of opImage is left as it was. The anchor is the kernel centre (size / 2).
+//Only the rows and words covering area are processed. ipImage must be zero outside area and only
+//pixels inside it are written, so area has to allow for the result growing by the kernel size.
+//With a pool the output rows are split into bands run in parallel, ipImage and opImage must then differ.
+//Once cancel is set the remaining rows are skipped and opImage is left partly written.
+void Erode_Rect(const BinaryMask &ipImage, BinaryMask &opImage, int kernelWidth, int kernelHeight, const cv::Rect &area, ThreadPool *pool = nullptr, const std::atomic<bool> *cancel = nullptr);
+void Dilate_Rect(const BinaryMask &ipImage, BinaryMask &opImage, int kernelWidth, int kernelHeight, const cv::Rect &area, ThreadPool *pool = nullptr, const std::atomic<bool> *cancel = nullptr);
+
+//Perimeter of a region in one pass: region AND NOT erosion(region), computed row by row without
+//materialising the eroded mask. Only rows and words covering area are processed, area must contain
+//every set pixel of region and the rest of perimeter is expected to be clear.
+//Returns the number of perimeter pixels, counted as the rows are written.
+size_t Boundary_Rect(const BinaryMask &region, BinaryMask &perimeter, int kernelWidth, int kernelHeight, const cv::Rect &area, ThreadPool *pool = nullptr, const std::atomic<bool> *cancel = nullptr);
+
+#endif
@@ -0,0 +1,145 @@
+#include "PixelClassifier.h"
+#include "BitOps.h"
+
+//maps 6 bits of per channel results (two pixels) to 2 bits of per pixel results
+struct TripleTable
+{
+	unsigned char bits[64];
+	TripleTable()
+	{
+		for (int i = 0; i < 64; ++i)
+			bits[i] = (unsigned char)(((i & 7) == 7 ? 1 : 0) | (((i >> 3) & 7) == 7 ? 2 : 0));
+	}
+};
+
+static const TripleTable TRIPLE_TABLE;
+
+//48 per channel bits of 16 consecutive pixels down to 16 per pixel bits
+static inline uint64_t Gather_Pixels(uint64_t channelBits)
+{
+	uint64_t pixelBits = 0;
+	for (int k = 0; k < 8; ++k)
+		pixelBits |= (uint64_t)TRIPLE_TABLE.bits[(channelBits >> (6 * k)) & 63] << (2 * k);
+	return pixelBits;
+}
+
+static void Classify_Scalar(const unsigned char *seed, int tolerance, const unsigned char *src, int first, int width, uint64_t *mask)
+{
+	for (int j = first; j < width; ++j)
+	{
+		const unsigned char *px = src + 3 * j;
+		if ((abs(px[0] - seed[0]) < tolerance) && (abs(px[1] - seed[1]) < tolerance) && (abs(px[2] - seed[2]) < tolerance))
+			mask[j >> 6] |= 1ULL << (j & 63);
+	}
+}
+
+#ifdef IAS_HAVE_SSE2
+static inline uint32_t Channel_Bits_Sse2(__m128i value, __m128i seed, __m128i limit)
+{
+	__m128i diff = _mm_or_si128(_mm_subs_epu8(value, seed), _mm_subs_epu8(seed, value));
+	return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(diff, limit), limit));
+}
+
+static int Classify_Sse2(const unsigned char *pattern, int tolerance, const unsigned char *src, int width, uint64_t *mask)
+{
+	const __m128i seed0 = _mm_loadu_si128((const __m128i*)pattern);
+	const __m128i seed1 = _mm_loadu_si128((const __m128i*)(pattern + 16));
+	const __m128i seed2 = _mm_loadu_si128((const __m128i*)(pattern + 32));
+	const __m128i limit = _mm_set1_epi8((char)(tolerance - 1));
+
+	//16 pixels per step, the steps never straddle a mask word
+	int j = 0;
+	for (; j + 16 <= width; j += 16)
+	{
+		const unsigned char *px = src + 3 * j;
+		uint64_t channelBits = Channel_Bits_Sse2(_mm_loadu_si128((const __m128i*)px), seed0, limit);
+		channelBits |= (uint64_t)Channel_Bits_Sse2(_mm_loadu_si128((const __m128i*)(px + 16)), seed1, limit) << 16;
+		channelBits |= (uint64_t)Channel_Bits_Sse2(_mm_loadu_si128((const __m128i*)(px + 32)), seed2, limit) << 32;
+		mask[j >> 6] |= Gather_Pixels(channelBits) << (j & 63);
+	}
+	return j;
+}
+#endif
+
+#ifdef IAS_HAVE_AVX2
+static IAS_TARGET_AVX2 inline uint64_t Channel_Bits_Avx2(__m256i value, __m256i seed, __m256i limit)
+{
+	__m256i diff = _mm256_or_si256(_mm256_subs_epu8(value, seed), _mm256_subs_epu8(seed, value));
+	return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(diff, limit), limit));
+}
+
+static IAS_TARGET_AVX2 int Classify_Avx2(const unsigned char *pattern, int tolerance, const unsigned char *src, int width, uint64_t *mask)
+{
+	const __m256i seed0 = _mm256_loadu_si256((const __m256i*)pattern);
+	const __m256i seed1 = _mm256_loadu_si256((const __m256i*)(pattern + 32));
+	const __m256i seed2 = _mm256_loadu_si256((const __m256i*)(pattern + 64));
+	const __m256i limit = _mm256_set1_epi8((char)(tolerance - 1));
+
+	//32 pixels per step, 96 channel bits split in two halves of 16 pixels
+	int j = 0;
+	for (; j + 32 <= width; j += 32)
+	{
+		const unsigned char *px = src + 3 * j;
+		uint64_t bits0 = Channel_Bits_Avx2(_mm256_loadu_si256((const __m256i*)px), seed0, limit);
+		uint64_t bits1 = Channel_Bits_Avx2(_mm256_loadu_si256((const __m256i*)(px + 32)), seed1, limit);
+		uint64_t bits2 = Channel_Bits_Avx2(_mm256_loadu_si256((const __m256i*)(px + 64)), seed2, limit);
+		uint64_t pixelBits = Gather_Pixels(bits0 | ((bits1 & 0xFFFF) << 32));
+		pixelBits |= Gather_Pixels((bits1 >> 16) | (bits2 << 16)) << 16;
+		mask[j >> 6] |= pixelBits << (j & 63);
+	}
+	return j;
+}
+#endif
+
+PixelClassifier::PixelClassifier()
+{
+	m_seed[0] = m_seed[1] = m_seed[2] = 0;
+	m_tolerance = 0;
+	m_level = Detect_Simd_Level();
+}
+
+void PixelClassifier::Set_Seed(const cv::Vec3b &seed, int tolerance)
+{
+	m_seed[0] = seed[0];
+	m_seed[1] = seed[1];
+	m_seed[2] = seed[2];
+	m_tolerance = tolerance;
+}
+
+void PixelClassifier::Set_Level(SimdLevel level)
+{
+	//never go above what the cpu can run
+	m_level = (level < Detect_Simd_Level()) ? level : Detect_Simd_Level();
+}
+
+SimdLevel PixelClassifier::Get_Level()
+{
+	return m_level;
+}
+
+void PixelClassifier::Classify_Row(const cv::Vec3b *row, int width, uint64_t *mask)
+{
+	memset(mask, 0, Words_Per_Row(width) * sizeof(uint64_t));
+	if (m_tolerance <= 0)
+		return;
+
+	//tolerances above 255 accept everything, which the saturated limit below already does
+	int tolerance = (m_tolerance > 256) ? 256 : m_tolerance;
+	const unsigned char *src = (const unsigned char*)row;
+
+	//the seed colour repeated so any block of 16 or 32 pixels starts on the same phase
+	unsigned char pattern[96];
+	for (int i = 0; i < 96; ++i)
+		pattern[i] = m_seed[i % 3];
+
+	int done = 0;
+#ifdef IAS_HAVE_AVX2
+	if (m_level == SIMD_AVX2)
+		done = Classify_Avx2(pattern, tolerance, src, width, mask);
+#endif
+#ifdef IAS_HAVE_SSE2
+	if (m_level == SIMD_SSE2)
+		done = Classify_Sse2(pattern, tolerance, src, width, mask);
+#endif
+	Classify_Scalar(m_seed, tolerance, src, done, width, mask);
+}
@@ -0,0 +1,26 @@
+#ifndef PIXEL_CLASSIFIER_H
+#define PIXEL_CLASSIFIER_H
+
+#include <stdint.h>
+#include <opencv2/opencv.hpp>
+#include "Simd.h"
+
+//Classifies whole rows of a BGR image against a seed colour.
+//A pixel is a candidate when every channel differs from the seed by less than the tolerance,
+//the result is packed 64 pixels per word with pixel j in bit (j % 64) of word (j / 64).
+class PixelClassifier
+{
+private:
+	unsigned char m_seed[3];
+	int m_tolerance;
+	SimdLevel m_level;
+
+public:
+	PixelClassifier();
+	void Set_Seed(const cv::Vec3b &seed, int tolerance);
+	void Set_Level(SimdLevel level);
+	SimdLevel Get_Level();
+	void Classify_Row(const cv::Vec3b *row, int width, uint64_t *mask);
+};
+
+#endif
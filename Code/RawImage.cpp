@@ -0,0 +1,112 @@
+#include "RawImage.h"
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <sstream>
+#include <thread>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+static int Process_Id()
+{
+#ifdef _WIN32
+	return _getpid();
+#else
+	return (int)getpid();
+#endif
+}
+
+bool Is_Raw_Image_Path(const std::string &path)
+{
+	size_t length = strlen(RAW_IMAGE_EXTENSION);
+	return (path.size() > length) && (path.compare(path.size() - length, length, RAW_IMAGE_EXTENSION) == 0);
+}
+
+bool Write_Raw_Image(const std::string &path, const cv::Mat &image, uint64_t sourceSize, uint64_t sourceTime)
+{
+	if (image.empty() || (image.type() != CV_8UC3))
+		return false;
+
+	RawImageHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, RAW_IMAGE_MAGIC, sizeof(header.magic));
+	header.width = (uint32_t)image.cols;
+	header.height = (uint32_t)image.rows;
+	header.channels = 3;
+	header.rowBytes = (uint32_t)image.cols * 3;
+	header.dataOffset = RAW_IMAGE_ALIGNMENT;
+	header.sourceSize = sourceSize;
+	header.sourceTime = sourceTime;
+
+	//readers never see a half written file. Every writer, in this process or another one loading the same
+	//image, has a temp file of its own
+	std::ostringstream tmpName;
+	tmpName << path << "." << Process_Id() << "." << std::hash<std::thread::id>()(std::this_thread::get_id()) << ".tmp";
+	std::string tmpPath = tmpName.str();
+	{
+		std::ofstream file(tmpPath, std::ios::binary);
+		if (!file)
+			return false;
+
+		std::vector<char> padding((size_t)header.dataOffset, 0);
+		memcpy(padding.data(), &header, sizeof(header));
+		file.write(padding.data(), padding.size());
+		for (int i = 0; i < image.rows; ++i)
+			file.write((const char*)image.ptr<uchar>(i), header.rowBytes);
+		if (!file)
+		{
+			file.close();
+			std::remove(tmpPath.c_str());
+			return false;
+		}
+	}
+
+	//rename replaces the file in one step on POSIX, so readers find either the old cache or the new one.
+	//Windows does not replace an existing file on rename
+#ifdef _WIN32
+	std::remove(path.c_str());
+#endif
+	if (std::rename(tmpPath.c_str(), path.c_str()) != 0)
+	{
+		std::remove(tmpPath.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool Is_Valid_Raw_Header(const RawImageHeader &header)
+{
+	return (memcmp(header.magic, RAW_IMAGE_MAGIC, sizeof(header.magic)) == 0) && (header.channels == 3)
+		&& (header.width > 0) && (header.height > 0) && (header.rowBytes >= (uint64_t)header.width * 3)
+		&& (header.dataOffset >= sizeof(header));
+}
+
+bool Read_Raw_Header(std::istream &file, RawImageHeader &header)
+{
+	file.seekg(0);
+	if (!file.read((char*)&header, sizeof(header)))
+		return false;
+	return Is_Valid_Raw_Header(header);
+}
+
+bool Get_File_Stamp(const std::string &path, uint64_t &size, uint64_t &time)
+{
+	//the 32 bit st_size of MSVC's plain stat fails for files over 2 GB
+#ifdef _WIN32
+	struct _stat64 info;
+	if (_stat64(path.c_str(), &info) != 0)
+		return false;
+#else
+	struct stat info;
+	if (stat(path.c_str(), &info) != 0)
+		return false;
+#endif
+	size = (uint64_t)info.st_size;
+	time = (uint64_t)info.st_mtime;
+	return true;
+}
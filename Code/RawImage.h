@@ -0,0 +1,39 @@
+#ifndef RAW_IMAGE_H
+#define RAW_IMAGE_H
+
+#include <stdint.h>
+#include <string>
+#include <opencv2/opencv.hpp>
+
+//On disk raw image: a RawImageHeader, padding up to dataOffset, then height rows of width interleaved
+//BGR pixels, rowBytes apart. Everything is little endian. dataOffset is a multiple of RAW_IMAGE_ALIGNMENT,
+//so the rows of a mapped file start on a page. A raw file made as a cache of another image file records
+//that file's size and modification time, 0 otherwise.
+struct RawImageHeader
+{
+	char magic[8];
+	uint32_t width;
+	uint32_t height;
+	uint32_t channels;
+	uint32_t rowBytes;
+	uint64_t dataOffset;
+	uint64_t sourceSize;
+	uint64_t sourceTime;
+};
+
+static const char RAW_IMAGE_MAGIC[8] = { 'I', 'A', 'S', 'R', 'A', 'W', '1', '\0' };
+static const uint64_t RAW_IMAGE_ALIGNMENT = 4096;
+static const char RAW_IMAGE_EXTENSION[] = ".iasraw";
+
+//true for file names ending in RAW_IMAGE_EXTENSION
+bool Is_Raw_Image_Path(const std::string &path);
+//writes a CV_8UC3 image in the raw format, through a temporary file renamed into place
+bool Write_Raw_Image(const std::string &path, const cv::Mat &image, uint64_t sourceSize = 0, uint64_t sourceTime = 0);
+//true when the header describes a raw image this code can read
+bool Is_Valid_Raw_Header(const RawImageHeader &header);
+//reads and checks the header of a raw image
+bool Read_Raw_Header(std::istream &file, RawImageHeader &header);
+//size and modification time of a file, false if it can not be found
+bool Get_File_Stamp(const std::string &path, uint64_t &size, uint64_t &time);
+
+#endif
@@ -0,0 +1,149 @@
+#include "RegionCache.h"
+
+bool RegionKey::operator==(const RegionKey &other) const
+{
+	return (generation == other.generation) && (colour == other.colour) && (tolerance == other.tolerance)
+		&& (kernelWidth == other.kernelWidth) && (kernelHeight == other.kernelHeight);
+}
+
+size_t CachedRegion::Bytes() const
+{
+	return sizeof(CachedRegion) + fill.Bytes() + region.Bytes() + perimeter.Bytes();
+}
+
+void RegionCache::Set_Limit(size_t bytes)
+{
+	m_limit = bytes;
+	Evict();
+}
+
+size_t RegionCache::Limit() const
+{
+	return m_limit;
+}
+
+bool RegionCache::Enabled() const
+{
+	return m_limit > 0;
+}
+
+void RegionCache::Clear()
+{
+	m_entries.clear();
+	m_bytes = 0;
+}
+
+void RegionCache::Evict()
+{
+	while ((m_bytes > m_limit) && !m_entries.empty())
+	{
+		m_bytes -= m_entries.back().Bytes();
+		m_entries.pop_back();
+	}
+}
+
+bool RegionCache::Evict_Oldest()
+{
+	if (m_entries.empty())
+		return false;
+	m_bytes -= m_entries.back().Bytes();
+	m_entries.pop_back();
+	return true;
+}
+
+const CachedRegion* RegionCache::Find(const RegionKey &key, int seedRow, int seedCol)
+{
+	bool isInterior = (seedRow > 0) && (seedCol > 0);
+	for (std::list<CachedRegion>::iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+	{
+		if (!(it->key == key))
+			continue;
+
+		bool isSamePixel = (it->seedRow == seedRow) && (it->seedCol == seedCol);
+		bool isInside = isInterior && (it->seedRow > 0) && (it->seedCol > 0)
+			&& it->fillBounds.contains(cv::Point(seedCol, seedRow))
+			&& it->fill.Get(seedRow - it->fillBounds.y, seedCol - it->fillBounds.x);
+		if (!isSamePixel && !isInside)
+			continue;
+
+		//most recently used goes to the front
+		m_entries.splice(m_entries.begin(), m_entries, it);
+		++m_hits;
+		return &m_entries.front();
+	}
+	++m_misses;
+	return nullptr;
+}
+
+size_t RegionCache::Insert(const RegionKey &key, int seedRow, int seedCol, BinaryMask &fill, const cv::Rect &fillBounds,
+	const BinaryMask &region, const cv::Rect &regionArea, const RegionMoments &fillMoments,
+	const RegionMoments &regionMoments, const cv::Rect &regionExtent)
+{
+	if (!Enabled())
+		return 0;
+
+	m_entries.push_front(CachedRegion());
+	CachedRegion &entry = m_entries.front();
+	entry.id = m_nextId++;
+	entry.key = key;
+	entry.seedRow = seedRow;
+	entry.seedCol = seedCol;
+	entry.fillBounds = fillBounds;
+	std::swap(entry.fill, fill);
+	entry.regionArea = regionArea;
+	entry.region.Crop(region, regionArea);
+	entry.fillMoments = fillMoments;
+	entry.regionMoments = regionMoments;
+	entry.regionExtent = regionExtent;
+	m_bytes += entry.Bytes();
+
+	size_t id = entry.id;
+	Evict();
+	return (!m_entries.empty() && (m_entries.front().id == id)) ? id : 0;
+}
+
+const CachedRegion* RegionCache::Get(size_t id) const
+{
+	for (std::list<CachedRegion>::const_iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+		if (it->id == id)
+			return &(*it);
+	return nullptr;
+}
+
+void RegionCache::Store_Perimeter(size_t id, const BinaryMask &perimeter, const cv::Rect &perimeterArea, size_t perimeterLength)
+{
+	for (std::list<CachedRegion>::iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+	{
+		if (it->id != id)
+			continue;
+
+		m_bytes -= it->Bytes();
+		it->hasPerimeter = true;
+		it->perimeterArea = perimeterArea;
+		it->perimeter.Crop(perimeter, perimeterArea);
+		it->perimeterLength = perimeterLength;
+		m_bytes += it->Bytes();
+		Evict();
+		return;
+	}
+}
+
+size_t RegionCache::Hits() const
+{
+	return m_hits;
+}
+
+size_t RegionCache::Misses() const
+{
+	return m_misses;
+}
+
+size_t RegionCache::Bytes() const
+{
+	return m_bytes;
+}
+
+size_t RegionCache::Entries() const
+{
+	return m_entries.size();
+}
@@ -0,0 +1,88 @@
+#ifndef REGION_CACHE_H
+#define REGION_CACHE_H
+
+#include <list>
+#include <opencv2/opencv.hpp>
+#include "BinaryMask.h"
+#include "RegionStats.h"
+
+//everything a region depends on apart from the seed position
+struct RegionKey
+{
+	unsigned int generation;
+	int colour;
+	int tolerance;
+	int kernelWidth;
+	int kernelHeight;
+
+	bool operator==(const RegionKey &other) const;
+};
+
+//a grown region, masks are cropped to their areas
+struct CachedRegion
+{
+	size_t id = 0;
+	RegionKey key;
+	int seedRow = 0;
+	int seedCol = 0;
+	cv::Rect fillBounds;
+	BinaryMask fill;
+	cv::Rect regionArea;
+	BinaryMask region;
+	//statistics of the fill and of the region, so a hit does not need to gather them again
+	RegionMoments fillMoments;
+	RegionMoments regionMoments;
+	cv::Rect regionExtent;
+	bool hasPerimeter = false;
+	cv::Rect perimeterArea;
+	BinaryMask perimeter;
+	size_t perimeterLength = 0;
+
+	size_t Bytes() const;
+};
+
+//Least recently used cache of grown regions.
+//A seed hits an entry with the same key when it is on the entry's seed pixel, or when both seeds are off
+//row 0 and column 0 and the seed is inside the entry's raw fill (before opening and closing): such a seed
+//grows exactly the same connected component.
+class RegionCache
+{
+private:
+	std::list<CachedRegion> m_entries;
+	size_t m_limit = 64 * 1024 * 1024;
+	size_t m_bytes = 0;
+	size_t m_hits = 0;
+	size_t m_misses = 0;
+	size_t m_nextId = 1;
+
+	void Evict();
+
+public:
+	//byte budget for the cached masks, 0 turns the cache off
+	void Set_Limit(size_t bytes);
+	size_t Limit() const;
+	bool Enabled() const;
+	void Clear();
+	//drops the least recently used entry, false when there is none
+	bool Evict_Oldest();
+
+	//the entry for a seed, nullptr on a miss. Counts the hit or miss and marks the entry most recently used
+	const CachedRegion* Find(const RegionKey &key, int seedRow, int seedCol);
+	//stores a freshly grown region and returns its id, 0 if it does not fit in the budget.
+	//fill is the raw fill already cropped to fillBounds and is taken over, region is cropped to regionArea.
+	//regionExtent is the region's exact bounding box
+	size_t Insert(const RegionKey &key, int seedRow, int seedCol, BinaryMask &fill, const cv::Rect &fillBounds,
+		const BinaryMask &region, const cv::Rect &regionArea, const RegionMoments &fillMoments,
+		const RegionMoments &regionMoments, const cv::Rect &regionExtent);
+	//the entry id if it is still cached, without counting or reordering
+	const CachedRegion* Get(size_t id) const;
+	//adds the perimeter of the entry id, if it is still cached
+	void Store_Perimeter(size_t id, const BinaryMask &perimeter, const cv::Rect &perimeterArea, size_t perimeterLength);
+
+	size_t Hits() const;
+	size_t Misses() const;
+	size_t Bytes() const;
+	size_t Entries() const;
+};
+
+#endif
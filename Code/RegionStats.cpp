@@ -0,0 +1,64 @@
+#include "RegionStats.h"
+#include "BitOps.h"
+
+void RegionMoments::Clear()
+{
+	*this = RegionMoments();
+}
+
+void RegionMoments::Add(const RegionMoments &other)
+{
+	area += other.area;
+	rowSum += other.rowSum;
+	colSum += other.colSum;
+	for (int c = 0; c < 3; ++c)
+		colourSum[c] += other.colourSum[c];
+}
+
+void RegionMoments::Subtract(const RegionMoments &other)
+{
+	area -= other.area;
+	rowSum -= other.rowSum;
+	colSum -= other.colSum;
+	for (int c = 0; c < 3; ++c)
+		colourSum[c] -= other.colourSum[c];
+}
+
+void RegionMoments::Add_Pixel(int row, int col, const cv::Vec3b &colour)
+{
+	++area;
+	rowSum += (uint64_t)row;
+	colSum += (uint64_t)col;
+	for (int c = 0; c < 3; ++c)
+		colourSum[c] += colour[c];
+}
+
+void RegionMoments::Add_Run(int row, int first, int last, const cv::Vec3b *pixels)
+{
+	//positions of a run are an arithmetic series, only the colours need the pixels
+	uint64_t length = (uint64_t)(last - first + 1);
+	area += length;
+	rowSum += (uint64_t)row * length;
+	colSum += ((uint64_t)first + (uint64_t)last) * length / 2;
+
+	uint64_t sum0 = 0, sum1 = 0, sum2 = 0;
+	for (int c = first; c <= last; ++c)
+	{
+		sum0 += pixels[c][0];
+		sum1 += pixels[c][1];
+		sum2 += pixels[c][2];
+	}
+	colourSum[0] += sum0;
+	colourSum[1] += sum1;
+	colourSum[2] += sum2;
+}
+
+void RegionMoments::Add_Word(int row, int firstCol, uint64_t bits, const cv::Vec3b *pixels)
+{
+	while (bits != 0)
+	{
+		int col = firstCol + Lowest_Set_Bit(bits);
+		Add_Pixel(row, col, pixels[col]);
+		bits &= bits - 1;
+	}
+}
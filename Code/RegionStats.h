@@ -0,0 +1,29 @@
+#ifndef REGION_STATS_H
+#define REGION_STATS_H
+
+#include <stdint.h>
+#include <opencv2/opencv.hpp>
+
+//Sums over a region's pixels that its area, centroid and mean colour follow from.
+//Sums only add up, so a region can be gathered a run at a time while it is filled, row by row in
+//parallel, and the pixels a cleanup adds or removes can be put in or taken out afterwards
+//(unsigned wrap around keeps taking out exact).
+struct RegionMoments
+{
+	uint64_t area = 0;
+	uint64_t rowSum = 0;
+	uint64_t colSum = 0;
+	//per channel of the input, so blue, green, red
+	uint64_t colourSum[3] = { 0, 0, 0 };
+
+	void Clear();
+	void Add(const RegionMoments &other);
+	void Subtract(const RegionMoments &other);
+	void Add_Pixel(int row, int col, const cv::Vec3b &colour);
+	//columns first..last of a row, pixels is the row's input
+	void Add_Run(int row, int first, int last, const cv::Vec3b *pixels);
+	//the set bits of a mask word whose bit 0 is column firstCol
+	void Add_Word(int row, int firstCol, uint64_t bits, const cv::Vec3b *pixels);
+};
+
+#endif
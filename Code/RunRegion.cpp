@@ -0,0 +1,480 @@
+#include "RunRegion.h"
+#include <algorithm>
+
+RunRegion::RunRegion()
+{
+	m_rowStarts.assign(1, 0);
+}
+
+void RunRegion::Create(int width, int height, int top)
+{
+	m_width = width;
+	m_height = height;
+	m_top = top;
+	m_rowStarts.assign(1, 0);
+	m_runs.clear();
+}
+
+void RunRegion::Clear()
+{
+	Create(m_width, m_height, 0);
+}
+
+int RunRegion::Width() const
+{
+	return m_width;
+}
+
+int RunRegion::Height() const
+{
+	return m_height;
+}
+
+int RunRegion::Top() const
+{
+	return m_top;
+}
+
+int RunRegion::Rows() const
+{
+	return (int)m_rowStarts.size() - 1;
+}
+
+int RunRegion::Run_Count() const
+{
+	return (int)m_runs.size();
+}
+
+bool RunRegion::Empty() const
+{
+	return m_runs.empty();
+}
+
+int RunRegion::Row(int row, const Run *&runs) const
+{
+	int i = row - m_top;
+	if ((i < 0) || (i >= Rows()))
+	{
+		runs = nullptr;
+		return 0;
+	}
+	runs = m_runs.data() + m_rowStarts[i];
+	return m_rowStarts[i + 1] - m_rowStarts[i];
+}
+
+void RunRegion::Add_Row(const Run *runs, int count)
+{
+	m_runs.insert(m_runs.end(), runs, runs + count);
+	m_rowStarts.push_back((int)m_runs.size());
+}
+
+void RunRegion::Add_Row(const std::vector<Run> &runs)
+{
+	Add_Row(runs.data(), (int)runs.size());
+}
+
+std::vector<Run>& RunRegion::Begin_Row()
+{
+	return m_runs;
+}
+
+void RunRegion::End_Row()
+{
+	m_rowStarts.push_back((int)m_runs.size());
+}
+
+void RunRegion::Offset_Rows(int rows)
+{
+	m_top += rows;
+}
+
+void RunRegion::From_Runs(int width, int height, std::vector<RowRun> &runs)
+{
+	Create(width, height, 0);
+	if (runs.empty())
+		return;
+
+	//counting sort by row, then each row by column, so the cost follows the number of runs
+	int top = height, bottom = -1;
+	for (size_t r = 0; r < runs.size(); ++r)
+	{
+		top = std::min(top, runs[r].row);
+		bottom = std::max(bottom, runs[r].row);
+	}
+	m_top = top;
+	m_rowStarts.assign(bottom - top + 2, 0);
+	for (size_t r = 0; r < runs.size(); ++r)
+		++m_rowStarts[runs[r].row - top + 1];
+	for (size_t i = 1; i < m_rowStarts.size(); ++i)
+		m_rowStarts[i] += m_rowStarts[i - 1];
+
+	//placing a run moves its row's start on, so afterwards every start is where the next row's was
+	m_runs.resize(runs.size());
+	for (size_t r = 0; r < runs.size(); ++r)
+	{
+		Run run = { runs[r].first, runs[r].last };
+		m_runs[m_rowStarts[runs[r].row - top]++] = run;
+	}
+	for (size_t i = m_rowStarts.size() - 1; i > 0; --i)
+		m_rowStarts[i] = m_rowStarts[i - 1];
+	m_rowStarts[0] = 0;
+
+	//the fill can leave two runs of a row side by side, they are joined so every run is as long as it can be
+	size_t kept = 0;
+	int rowFirst = 0;
+	for (size_t i = 0; i + 1 < m_rowStarts.size(); ++i)
+	{
+		int first = rowFirst;
+		int last = m_rowStarts[i + 1];
+		rowFirst = last;
+		std::sort(m_runs.begin() + first, m_runs.begin() + last, [](const Run &a, const Run &b) { return a.first < b.first; });
+		m_rowStarts[i] = (int)kept;
+		for (int r = first; r < last; ++r)
+		{
+			if ((r > first) && (m_runs[r].first == m_runs[kept - 1].last + 1))
+				m_runs[kept - 1].last = m_runs[r].last;
+			else
+				m_runs[kept++] = m_runs[r];
+		}
+	}
+	m_rowStarts.back() = (int)kept;
+	m_runs.resize(kept);
+}
+
+void RunRegion::From_Mask(const BinaryMask &mask, const cv::Rect &area)
+{
+	Create(mask.Width(), mask.Height(), 0);
+	cv::Rect bounds = area & cv::Rect(0, 0, mask.Width(), mask.Height());
+	if (bounds.empty())
+		return;
+
+	m_top = bounds.y;
+	const int firstCol = bounds.x;
+	const int lastCol = bounds.x + bounds.width - 1;
+	const int lastWord = lastCol >> 6;
+	for (int i = bounds.y; i < bounds.y + bounds.height; ++i)
+	{
+		const uint64_t *words = mask.Row(i);
+		int col = firstCol;
+		while (col <= lastCol)
+		{
+			//next set pixel
+			int w = col >> 6;
+			uint64_t bits = words[w] & (~0ULL << (col & 63));
+			while ((bits == 0) && (++w <= lastWord))
+				bits = words[w];
+			if (bits == 0)
+				break;
+			int first = (w << 6) + Lowest_Set_Bit(bits);
+			if (first > lastCol)
+				break;
+
+			//next clear pixel
+			w = first >> 6;
+			bits = ~words[w] & (~0ULL << (first & 63));
+			while ((bits == 0) && (++w <= lastWord))
+				bits = ~words[w];
+			col = (bits == 0) ? lastCol + 1 : std::min(lastCol + 1, (w << 6) + Lowest_Set_Bit(bits));
+
+			Run run = { first, col - 1 };
+			m_runs.push_back(run);
+		}
+		m_rowStarts.push_back((int)m_runs.size());
+	}
+}
+
+void RunRegion::To_Mask(BinaryMask &mask) const
+{
+	for (int i = 0; i < Rows(); ++i)
+		for (int r = m_rowStarts[i]; r < m_rowStarts[i + 1]; ++r)
+			mask.Set_Run(m_top + i, m_runs[r].first, m_runs[r].last);
+}
+
+size_t RunRegion::Area() const
+{
+	size_t area = 0;
+	for (size_t r = 0; r < m_runs.size(); ++r)
+		area += m_runs[r].last - m_runs[r].first + 1;
+	return area;
+}
+
+cv::Rect RunRegion::Bounding_Box() const
+{
+	int top = -1, bottom = -1, left = m_width, right = -1;
+	for (int i = 0; i < Rows(); ++i)
+	{
+		if (m_rowStarts[i] == m_rowStarts[i + 1])
+			continue;
+		if (top < 0)
+			top = m_top + i;
+		bottom = m_top + i;
+		//runs are sorted, so only the ends of the row matter
+		left = std::min(left, m_runs[m_rowStarts[i]].first);
+		right = std::max(right, m_runs[m_rowStarts[i + 1] - 1].last);
+	}
+	if (top < 0)
+		return cv::Rect();
+	return cv::Rect(left, top, right - left + 1, bottom - top + 1);
+}
+
+size_t RunRegion::Bytes() const
+{
+	return m_runs.size() * sizeof(Run) + m_rowStarts.size() * sizeof(int);
+}
+
+//appends run to out, joining it to the last run if they overlap or touch
+static inline void Append_Run(std::vector<Run> &out, size_t rowStart, int first, int last)
+{
+	if ((out.size() > rowStart) && (first <= out.back().last + 1))
+		out.back().last = std::max(out.back().last, last);
+	else
+	{
+		Run run = { first, last };
+		out.push_back(run);
+	}
+}
+
+void Union_Runs(const Run *a, int aCount, const Run *b, int bCount, std::vector<Run> &out)
+{
+	size_t rowStart = out.size();
+	int i = 0, j = 0;
+	while ((i < aCount) || (j < bCount))
+	{
+		const Run &run = ((j >= bCount) || ((i < aCount) && (a[i].first <= b[j].first))) ? a[i++] : b[j++];
+		Append_Run(out, rowStart, run.first, run.last);
+	}
+}
+
+void Intersect_Runs(const Run *a, int aCount, const Run *b, int bCount, std::vector<Run> &out)
+{
+	int i = 0, j = 0;
+	while ((i < aCount) && (j < bCount))
+	{
+		int first = std::max(a[i].first, b[j].first);
+		int last = std::min(a[i].last, b[j].last);
+		if (first <= last)
+		{
+			Run run = { first, last };
+			out.push_back(run);
+		}
+		//the run ending first cannot meet anything further on
+		if (a[i].last < b[j].last)
+			++i;
+		else
+			++j;
+	}
+}
+
+void Subtract_Runs(const Run *a, int aCount, const Run *b, int bCount, std::vector<Run> &out)
+{
+	int j = 0;
+	for (int i = 0; i < aCount; ++i)
+	{
+		int first = a[i].first;
+		const int last = a[i].last;
+		while ((j < bCount) && (b[j].last < first))
+			++j;
+		//cut every run of b that falls inside this one, the last of them may reach the next run of a
+		int k = j;
+		while ((k < bCount) && (b[k].first <= last) && (first <= last))
+		{
+			if (b[k].first > first)
+			{
+				Run run = { first, b[k].first - 1 };
+				out.push_back(run);
+			}
+			first = b[k].last + 1;
+			++k;
+		}
+		if (first <= last)
+		{
+			Run run = { first, last };
+			out.push_back(run);
+		}
+	}
+}
+
+//op holds rows top..bottom, kept inside the image, row r being what makeRow(r, out) appends.
+//The runs go straight into op, which keeps its capacity from one build to the next
+template <typename MakeRow>
+static void Build_Rows(RunRegion &op, int width, int height, int top, int bottom, MakeRow makeRow)
+{
+	top = std::max(top, 0);
+	bottom = std::min(bottom, height - 1);
+	op.Create(width, height, top);
+	for (int r = top; r <= bottom; ++r)
+	{
+		makeRow(r, op.Begin_Row());
+		op.End_Row();
+	}
+}
+
+static int Bottom_Row(const RunRegion &region)
+{
+	return region.Top() + region.Rows() - 1;
+}
+
+void Union_Region(const RunRegion &a, const RunRegion &b, RunRegion &op)
+{
+	int top = std::min(a.Empty() ? b.Top() : a.Top(), b.Empty() ? a.Top() : b.Top());
+	int bottom = std::max(a.Empty() ? -1 : Bottom_Row(a), b.Empty() ? -1 : Bottom_Row(b));
+	Build_Rows(op, a.Width(), a.Height(), top, bottom, [&](int r, std::vector<Run> &out)
+	{
+		const Run *aRuns, *bRuns;
+		int aCount = a.Row(r, aRuns);
+		int bCount = b.Row(r, bRuns);
+		Union_Runs(aRuns, aCount, bRuns, bCount, out);
+	});
+}
+
+void Subtract_Region(const RunRegion &a, const RunRegion &b, RunRegion &op)
+{
+	Build_Rows(op, a.Width(), a.Height(), a.Top(), Bottom_Row(a), [&](int r, std::vector<Run> &out)
+	{
+		const Run *aRuns, *bRuns;
+		int aCount = a.Row(r, aRuns);
+		int bCount = b.Row(r, bRuns);
+		Subtract_Runs(aRuns, aCount, bRuns, bCount, out);
+	});
+}
+
+void Clip_Region(const RunRegion &ip, const cv::Rect &area, RunRegion &op)
+{
+	if (area.empty())
+	{
+		op.Create(ip.Width(), ip.Height(), 0);
+		return;
+	}
+	const Run column = { area.x, area.x + area.width - 1 };
+	Build_Rows(op, ip.Width(), ip.Height(), std::max(ip.Top(), area.y), std::min(Bottom_Row(ip), area.y + area.height - 1), [&](int r, std::vector<Run> &out)
+	{
+		const Run *runs;
+		int count = ip.Row(r, runs);
+		Intersect_Runs(runs, count, &column, 1, out);
+	});
+}
+
+void Cut_Region(const RunRegion &ip, const cv::Rect &area, RunRegion &op)
+{
+	const Run column = { area.x, area.x + area.width - 1 };
+	Build_Rows(op, ip.Width(), ip.Height(), ip.Top(), Bottom_Row(ip), [&](int r, std::vector<Run> &out)
+	{
+		const Run *runs;
+		int count = ip.Row(r, runs);
+		if (area.empty() || (r < area.y) || (r >= area.y + area.height))
+			out.insert(out.end(), runs, runs + count);
+		else
+			Subtract_Runs(runs, count, &column, 1, out);
+	});
+}
+
+cv::Rect Interior_Area(int width, int height, int kernelWidth, int kernelHeight)
+{
+	if ((kernelWidth < 1) || (kernelHeight < 1) || (width < kernelWidth) || (height < kernelHeight))
+		return cv::Rect();
+	return cv::Rect(kernelWidth / 2, kernelHeight / 2, width - kernelWidth + 1, height - kernelHeight + 1);
+}
+
+//op row r = rows r .. r + length - 1 of ip intersected (or merged), the window is built by doubling.
+//The steps ping-pong between op and window, swapping regions only swaps their buffers
+template <bool IS_UNION>
+static void Reduce_Rows(const RunRegion &ip, RunRegion &op, RunRegion &window, int length)
+{
+	const RunRegion *src = &ip;
+	int covered = 1;
+	while (covered < length)
+	{
+		//the last step only adds what is missing, overlapping rows already covered
+		const int shift = std::min(covered, length - covered);
+		//a merged row exists if either row does, an intersected one only if both do
+		const RunRegion &step = *src;
+		int top = IS_UNION ? step.Top() - shift : step.Top();
+		int bottom = IS_UNION ? Bottom_Row(step) : Bottom_Row(step) - shift;
+		Build_Rows(op, step.Width(), step.Height(), top, bottom, [&](int r, std::vector<Run> &out)
+		{
+			const Run *a, *b;
+			int aCount = step.Row(r, a);
+			int bCount = step.Row(r + shift, b);
+			if (IS_UNION)
+				Union_Runs(a, aCount, b, bCount, out);
+			else
+				Intersect_Runs(a, aCount, b, bCount, out);
+		});
+		std::swap(window, op);
+		src = &window;
+		covered += shift;
+	}
+	if (src == &ip)
+		op = ip;
+	else
+		std::swap(window, op);
+}
+
+size_t RunScratch::Bytes() const
+{
+	return rows.Bytes() + columns.Bytes() + window.Bytes() + eroded.Bytes();
+}
+
+void Erode_Rect(const RunRegion &ipImage, RunRegion &opImage, int kernelWidth, int kernelHeight, RunScratch &scratch)
+{
+	cv::Rect interior = Interior_Area(ipImage.Width(), ipImage.Height(), kernelWidth, kernelHeight);
+	if (interior.empty() || ipImage.Empty())
+	{
+		opImage.Create(ipImage.Width(), ipImage.Height(), 0);
+		return;
+	}
+
+	//row pass, pixel j is kept when j - anchor .. j - anchor + kernelWidth - 1 are all inside one run
+	const int anchorX = kernelWidth / 2;
+	RunRegion &rows = scratch.rows;
+	Build_Rows(rows, ipImage.Width(), ipImage.Height(), ipImage.Top(), Bottom_Row(ipImage), [&](int r, std::vector<Run> &out)
+	{
+		const Run *runs;
+		int count = ipImage.Row(r, runs);
+		for (int k = 0; k < count; ++k)
+			if (runs[k].last - runs[k].first + 1 >= kernelWidth)
+			{
+				Run run = { runs[k].first + anchorX, runs[k].last - kernelWidth + 1 + anchorX };
+				out.push_back(run);
+			}
+	});
+
+	//column pass, then the window is moved from its top row to the anchor
+	RunRegion &columns = scratch.columns;
+	Reduce_Rows<false>(rows, columns, scratch.window, kernelHeight);
+	columns.Offset_Rows(kernelHeight / 2);
+	Clip_Region(columns, interior, opImage);
+}
+
+void Dilate_Rect(const RunRegion &ipImage, RunRegion &opImage, int kernelWidth, int kernelHeight, RunScratch &scratch)
+{
+	cv::Rect interior = Interior_Area(ipImage.Width(), ipImage.Height(), kernelWidth, kernelHeight);
+	if (interior.empty() || ipImage.Empty())
+	{
+		opImage.Create(ipImage.Width(), ipImage.Height(), 0);
+		return;
+	}
+
+	//row pass, pixel j is set when j - anchor .. j - anchor + kernelWidth - 1 meets a run
+	const int anchorX = kernelWidth / 2;
+	RunRegion &rows = scratch.rows;
+	Build_Rows(rows, ipImage.Width(), ipImage.Height(), ipImage.Top(), Bottom_Row(ipImage), [&](int r, std::vector<Run> &out)
+	{
+		const Run *runs;
+		int count = ipImage.Row(r, runs);
+		size_t rowStart = out.size();
+		for (int k = 0; k < count; ++k)
+			Append_Run(out, rowStart, runs[k].first - kernelWidth + 1 + anchorX, runs[k].last + anchorX);
+	});
+
+	RunRegion &columns = scratch.columns;
+	Reduce_Rows<true>(rows, columns, scratch.window, kernelHeight);
+	columns.Offset_Rows(kernelHeight / 2);
+	Clip_Region(columns, interior, opImage);
+}
+
+void Boundary_Rect(const RunRegion &region, RunRegion &perimeter, int kernelWidth, int kernelHeight, RunScratch &scratch)
+{
+	Erode_Rect(region, scratch.eroded, kernelWidth, kernelHeight, scratch);
+	Subtract_Region(region, scratch.eroded, perimeter);
+}
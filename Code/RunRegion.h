@@ -0,0 +1,114 @@
+#ifndef RUN_REGION_H
+#define RUN_REGION_H
+
+#include <stdint.h>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "BinaryMask.h"
+
+//columns first..last (inclusive) of one row
+struct Run
+{
+	int first;
+	int last;
+};
+
+//a run as the scanline fill finds it, before runs are sorted into rows
+struct RowRun
+{
+	int row;
+	int first;
+	int last;
+};
+
+//Region held as the runs of each row, sorted by column, never overlapping or touching.
+//Only the rows from Top() to the last one added are stored, so the size depends on the region's
+//outline rather than on its pixel count or the image size.
+class RunRegion
+{
+private:
+	int m_width = 0;
+	int m_height = 0;
+	int m_top = 0;
+	//runs of row m_top + i are m_runs[m_rowStarts[i]] up to m_runs[m_rowStarts[i + 1]]
+	std::vector<int> m_rowStarts;
+	std::vector<Run> m_runs;
+
+public:
+	RunRegion();
+
+	//empty region of a width x height image, rows are then added from top down
+	void Create(int width, int height, int top = 0);
+	void Clear();
+
+	int Width() const;
+	int Height() const;
+	int Top() const;
+	//rows held, from Top() on, some of them may be empty
+	int Rows() const;
+	int Run_Count() const;
+	bool Empty() const;
+
+	//runs of a row, 0 for rows that are not held
+	int Row(int row, const Run *&runs) const;
+	//adds the next row below the last one held, runs sorted and not touching
+	void Add_Row(const Run *runs, int count);
+	void Add_Row(const std::vector<Run> &runs);
+	//or appends them in place: runs pushed onto Begin_Row() become the next row with End_Row()
+	std::vector<Run>& Begin_Row();
+	void End_Row();
+	//moves every row down by rows (up if negative)
+	void Offset_Rows(int rows);
+
+	//builds the region from fill runs in any order, runs of one row must not overlap
+	void From_Runs(int width, int height, std::vector<RowRun> &runs);
+	//runs of the set pixels of mask inside area
+	void From_Mask(const BinaryMask &mask, const cv::Rect &area);
+	//sets the region's pixels in a mask of the same size, nothing else is touched
+	void To_Mask(BinaryMask &mask) const;
+
+	//number of pixels
+	size_t Area() const;
+	//smallest rectangle holding every pixel, empty for an empty region
+	cv::Rect Bounding_Box() const;
+	//bytes held by the runs
+	size_t Bytes() const;
+};
+
+//Operations on the runs of one row, the result is appended to out
+void Union_Runs(const Run *a, int aCount, const Run *b, int bCount, std::vector<Run> &out);
+void Intersect_Runs(const Run *a, int aCount, const Run *b, int bCount, std::vector<Run> &out);
+void Subtract_Runs(const Run *a, int aCount, const Run *b, int bCount, std::vector<Run> &out);
+
+//The same on whole regions of one image size. op must not be either input
+void Union_Region(const RunRegion &a, const RunRegion &b, RunRegion &op);
+void Subtract_Region(const RunRegion &a, const RunRegion &b, RunRegion &op);
+//pixels of ip inside area, and outside it
+void Clip_Region(const RunRegion &ip, const cv::Rect &area, RunRegion &op);
+void Cut_Region(const RunRegion &ip, const cv::Rect &area, RunRegion &op);
+
+//pixels whose whole kernelWidth x kernelHeight window (anchored at the kernel centre) is inside the image
+cv::Rect Interior_Area(int width, int height, int kernelWidth, int kernelHeight);
+
+//Regions the morphology below works in. The caller keeps one and passes it to every call, so after the first
+//calls the runs reuse what the scratch regions already hold instead of being allocated again
+struct RunScratch
+{
+	RunRegion rows;
+	RunRegion columns;
+	RunRegion window;
+	RunRegion eroded;
+
+	size_t Bytes() const;
+};
+
+//Erosion and dilation with the same rectangle and anchor as the mask versions in Morphology.h.
+//Each run is shrunk or grown along its row, then kernelHeight rows are intersected or merged,
+//by doubling so tall kernels cost log(kernelHeight) passes. Pixels outside Interior_Area come out clear,
+//where the mask versions leave them as they were.
+void Erode_Rect(const RunRegion &ipImage, RunRegion &opImage, int kernelWidth, int kernelHeight, RunScratch &scratch);
+void Dilate_Rect(const RunRegion &ipImage, RunRegion &opImage, int kernelWidth, int kernelHeight, RunScratch &scratch);
+//region minus its erosion, pixels outside Interior_Area stay on the perimeter as in the mask Boundary_Rect
+void Boundary_Rect(const RunRegion &region, RunRegion &perimeter, int kernelWidth, int kernelHeight, RunScratch &scratch);
+
+#endif
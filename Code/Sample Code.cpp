@@ -3,6 +3,17 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <sstream>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <cctype>
+#include <algorithm>
 #include "ImageAnalysisService.h"
 using namespace cv;
 using namespace std;
@@ -12,8 +23,8 @@ std::string consoleOutput;
 
 unsigned int splitstring(const std::string &txt, std::vector<std::string> &strs, char ch)
 {
-	unsigned int pos = txt.find(ch);
-	unsigned int initialPos = 0;
+	size_t pos = txt.find(ch);
+	size_t initialPos = 0;
 	strs.clear();
 
 	// Decompose statement
@@ -46,24 +57,68 @@ void DisplayCommands()
 {
 	string command = "To load the image \n"
 		"> INPUT_IMAGE_PATH *space* filename\n"
+		"To save the loaded image as a raw .iasraw file, which INPUT_IMAGE_PATH streams instead of loading whole\n"
+		"> SAVE_RAW_IMAGE *space* filename\n"
+		"To keep a raw copy of loaded images and map it on later loads instead of decoding again\n"
+		"> RAW_CACHE *space* on *OR* off\n"
+		"To set how many megabytes of a streamed image stay loaded (default 256)\n"
+		"> SET_MEMORY_BUDGET *space* megabytes\n"
 		"To Find region\n"
-		"> FIND_REGION *space* seedx *space* seedy *space* tolerence\n"
+		"> FIND_REGION *space* seedx *space* seedy *space* tolerence [*space* scanline *OR* forrest *OR* parallel]\n"
+		"To find the regions of several seeds at once\n"
+		"> FIND_REGIONS *space* tolerence *space* seedx1 *space* seedy1 [*space* seedx2 *space* seedy2 ...]\n"
+		"To find the region areas of one seed for several tolerances\n"
+		"> SWEEP_TOLERANCE *space* seedx *space* seedy *space* tolerence1 [*space* tolerence2 ...]\n"
+		"To precompute the flood levels of a seed so later FIND_REGION calls for it are fast\n"
+		"> BUILD_LEVEL_MAP *space* seedx *space* seedy\n"
+		"To set the opening/closing kernel size (default 3 3)\n"
+		"> SET_KERNEL_SIZE *space* width *space* height\n"
+		"To set the smoothing filter size (odd, default 3) and optionally its sigma\n"
+		"> SET_SMOOTHING_KERNEL *space* size [*space* sigma]\n"
+		"To set the number of worker threads (0 uses one per core)\n"
+		"> SET_THREAD_COUNT *space* count\n"
+		"To keep regions as bit masks (default) or as runs of each row\n"
+		"> SET_REGION_FORMAT mask *OR* runs\n"
+		"To set the region cache size in megabytes (0 turns it off)\n"
+		"> SET_CACHE_LIMIT *space* megabytes\n"
+		"To show region cache hits and misses\n"
+		"> CACHE_STATS\n"
+		"To show the area, bounds, centroid, mean colour and perimeter length of the region\n"
+		"> REGION_STATS\n"
+		"To show the time, pixels and memory of each stage since the start or the last reset\n"
+		"> STATS [*space* reset]\n"
+		"To record every stage from now on for chrome://tracing or Perfetto\n"
+		"> START_TRACE\n"
+		"To stop recording and save the trace as json\n"
+		"> SAVE_TRACE *space* filename\n"
 		"To find perimeter\n"
 		"> FIND_PERIMETER\n"
 		"To make perimeter smooth\n"
 		"> FIND_SMOOTH_PERIMETER\n"
+		"To trace the region borders as polygons\n"
+		"> FIND_CONTOURS\n"
+		"To smooth the polygons by averaging, corner cutting passes (at most 8) or simplification within a distance\n"
+		"> SMOOTH_CONTOURS avg *OR* chaikin *OR* dp *space* amount\n"
+		"To save the polygons as svg (by extension) or text\n"
+		"> SAVE_CONTOURS filename\n"
 		"To show input image\n"
 		"> DISPLAY_IMAGE\n"
 		"To show output image\n"
 		"> DISPLAY_PIXELS region *OR* perimeter\n"
 		"To save output\n"
 		"> SAVE_PIXELS region *OR* perimeter *space* filename\n"
+		"followed by any of: a format (image, png1, tiff1 or rle), a compression level and background\n"
+		"> SAVE_PIXELS region *space* filename *space* png1 *space* 9 *space* background\n"
+		"To wait for background saves\n"
+		"> FLUSH_SAVES\n"
 		"To save program output\n"
 		"> SAVE_PROGRAM_OUTPUT filename\n"
 		"To exit application\n"
 		"> EXIT\n"
 		"To get list of availabe commands\n"
-		"> HELP\n";
+		"> HELP\n"
+		"To process a manifest of images without the console, start the program with\n"
+		"> --batch *space* manifest [*space* output directory]\n";
 	DisplayStatus(command);
 }
 
@@ -75,8 +130,345 @@ void SaveProgramOutput(std::string path)
 	DisplayStatus("Program output saved");
 }
 
-int main()
+//fixed capacity queue between two pipeline stages. Push waits while it is full and Pop while it is empty,
+//Pop returns false once the queue is closed and nothing is left in it
+template <typename T>
+class BoundedQueue
 {
+private:
+	std::deque<T> m_items;
+	size_t m_capacity;
+	bool m_isClosed = false;
+	std::mutex m_mutex;
+	std::condition_variable m_notFull;
+	std::condition_variable m_notEmpty;
+
+public:
+	explicit BoundedQueue(size_t capacity) : m_capacity(capacity)
+	{
+	}
+
+	void Push(T item)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_notFull.wait(lock, [this] { return m_items.size() < m_capacity; });
+		m_items.push_back(std::move(item));
+		m_notEmpty.notify_one();
+	}
+
+	bool Pop(T &item)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_notEmpty.wait(lock, [this] { return m_isClosed || !m_items.empty(); });
+		if (m_items.empty())
+			return false;
+		item = std::move(m_items.front());
+		m_items.pop_front();
+		m_notFull.notify_one();
+		return true;
+	}
+
+	void Close()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_isClosed = true;
+		m_notEmpty.notify_all();
+	}
+};
+
+//one line of a batch manifest
+struct BatchJob
+{
+	int line;
+	std::string image;
+	int tolerance;
+	bool saveRegion = false;
+	bool savePerimeter = false;
+	bool saveSmooth = false;
+	std::vector<RegionSeed> seeds;
+};
+
+//one seed of a job on its way through the pipeline
+struct BatchItem
+{
+	const BatchJob *job;
+	int seed;
+	std::unique_ptr<ImageAnalysisService> service;
+	Status status;
+	std::string failedStage;
+	std::vector<std::pair<std::string, cv::Mat>> outputs;
+};
+
+std::string StatusText(Status status)
+{
+	switch (status)
+	{
+	case Status::SUCCESS:
+		return "done";
+	case Status::INVALID_IMAGE:
+		return "invalid image path/file";
+	case Status::SEED_POINT_OUT_OF_RANGE:
+		return "seed point out of image bounds";
+	case Status::CANCELLED:
+		return "cancelled";
+	case Status::AMOUNT_OUT_OF_RANGE:
+		return "amount out of range";
+	case Status::OVER_MEMORY_BUDGET:
+		return "memory budget too small";
+	default:
+		return "failed";
+	}
+}
+
+//manifest lines are: image tolerence outputs seedx1 seedy1 [seedx2 seedy2 ...]
+//where outputs is a comma separated list of region, perimeter and smooth. # starts a comment line.
+//Unknown output names and unpaired coordinates are reported as manifest errors
+bool ReadManifest(const std::string &path, std::vector<BatchJob> &jobs)
+{
+	std::ifstream manifest(path);
+	if (!manifest)
+	{
+		DisplayStatus("Could not open manifest " + path);
+		return false;
+	}
+
+	std::string line;
+	int lineNumber = 0;
+	while (std::getline(manifest, line))
+	{
+		++lineNumber;
+		std::istringstream fields(line);
+		BatchJob job;
+		std::string outputs;
+		if (!(fields >> job.image) || (job.image[0] == '#'))
+			continue;
+		if (!(fields >> job.tolerance >> outputs))
+		{
+			DisplayStatus("Manifest line " + std::to_string(lineNumber) + ": expected image tolerence outputs seeds");
+			return false;
+		}
+
+		job.line = lineNumber;
+		std::istringstream names(outputs);
+		std::string name;
+		while (std::getline(names, name, ','))
+		{
+			if (name == "region")
+				job.saveRegion = true;
+			else if (name == "perimeter")
+				job.savePerimeter = true;
+			else if (name == "smooth")
+				job.saveSmooth = true;
+			else
+			{
+				DisplayStatus("Manifest line " + std::to_string(lineNumber) + ": unknown output '" + name + "', expected region, perimeter or smooth");
+				return false;
+			}
+		}
+
+		std::vector<int> coordinates;
+		int coordinate;
+		while (fields >> coordinate)
+			coordinates.push_back(coordinate);
+		if (!fields.eof() || ((coordinates.size() % 2) != 0))
+		{
+			DisplayStatus("Manifest line " + std::to_string(lineNumber) + ": seeds have to be pairs of whole numbers");
+			return false;
+		}
+
+		RegionSeed seed;
+		seed.tolerance = job.tolerance;
+		for (size_t i = 0; i < coordinates.size(); i += 2)
+		{
+			seed.x = coordinates[i];
+			seed.y = coordinates[i + 1];
+			job.seeds.push_back(seed);
+		}
+		if (job.seeds.empty())
+		{
+			DisplayStatus("Manifest line " + std::to_string(lineNumber) + ": expected at least one seed");
+			return false;
+		}
+		jobs.push_back(job);
+	}
+	return true;
+}
+
+//starts count threads running work, output is closed once the last of them is done
+template <typename T>
+void StartStage(std::vector<std::thread> &threads, int count, BoundedQueue<T> &output, const std::function<void()> &work)
+{
+	std::shared_ptr<std::atomic<int>> remaining = std::make_shared<std::atomic<int>>(count);
+	for (int i = 0; i < count; ++i)
+		threads.push_back(std::thread([remaining, &output, work]
+		{
+			work();
+			if (--*remaining == 0)
+				output.Close();
+		}));
+}
+
+//Runs every seed of every manifest line through decode -> region -> perimeter/smoothing -> PNG encoding.
+//Each stage has its own threads and the stages are joined by bounded queues, so decoding and encoding
+//overlap with the analysis, throughput is set by the slowest stage and only a few images are in flight.
+//An image is decoded once per line, its seeds get services sharing it.
+int RunBatch(const std::string &manifestPath, const std::string &outputDirectory)
+{
+	std::vector<BatchJob> jobs;
+	if (!ReadManifest(manifestPath, jobs))
+		return 1;
+
+	auto start = std::chrono::steady_clock::now();
+	const size_t QUEUE_CAPACITY = 16;
+	BoundedQueue<const BatchJob*> jobQueue(QUEUE_CAPACITY);
+	BoundedQueue<BatchItem> decoded(QUEUE_CAPACITY);
+	BoundedQueue<BatchItem> grown(QUEUE_CAPACITY);
+	BoundedQueue<BatchItem> analysed(QUEUE_CAPACITY);
+	BoundedQueue<BatchItem> finished(QUEUE_CAPACITY);
+
+	//the images themselves run on one thread each, the parallelism comes from the pipeline
+	int cores = std::max(1, (int)std::thread::hardware_concurrency());
+	std::vector<std::thread> threads;
+
+	StartStage(threads, 2, decoded, [&]
+	{
+		const BatchJob *job;
+		while (jobQueue.Pop(job))
+		{
+			ImageAnalysisService source;
+			std::string path = job->image;
+			Status status = source.INITIALIZE(path);
+			for (int i = 0; i < (int)job->seeds.size(); ++i)
+			{
+				BatchItem item;
+				item.job = job;
+				item.seed = i;
+				item.status = status;
+				item.failedStage = "decode";
+				if (status == Status::SUCCESS)
+				{
+					item.service.reset(new ImageAnalysisService());
+					item.service->SET_THREAD_COUNT(1);
+					item.status = item.service->SHARE_IMAGE(source);
+				}
+				decoded.Push(std::move(item));
+			}
+		}
+	});
+
+	StartStage(threads, std::max(1, cores / 2), grown, [&]
+	{
+		BatchItem item;
+		while (decoded.Pop(item))
+		{
+			if (item.status == Status::SUCCESS)
+			{
+				const RegionSeed &seed = item.job->seeds[item.seed];
+				item.failedStage = "region";
+				item.status = item.service->FIND_REGION(seed.x, seed.y, seed.tolerance);
+				if ((item.status == Status::SUCCESS) && item.job->saveRegion)
+				{
+					item.outputs.push_back(std::make_pair(std::string("region"), cv::Mat()));
+					item.status = item.service->GET_PIXELS(OutputImageType::REGION, item.outputs.back().second);
+				}
+			}
+			grown.Push(std::move(item));
+		}
+	});
+
+	StartStage(threads, std::max(1, cores / 2), analysed, [&]
+	{
+		BatchItem item;
+		while (grown.Pop(item))
+		{
+			if ((item.status == Status::SUCCESS) && (item.job->savePerimeter || item.job->saveSmooth))
+			{
+				item.failedStage = "perimeter";
+				item.status = item.service->FIND_PERIMETER();
+				if ((item.status == Status::SUCCESS) && item.job->savePerimeter)
+				{
+					item.outputs.push_back(std::make_pair(std::string("perimeter"), cv::Mat()));
+					item.status = item.service->GET_PIXELS(OutputImageType::PERIMETER, item.outputs.back().second);
+				}
+				if ((item.status == Status::SUCCESS) && item.job->saveSmooth)
+				{
+					item.outputs.push_back(std::make_pair(std::string("smooth"), cv::Mat()));
+					item.status = item.service->FIND_SMOOTH_PERIMETER();
+					if (item.status == Status::SUCCESS)
+						item.status = item.service->GET_PIXELS(OutputImageType::PERIMETER, item.outputs.back().second);
+				}
+			}
+			//the masks are not needed any more, only the output images go on to be encoded
+			item.service.reset();
+			analysed.Push(std::move(item));
+		}
+	});
+
+	StartStage(threads, 2, finished, [&]
+	{
+		BatchItem item;
+		while (analysed.Pop(item))
+		{
+			if (item.status == Status::SUCCESS)
+			{
+				//name_line_seed_output.png, the line keeps names apart when an image is listed twice
+				std::string name = item.job->image.substr(item.job->image.find_last_of("/\\") + 1);
+				name = name.substr(0, name.find_last_of('.'));
+				for (size_t i = 0; i < item.outputs.size(); ++i)
+				{
+					std::string path = outputDirectory + "/" + name + "_" + std::to_string(item.job->line) + "_"
+						+ std::to_string(item.seed + 1) + "_" + item.outputs[i].first + ".png";
+					item.failedStage = "encode";
+					if (!imwrite(path, item.outputs[i].second))
+						item.status = Status::FAILURE;
+				}
+			}
+			item.outputs.clear();
+			finished.Push(std::move(item));
+		}
+	});
+
+	//the main thread feeds the jobs in and reports the results as they come out
+	std::thread feeder([&]
+	{
+		for (size_t i = 0; i < jobs.size(); ++i)
+			jobQueue.Push(&jobs[i]);
+		jobQueue.Close();
+	});
+
+	int seeds = 0, failures = 0;
+	BatchItem item;
+	while (finished.Pop(item))
+	{
+		++seeds;
+		const RegionSeed &seed = item.job->seeds[item.seed];
+		std::string text = item.job->image + " seed " + std::to_string(seed.x) + " " + std::to_string(seed.y) + ": ";
+		if (item.status == Status::SUCCESS)
+			DisplayStatus(text + StatusText(item.status));
+		else
+		{
+			++failures;
+			DisplayStatus(text + item.failedStage + " " + StatusText(item.status));
+		}
+	}
+
+	feeder.join();
+	for (size_t i = 0; i < threads.size(); ++i)
+		threads[i].join();
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	DisplayStatus("Batch completed: " + std::to_string(jobs.size()) + " images, " + std::to_string(seeds) + " seeds, "
+		+ std::to_string(failures) + " failed in " + std::to_string(seconds) + " s ("
+		+ std::to_string(seconds > 0 ? jobs.size() / seconds : 0.0) + " images/s)");
+	return (failures == 0) ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+	//batch mode runs a manifest through the pipeline instead of reading commands
+	if ((argc >= 3) && (std::string(argv[1]) == "--batch"))
+		return RunBatch(argv[2], (argc >= 4) ? argv[3] : ".");
+
 	//below code provides the command line functionality
 	ImageAnalysisService service;
 	DisplayCommands();
@@ -99,7 +491,7 @@ int main()
 			continue;
 		}
 
-		args[0].erase(remove_if(args[0].begin(), args[0].end(), isspace), args[0].end());
+		args[0].erase(remove_if(args[0].begin(), args[0].end(), ::isspace), args[0].end());
 
 
 		if (args[0] == "INPUT_IMAGE_PATH")
@@ -121,11 +513,92 @@ int main()
 				DisplayStatus("Invalid Image path/file.");
 				continue;
 			}
+			else if (returnval == Status::OVER_MEMORY_BUDGET)
+			{
+				DisplayStatus("The memory budget is too small for one strip of this image.");
+				continue;
+			}
+			else if (service.IsRawCacheMissed())
+			{
+				DisplayStatus("Image loaded sucessfully, but its raw cache could not be used and it was decoded.");
+			}
 			else
 			{
 				DisplayStatus("Image loaded sucessfully.");
 			}
 		}
+		else if (args[0] == "SAVE_RAW_IMAGE")
+		{
+			if (count < 2)
+			{
+				DisplayStatus("Please enter valid command");
+				continue;
+			}
+			if (!service.IsIntitialized())
+			{
+				DisplayStatus("Please load input image first");
+				continue;
+			}
+
+			returnval = service.SAVE_RAW_IMAGE(args[1]);
+			if (returnval == Status::FAILURE)
+			{
+				DisplayStatus("Could not save the raw image. Streamed images can not be saved again.");
+				continue;
+			}
+			else
+			{
+				DisplayStatus("Raw image saved.");
+			}
+		}
+		else if (args[0] == "RAW_CACHE")
+		{
+			if (count < 2)
+			{
+				DisplayStatus("Please enter valid command");
+				continue;
+			}
+
+			args[1].erase(remove_if(args[1].begin(), args[1].end(), ::isspace), args[1].end());
+			if ((args[1] != "on") && (args[1] != "off"))
+			{
+				DisplayStatus("Enter on or off");
+				continue;
+			}
+
+			returnval = service.SET_RAW_CACHE(args[1] == "on");
+			DisplayStatus("Raw cache turned " + args[1] + ".");
+		}
+		else if (args[0] == "SET_MEMORY_BUDGET")
+		{
+			if (count < 2)
+			{
+				DisplayStatus("Please enter valid command");
+				continue;
+			}
+			int megabytes = std::stoi(args[1]);
+			if (megabytes < 0)
+			{
+				DisplayStatus("Please enter a memory budget of 0 or more");
+				continue;
+			}
+
+			returnval = service.SET_MEMORY_BUDGET((size_t)megabytes * 1024 * 1024);
+			if (returnval == Status::FAILURE)
+			{
+				DisplayStatus("Something went wrong. Please see the error message above.");
+				continue;
+			}
+			else if (returnval == Status::OVER_MEMORY_BUDGET)
+			{
+				DisplayStatus("The memory budget is too small for the regions this image's services hold now.");
+				continue;
+			}
+			else
+			{
+				DisplayStatus("Memory budget set.");
+			}
+		}
 		else if (args[0] == "FIND_REGION")
 		{
 			if (count < 4)
@@ -142,7 +615,27 @@ int main()
 			int seedy = std::stoi(args[2]);
 			int tolerence = std::stoi(args[3]);
 
-			returnval = service.FIND_REGION(seedx, seedy, tolerence);
+			//scanline is the default, forrest keeps the original per pixel fill
+			FillMode mode = FillMode::SCANLINE;
+			if (count >= 5)
+			{
+				args[4].erase(remove_if(args[4].begin(), args[4].end(), ::isspace), args[4].end());
+				if (args[4] == "forrest")
+				{
+					mode = FillMode::FORREST_FIRE;
+				}
+				else if (args[4] == "parallel")
+				{
+					mode = FillMode::PARALLEL;
+				}
+				else if (args[4] != "scanline")
+				{
+					DisplayStatus("Enter valid fill mode");
+					continue;
+				}
+			}
+
+			returnval = service.FIND_REGION(seedx, seedy, tolerence, mode);
 			if (returnval == Status::FAILURE)
 			{
 				DisplayStatus("Something went wrong. Please see the error message above.");
@@ -153,11 +646,353 @@ int main()
 				DisplayStatus("Please enter seed point within image bounds");
 				continue;
 			}
+			else if (returnval == Status::OVER_MEMORY_BUDGET)
+			{
+				DisplayStatus("The memory budget of this image has no room for this command.");
+				continue;
+			}
 			else
 			{
 				DisplayStatus("Region found completed.");
 			}
 		}
+		else if (args[0] == "FIND_REGIONS")
+		{
+			if ((count < 4) || ((count % 2) != 0))
+			{
+				DisplayStatus("Please enter valid command");
+				continue;
+			}
+			if (!service.IsIntitialized())
+			{
+				DisplayStatus("Please load input image first");
+				continue;
+			}
+			int tolerence = std::stoi(args[1]);
+
+			std::vector<RegionSeed> seeds;
+			for (int i = 2; i + 1 < count; i += 2)
+			{
+				RegionSeed seed;
+				seed.x = std::stoi(args[i]);
+				seed.y = std::stoi(args[i + 1]);
+				seed.tolerance = tolerence;
+				seeds.push_back(seed);
+			}
+
+			cv::Mat labels;
+			std::vector<RegionCrop> regions;
+			returnval = service.FIND_REGIONS(seeds, labels, &regions);
+			if (returnval == Status::FAILURE)
+			{
+				DisplayStatus("Something went wrong. Please see the error message above.");
+				continue;
+			}
+			else if (returnval == Status::OVER_MEMORY_BUDGET)
+			{
+				DisplayStatus("The memory budget of this image has no room for this command.");
+				continue;
+			}
+			else if (returnval == Status::SEED_POINT_OUT_OF_RANGE)
+			{
+				DisplayStatus("Please enter seed points within image bounds");
+				continue;
+			}
+			else
+			{
+				for (size_t i = 0; i < regions.size(); ++i)
+					DisplayStatus("Region " + std::to_string(i + 1) + " area: " + std::to_string(regions[i].mask.empty() ? 0 : cv::countNonZero(regions[i].mask)) + " pixels");
+				DisplayStatus("Regions found completed.");
+			}
+		}
+		else if (args[0] == "SWEEP_TOLERANCE")
+		{
+			if (count < 4)
+			{
+				DisplayStatus("Please enter valid command");
+				continue;
+			}
+			if (!service.IsIntitialized())
+			{
+				DisplayStatus("Please load input image first");
+				continue;
+			}
+			int seedx = std::stoi(args[1]);
+			int seedy = std::stoi(args[2]);
+
+			std::vector<int> tolerences;
+			for (int i = 3; i < count; ++i)
+				tolerences.push_back(std::stoi(args[i]));
+
+			std::vector<int> areas;
+			returnval = service.SWEEP_TOLERANCE(seedx, seedy, tolerences, areas);
+			if (returnval == Status::FAILURE)
+			{
+				DisplayStatus("Something went wrong. Please see the error message above.");
+				continue;
+			}
+			else if (returnval == Status::OVER_MEMORY_BUDGET)
+			{
+				DisplayStatus("The memory budget of this image has no room for this command.");
+				continue;
+			}
+			else if (returnval == Status::SEED_POINT_OUT_OF_RANGE)
+			{
+				DisplayStatus("Please enter seed point within image bounds");
+				continue;
+			}
+			else
+			{
+				for (size_t i = 0; i < areas.size(); ++i)
+					DisplayStatus("Tolerence " + std::to_string(tolerences[i]) + " area: " + std::to_string(areas[i]) + " pixels");
+				DisplayStatus("Tolerence sweep completed.");
+			}
+		}
+		else if (args[0] == "BUILD_LEVEL_MAP")
+		{
+			if (count < 3)
+			{
+				DisplayStatus("Please enter valid command");
+				continue;
+			}
+			if (!service.IsIntitialized())
+			{
+				DisplayStatus("Please load input image first");
+				continue;
+			}
+			int seedx = std::stoi(args[1]);
+			int seedy = std::stoi(args[2]);
+
+			returnval = service.BUILD_LEVEL_MAP(seedx, seedy);
+			if (returnval == Status::FAILURE)
+			{
+				DisplayStatus("Something went wrong. Please see the error message above.");
+				continue;
+			}
+			else if (returnval == Status::OVER_MEMORY_BUDGET)
+			{
+				DisplayStatus("The memory budget of this image has no room for this command.");
+				continue;
+			}
+			else if (returnval == Status::SEED_POINT_OUT_OF_RANGE)
+			{
+				DisplayStatus("Please enter seed point within image bounds");
+				continue;
+			}
+			else
+			{
+				DisplayStatus("Level map built.");
+			}
+		}
+		else if (args[0] == "SET_KERNEL_SIZE")
+		{
+			if (count < 3)
+			{
+				DisplayStatus("Please enter valid command");
+				continue;
+			}
+			int kernelWidth = std::stoi(args[1]);
+			int kernelHeight = std::stoi(args[2]);
+
+			returnval = service.SET_KERNEL_SIZE(kernelWidth, kernelHeight);
+			if (returnval == Status::FAILURE)
+			{
+				DisplayStatus("Please enter kernel size of at least 1 x 1");
+				continue;
+			}
+			else
+			{
+				DisplayStatus("Kernel size set.");
+			}
+		}
+		else if (args[0] == "SET_SMOOTHING_KERNEL")
+		{
+			if (count < 2)
+			{
+				DisplayStatus("Please enter valid command");
+				continue;
+			}
+			int size = std::stoi(args[1]);
+			double sigma = (count > 2) ? std::stod(args[2]) : 0;
+
+			returnval = service.SET_SMOOTHING_KERNEL(size, sigma);
+			if (returnval == Status::FAILURE)
+			{
+				DisplayStatus("Please enter an odd size and a sigma of 0 to 100 (size up to 40001 with sigma 0)");
+				continue;
+			}
+			else
+			{
+				DisplayStatus("Smoothing kernel set.");
+			}
+		}
+		else if (args[0] == "SET_THREAD_COUNT")
+		{
+			if (count < 2)
+			{
+				DisplayStatus("Please enter valid command");
+				continue;
+			}
+			int threadCount = std::stoi(args[1]);
+
+			returnval = service.SET_THREAD_COUNT(threadCount);
+			if (returnval == Status::FAILURE)
+			{
+				DisplayStatus("Please enter a thread count of 0 or more");
+				continue;
+			}
+			else
+			{
+				DisplayStatus("Thread count set.");
+			}
+		}
+		else if (args[0] == "SET_REGION_FORMAT")
+		{
+			if (count < 2)
+			{
+				DisplayStatus("Please enter valid command");
+				continue;
+			}
+
+			args[1].erase(remove_if(args[1].begin(), args[1].end(), ::isspace), args[1].end());
+
+			RegionFormat format;
+			if (args[1] == "mask")
+			{
+				format = RegionFormat::PACKED_MASK;
+			}
+			else if (args[1] == "runs")
+			{
+				format = RegionFormat::RUN_LENGTH;
+			}
+			else
+			{
+				DisplayStatus("Enter valid format");
+				continue;
+			}
+
+			returnval = service.SET_REGION_FORMAT(format);
+			if (returnval == Status::FAILURE)
+			{
+				DisplayStatus("Something went wrong. Please see the error message above.");
+				continue;
+			}
+			else
+			{
+				DisplayStatus("Region format set.");
+			}
+		}
+		else if (args[0] == "SET_CACHE_LIMIT")
+		{
+			if (count < 2)
+			{
+				DisplayStatus("Please enter valid command");
+				continue;
+			}
+			int megabytes = std::stoi(args[1]);
+			if (megabytes < 0)
+			{
+				DisplayStatus("Please enter a cache size of 0 or more");
+				continue;
+			}
+
+			returnval = service.SET_CACHE_LIMIT((size_t)megabytes * 1024 * 1024);
+			if (returnval == Status::FAILURE)
+			{
+				DisplayStatus("Something went wrong. Please see the error message above.");
+				continue;
+			}
+			else
+			{
+				DisplayStatus("Cache size set.");
+			}
+		}
+		else if (args[0] == "CACHE_STATS")
+		{
+			CacheStats stats = service.GetCacheStats();
+			DisplayStatus("Cache hits: " + std::to_string(stats.hits) + ", misses: " + std::to_string(stats.misses)
+				+ ", regions: " + std::to_string(stats.entries) + ", bytes: " + std::to_string(stats.bytes)
+				+ " of " + std::to_string(stats.limit));
+		}
+		else if (args[0] == "REGION_STATS")
+		{
+			if (!service.IsRegionCalculated())
+			{
+				DisplayStatus("Please calculate region first");
+				continue;
+			}
+
+			RegionStats stats = service.GetRegionStats();
+			DisplayStatus("Area: " + std::to_string(stats.area) + ", bounds: " + std::to_string(stats.bounds.x) + " " + std::to_string(stats.bounds.y)
+				+ " " + std::to_string(stats.bounds.width) + " x " + std::to_string(stats.bounds.height)
+				+ ", centroid: " + std::to_string(stats.centroidX) + " " + std::to_string(stats.centroidY)
+				+ ", mean colour: " + std::to_string(stats.meanRed) + " " + std::to_string(stats.meanGreen) + " " + std::to_string(stats.meanBlue)
+				+ ", perimeter: " + (service.IsPerimeterCalculated() ? std::to_string(stats.perimeterLength) : std::string("not found yet")));
+		}
+		else if (args[0] == "STATS")
+		{
+			ServiceStats stats = service.GetServiceStats();
+			std::ostringstream text;
+			text.setf(std::ios::fixed);
+			text.precision(3);
+			for (int i = 0; i < STAGE_COUNT; ++i)
+			{
+				const StageCounters &stage = stats.stages[i];
+				if (stage.calls == 0)
+					continue;
+				double megapixelsPerSecond = (stage.totalMs > 0) ? stage.pixels / (stage.totalMs * 1000.0) : 0;
+				text << Stage_Name((Stage)i) << ": calls " << stage.calls << ", total " << stage.totalMs << " ms, last " << stage.lastMs
+					<< " ms, max " << stage.maxMs << " ms, pixels " << stage.pixels << " (" << megapixelsPerSecond << " MP/s), bytes allocated "
+					<< stage.bytesAllocated << "\n";
+			}
+			text << "Fill stack peak: " << stats.lastListPeak << " (largest " << stats.listPeak << "), cache hits: " << stats.cacheHits
+				<< ", misses: " << stats.cacheMisses << ", working bytes: " << stats.workingBytes;
+			DisplayStatus(text.str());
+
+			if (count >= 2)
+			{
+				args[1].erase(remove_if(args[1].begin(), args[1].end(), ::isspace), args[1].end());
+				if (args[1] == "reset")
+				{
+					service.RESET_STATS();
+					DisplayStatus("Stats reset.");
+				}
+			}
+		}
+		else if (args[0] == "START_TRACE")
+		{
+			returnval = service.START_TRACE();
+			if (returnval == Status::FAILURE)
+			{
+				DisplayStatus("Something went wrong. Please see the error message above.");
+				continue;
+			}
+			else
+			{
+				DisplayStatus("Trace started.");
+			}
+		}
+		else if (args[0] == "SAVE_TRACE")
+		{
+			if (count < 2)
+			{
+				DisplayStatus("Please enter valid command");
+				continue;
+			}
+
+			args[1].erase(remove_if(args[1].begin(), args[1].end(), ::isspace), args[1].end());
+
+			returnval = service.SAVE_TRACE(args[1]);
+			if (returnval == Status::FAILURE)
+			{
+				DisplayStatus("Please start a trace first, or check the file path.");
+				continue;
+			}
+			else
+			{
+				DisplayStatus("Trace saved.");
+			}
+		}
 		else if (args[0] == "FIND_PERIMETER")
 		{
 			if (!service.IsIntitialized())
@@ -177,6 +1012,11 @@ int main()
 				DisplayStatus("Something went wrong. Please see the error message above.");
 				continue;
 			}
+			else if (returnval == Status::OVER_MEMORY_BUDGET)
+			{
+				DisplayStatus("The memory budget of this image has no room for this command.");
+				continue;
+			}
 			else
 			{
 				DisplayStatus("Perimeter find completed");
@@ -205,11 +1045,117 @@ int main()
 				DisplayStatus("Something went wrong. Please see the error message above.");
 				continue;
 			}
+			else if (returnval == Status::OVER_MEMORY_BUDGET)
+			{
+				DisplayStatus("The memory budget of this image has no room for this command.");
+				continue;
+			}
 			else
 			{
 				DisplayStatus("Perimeter smoothening completed");
 			}
 		}
+		else if (args[0] == "FIND_CONTOURS")
+		{
+			if (!service.IsIntitialized())
+			{
+				DisplayStatus("Please load input image first");
+				continue;
+			}
+			if (!service.IsRegionCalculated())
+			{
+				DisplayStatus("Please calculate region first");
+				continue;
+			}
+
+			returnval = service.FIND_CONTOURS();
+			if (returnval == Status::FAILURE)
+			{
+				DisplayStatus("Something went wrong. Please see the error message above.");
+				continue;
+			}
+			else
+			{
+				std::vector<Contour> contours;
+				service.GET_CONTOURS(contours);
+				DisplayStatus("Contour find completed, " + std::to_string(contours.size()) + " contours");
+			}
+		}
+		else if (args[0] == "SMOOTH_CONTOURS")
+		{
+			if (count < 3)
+			{
+				DisplayStatus("Please enter valid command");
+				continue;
+			}
+			if (!service.IsContourCalculated())
+			{
+				DisplayStatus("Please calculate contours first");
+				continue;
+			}
+
+			ContourSmoothing method;
+			if (args[1] == "avg")
+			{
+				method = ContourSmoothing::MOVING_AVERAGE;
+			}
+			else if (args[1] == "chaikin")
+			{
+				method = ContourSmoothing::CHAIKIN;
+			}
+			else if (args[1] == "dp")
+			{
+				method = ContourSmoothing::DOUGLAS_PEUCKER;
+			}
+			else
+			{
+				DisplayStatus("Enter valid smoothing");
+				continue;
+			}
+			double amount = std::stod(args[2]);
+
+			returnval = service.SMOOTH_CONTOURS(method, amount);
+			if (returnval == Status::AMOUNT_OUT_OF_RANGE)
+			{
+				DisplayStatus("Please enter an amount of 0 or more, and at most " + std::to_string(MAX_CHAIKIN_PASSES) + " chaikin passes");
+				continue;
+			}
+			else if (returnval == Status::FAILURE)
+			{
+				DisplayStatus("Something went wrong. Please see the error message above.");
+				continue;
+			}
+			else
+			{
+				DisplayStatus("Contour smoothening completed");
+			}
+		}
+		else if (args[0] == "SAVE_CONTOURS")
+		{
+			if (count < 2)
+			{
+				DisplayStatus("Please enter valid command");
+				continue;
+			}
+			if (!service.IsContourCalculated())
+			{
+				DisplayStatus("Please calculate contours first");
+				continue;
+			}
+
+			args[1].erase(remove_if(args[1].begin(), args[1].end(), ::isspace), args[1].end());
+
+			returnval = service.SAVE_CONTOURS(args[1]);
+			if (returnval == Status::FAILURE)
+			{
+				DisplayStatus("Something went wrong. Please see the error message above.");
+				continue;
+			}
+			else
+			{
+				DisplayStatus("Contours saved.");
+			}
+		}
 		else if (args[0] == "DISPLAY_IMAGE")
 		{
 			if (!service.IsIntitialized())
@@ -237,7 +1183,7 @@ int main()
 				continue;
 			}
 
-			args[1].erase(remove_if(args[1].begin(), args[1].end(), isspace), args[1].end());
+			args[1].erase(remove_if(args[1].begin(), args[1].end(), ::isspace), args[1].end());
 
 			OutputImageType type;
 			if (args[1] == "perimeter")
@@ -281,6 +1227,11 @@ int main()
 				DisplayStatus("Something went wrong. Please see the error message above.");
 				continue;
 			}
+			else if (returnval == Status::OVER_MEMORY_BUDGET)
+			{
+				DisplayStatus("The memory budget of this image has no room for this command.");
+				continue;
+			}
 		}
 		else if (args[0] == "SAVE_PIXELS")
 		{
@@ -295,7 +1246,7 @@ int main()
 				continue;
 			}
 
-			args[1].erase(remove_if(args[1].begin(), args[1].end(), isspace), args[1].end());
+			args[1].erase(remove_if(args[1].begin(), args[1].end(), ::isspace), args[1].end());
 
 			OutputImageType type;
 			if (args[1] == "perimeter")
@@ -333,16 +1284,57 @@ int main()
 				}
 			}
 
-			returnval = service.SAVE_PIXELS(type, args[2]);
+			SaveOptions options;
+			bool isValid = true;
+			for (int i = 3; i < count; ++i)
+			{
+				args[i].erase(remove_if(args[i].begin(), args[i].end(), ::isspace), args[i].end());
+				if (args[i] == "image")
+					options.format = OutputFormat::IMAGE_FILE;
+				else if (args[i] == "png1")
+					options.format = OutputFormat::PNG_1BIT;
+				else if (args[i] == "tiff1")
+					options.format = OutputFormat::TIFF_1BIT;
+				else if (args[i] == "rle")
+					options.format = OutputFormat::RLE_MASK;
+				else if (args[i] == "background")
+					options.isBackground = true;
+				else if (!args[i].empty() && std::all_of(args[i].begin(), args[i].end(), ::isdigit))
+					options.compression = std::stoi(args[i]);
+				else
+					isValid = false;
+			}
+			if (!isValid)
+			{
+				DisplayStatus("Enter valid save options");
+				continue;
+			}
+
+			returnval = service.SAVE_PIXELS(type, args[2], options);
 			if (returnval == Status::FAILURE)
 			{
 				DisplayStatus("Something went wrong. Please see the error message above.");
 				continue;
 			}
+			else if (returnval == Status::OVER_MEMORY_BUDGET)
+			{
+				DisplayStatus("The memory budget of this image has no room for this command.");
+				continue;
+			}
 			else
 			{
-				DisplayStatus("Output save completed");
+				DisplayStatus(options.isBackground ? "Output save started" : "Output save completed");
+			}
+		}
+		else if (args[0] == "FLUSH_SAVES")
+		{
+			returnval = service.FLUSH_SAVES();
+			if (returnval == Status::FAILURE)
+			{
+				DisplayStatus("Some background saves could not be written");
+				continue;
 			}
+			DisplayStatus("Background saves completed");
 		}
 		else if (args[0] == "HELP")
 		{
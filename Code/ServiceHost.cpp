@@ -0,0 +1,164 @@
+#include "ServiceHost.h"
+#include <vector>
+
+Status ServiceHost::OPEN_SESSION(const std::string &filename, int &sessionId)
+{
+	bool isCounted = false;
+	try
+	{
+		std::shared_ptr<HostedImage> image;
+		bool isRawCacheUsed;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			std::shared_ptr<HostedImage> &entry = m_images[filename];
+			if (!entry)
+				entry = std::make_shared<HostedImage>();
+			image = entry;
+			++image->sessions;
+			isCounted = true;
+			isRawCacheUsed = m_isRawCacheUsed;
+		}
+
+		//the first session loads the image, sessions opening it meanwhile wait for that instead of loading it again
+		std::shared_ptr<Session> session = std::make_shared<Session>();
+		session->filename = filename;
+		Status val = Status::SUCCESS;
+		{
+			std::lock_guard<std::mutex> lock(image->mutex);
+			if (!image->isLoaded)
+			{
+				//the budget is read here so that a SET_MEMORY_BUDGET meanwhile either comes before this load or finds it loaded
+				size_t memoryBudget;
+				{
+					std::lock_guard<std::mutex> hostLock(m_mutex);
+					memoryBudget = m_memoryBudget;
+				}
+				std::string path = filename;
+				image->source.SET_RAW_CACHE(isRawCacheUsed);
+				image->source.SET_MEMORY_BUDGET(memoryBudget);
+				val = image->source.INITIALIZE(path);
+				image->isLoaded = (val == Status::SUCCESS);
+			}
+			if (val == Status::SUCCESS)
+				val = session->service.SHARE_IMAGE(image->source);
+		}
+		if (val != Status::SUCCESS)
+		{
+			Release_Image(filename);
+			return val;
+		}
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		sessionId = m_nextSessionId++;
+		m_sessions[sessionId] = session;
+		return Status::SUCCESS;
+	}
+	catch (...)
+	{
+		if (isCounted)
+			Release_Image(filename);
+		return Status::FAILURE;
+	}
+}
+
+Status ServiceHost::CLOSE_SESSION(int sessionId)
+{
+	try
+	{
+		std::shared_ptr<Session> session;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			auto found = m_sessions.find(sessionId);
+			if (found == m_sessions.end())
+				return Status::FAILURE;
+			session = found->second;
+			m_sessions.erase(found);
+		}
+
+		//a command still running on the session keeps it, and so the image, alive until it returns
+		Release_Image(session->filename);
+		return Status::SUCCESS;
+	}
+	catch (...)
+	{
+		return Status::FAILURE;
+	}
+}
+
+Status ServiceHost::RUN(int sessionId, const std::function<Status(ImageAnalysisService&)> &command)
+{
+	try
+	{
+		std::shared_ptr<Session> session;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			auto found = m_sessions.find(sessionId);
+			if (found == m_sessions.end())
+				return Status::FAILURE;
+			session = found->second;
+		}
+
+		std::lock_guard<std::mutex> lock(session->mutex);
+		return command(session->service);
+	}
+	catch (...)
+	{
+		return Status::FAILURE;
+	}
+}
+
+Status ServiceHost::SET_RAW_CACHE(bool enabled)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_isRawCacheUsed = enabled;
+	return Status::SUCCESS;
+}
+
+Status ServiceHost::SET_MEMORY_BUDGET(size_t bytes)
+{
+	try
+	{
+		std::vector<std::shared_ptr<HostedImage>> images;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_memoryBudget = bytes;
+			for (auto &entry : m_images)
+				images.push_back(entry.second);
+		}
+
+		//sessions share their image's strips, so setting the budget on the source sets it for all of them
+		Status val = Status::SUCCESS;
+		for (size_t i = 0; i < images.size(); ++i)
+		{
+			std::lock_guard<std::mutex> lock(images[i]->mutex);
+			if (images[i]->isLoaded && (images[i]->source.SET_MEMORY_BUDGET(bytes) != Status::SUCCESS))
+				val = Status::OVER_MEMORY_BUDGET;
+		}
+		return val;
+	}
+	catch (...)
+	{
+		return Status::FAILURE;
+	}
+}
+
+int ServiceHost::GetSessionCount()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return (int)m_sessions.size();
+}
+
+int ServiceHost::GetImageCount()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return (int)m_images.size();
+}
+
+void ServiceHost::Release_Image(const std::string &filename)
+{
+	//the pixels themselves go when the last service sharing them does
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto found = m_images.find(filename);
+	if ((found != m_images.end()) && (--found->second->sessions == 0))
+		m_images.erase(found);
+}
@@ -0,0 +1,59 @@
+#ifndef SERVICE_HOST_H
+#define SERVICE_HOST_H
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "ImageAnalysisService.h"
+
+//Many analyses served concurrently from one process.
+//Each image is loaded once and shared read only by every session opened on it (see SHARE_IMAGE). A session is
+//an ImageAnalysisService with its own region, perimeter and scratch state, and its masks are only allocated once
+//it grows a region, so idle sessions are cheap. Every method can be called from any thread: commands on one
+//session run one at a time, different sessions run in parallel, and an image is dropped with its last session.
+class ServiceHost
+{
+private:
+	//one loaded image and the number of sessions using it
+	struct HostedImage
+	{
+		std::mutex mutex;
+		bool isLoaded = false;
+		ImageAnalysisService source;
+		int sessions = 0;
+	};
+
+	struct Session
+	{
+		std::mutex mutex;
+		std::string filename;
+		ImageAnalysisService service;
+	};
+
+	std::mutex m_mutex;
+	std::map<std::string, std::shared_ptr<HostedImage>> m_images;
+	std::map<int, std::shared_ptr<Session>> m_sessions;
+	int m_nextSessionId = 1;
+	bool m_isRawCacheUsed = false;
+	size_t m_memoryBudget = 256 * 1024 * 1024;
+
+	void Release_Image(const std::string &filename);
+
+public:
+	//opens a session on filename, which is only loaded if no open session already has it
+	Status OPEN_SESSION(const std::string &filename, int &sessionId);
+	Status CLOSE_SESSION(int sessionId);
+	//runs command on the session's service, no other command of that session runs meanwhile
+	Status RUN(int sessionId, const std::function<Status(ImageAnalysisService&)> &command);
+	//images loaded from now on keep a raw cache next to them, see ImageAnalysisService::SET_RAW_CACHE
+	Status SET_RAW_CACHE(bool enabled);
+	//memory budget of every streamed image, loaded or loaded from now on, see ImageAnalysisService::SET_MEMORY_BUDGET.
+	//OVER_MEMORY_BUDGET when a loaded image keeps its old budget because the new one is too small for it
+	Status SET_MEMORY_BUDGET(size_t bytes);
+	int GetSessionCount();
+	int GetImageCount();
+};
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+//SSE2 is always there on x64, AVX2 kernels are compiled in and picked at runtime
+#if defined(_M_X64) || defined(__x86_64__) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2)) || defined(__SSE2__)
+#define IAS_HAVE_SSE2
+#include <emmintrin.h>
+#if defined(_MSC_VER) || defined(__GNUC__)
+#define IAS_HAVE_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+//gcc and clang need the target attribute to emit AVX2 code from a non AVX2 build
+#if defined(__GNUC__) && !defined(__AVX2__)
+#define IAS_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define IAS_TARGET_AVX2
+#endif
+
+enum SimdLevel { SIMD_SCALAR, SIMD_SSE2, SIMD_AVX2 };
+
+inline SimdLevel Query_Simd_Level()
+{
+#if defined(IAS_HAVE_AVX2) && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return SIMD_SSE2;
+
+	//AVX2 also needs the OS to save the ymm registers
+	__cpuid(info, 1);
+	if (((info[2] & (1 << 27)) == 0) || ((info[2] & (1 << 28)) == 0) || ((_xgetbv(0) & 6) != 6))
+		return SIMD_SSE2;
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) ? SIMD_AVX2 : SIMD_SSE2;
+#elif defined(IAS_HAVE_AVX2)
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") ? SIMD_AVX2 : SIMD_SSE2;
+#elif defined(IAS_HAVE_SSE2)
+	return SIMD_SSE2;
+#else
+	return SIMD_SCALAR;
+#endif
+}
+
+//best level supported by this cpu, checked once
+inline SimdLevel Detect_Simd_Level()
+{
+	static const SimdLevel level = Query_Simd_Level();
+	return level;
+}
+
+#endif
@@ -0,0 +1,665 @@
+#include "Smoothing.h"
+#include <algorithm>
+#include <cmath>
+
+//below this many rows a band is not worth handing to another thread
+static const int MIN_BAND_ROWS = 16;
+
+//a column sum holds pixel * SMOOTHING_ONE * SMOOTHING_ONE, the output is sum * 4 / (9 * 128 * 128).
+//That is done as (sum >> 12) / 9, and the division as a multiply by 7282 and a shift by 16, which is
+//exact for the sums of 8 bit pixels (at most 1020 after the shift)
+static const int SUM_SHIFT = 12;
+static const int NINTH_MULTIPLIER = 7282;
+
+static inline uchar Scale_Sum(int sum)
+{
+	return (uchar)(((sum >> SUM_SHIFT) * NINTH_MULTIPLIER) >> 16);
+}
+
+//row pass plane of one call, the running totals of one box row pass and the sums and rings of one box column band,
+//kept per thread and reused
+struct SmoothBuffers
+{
+	std::vector<int16_t> rows;
+	std::vector<uint32_t> lines[2];
+	std::vector<int32_t> sums;
+	std::vector<int16_t> rings;
+};
+
+static SmoothBuffers& Smooth_Buffers()
+{
+	static thread_local SmoothBuffers buffers;
+	return buffers;
+}
+
+static bool Is_Cancelled(const std::atomic<bool> *cancel)
+{
+	return (cancel != nullptr) && cancel->load(std::memory_order_relaxed);
+}
+
+SmoothingKernel Make_Smoothing_Kernel(int size, double sigma)
+{
+	SmoothingKernel kernel;
+	if (size > BOX_KERNEL_SIZE)
+	{
+		//the binomial kernel of n taps has a variance of (n - 1) / 4
+		if (sigma <= 0)
+			sigma = std::sqrt((size - 1) / 4.0);
+
+		//three boxes of width low or low + 2 whose variances (width^2 - 1) / 12 add up to sigma^2
+		const int n = 3;
+		int low = (int)std::floor(std::sqrt(12.0 * sigma * sigma / n + 1));
+		if (low % 2 == 0)
+			--low;
+		low = std::max(low, 1);
+		int lowCount = (int)std::floor((12.0 * sigma * sigma - n * low * low - 4.0 * n * low - 3.0 * n) / (-4.0 * low - 4) + 0.5);
+		lowCount = std::min(std::max(lowCount, 0), n);
+		for (int i = 0; i < n; ++i)
+		{
+			kernel.boxes.push_back((i < lowCount) ? low : low + 2);
+			kernel.radius += kernel.boxes.back() / 2;
+		}
+		return kernel;
+	}
+
+	kernel.radius = size / 2;
+	std::vector<double> weights(size);
+	double total = 0;
+	for (int k = 0; k < size; ++k)
+	{
+		if (sigma <= 0)
+			weights[k] = (k == 0) ? 1 : weights[k - 1] * (size - k) / k;
+		else
+			weights[k] = std::exp(-(k - kernel.radius) * (k - kernel.radius) / (2 * sigma * sigma));
+		total += weights[k];
+	}
+
+	//rounding is made up on the centre tap, so the taps still add up to one
+	int sum = 0;
+	for (int k = 0; k < size; ++k)
+	{
+		kernel.taps.push_back((int)std::floor(SMOOTHING_ONE * weights[k] / total + 0.5));
+		sum += kernel.taps.back();
+	}
+	kernel.taps[kernel.radius] += SMOOTHING_ONE - sum;
+	return kernel;
+}
+
+//dst[j] = sum of taps[k] * src[j + k], the sums of 8 bit pixels fit in 16 bits
+static void Row_Pass_Scalar(const uchar *src, int16_t *dst, const int *taps, int length, int first, int count)
+{
+	for (int j = first; j < count; ++j)
+	{
+		int sum = 0;
+		for (int k = 0; k < length; ++k)
+			sum += taps[k] * src[j + k];
+		dst[j] = (int16_t)sum;
+	}
+}
+
+//out[j] = Scale_Sum of the sum of taps[k] * rows[k][j]
+static void Column_Pass_Scalar(const int16_t *const *rows, uchar *out, const int *taps, int length, int first, int count)
+{
+	for (int j = first; j < count; ++j)
+	{
+		int sum = 0;
+		for (int k = 0; k < length; ++k)
+			sum += taps[k] * rows[k][j];
+		out[j] = Scale_Sum(sum);
+	}
+}
+
+#ifdef IAS_HAVE_SSE2
+static int Row_Pass_Sse2(const uchar *src, int16_t *dst, const int *taps, int length, int count)
+{
+	const __m128i zero = _mm_setzero_si128();
+	int j = 0;
+	for (; j + 8 <= count; j += 8)
+	{
+		__m128i sum = zero;
+		for (int k = 0; k < length; ++k)
+		{
+			__m128i pixels = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(src + j + k)), zero);
+			sum = _mm_add_epi16(sum, _mm_mullo_epi16(pixels, _mm_set1_epi16((short)taps[k])));
+		}
+		_mm_storeu_si128((__m128i*)(dst + j), sum);
+	}
+	return j;
+}
+
+//rows are taken two at a time, interleaved so one multiply-add gives both of their products
+static int Column_Pass_Sse2(const int16_t *const *rows, uchar *out, const int *taps, int length, int count)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i ninth = _mm_set1_epi16((short)NINTH_MULTIPLIER);
+	int j = 0;
+	for (; j + 8 <= count; j += 8)
+	{
+		__m128i low = zero, high = zero;
+		for (int k = 0; k < length; k += 2)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i*)(rows[k] + j));
+			__m128i b = (k + 1 < length) ? _mm_loadu_si128((const __m128i*)(rows[k + 1] + j)) : zero;
+			__m128i weights = _mm_set1_epi32((int)(((unsigned)((k + 1 < length) ? taps[k + 1] : 0) << 16) | (unsigned)taps[k]));
+			low = _mm_add_epi32(low, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), weights));
+			high = _mm_add_epi32(high, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), weights));
+		}
+		__m128i shifted = _mm_packs_epi32(_mm_srai_epi32(low, SUM_SHIFT), _mm_srai_epi32(high, SUM_SHIFT));
+		_mm_storel_epi64((__m128i*)(out + j), _mm_packus_epi16(_mm_mulhi_epu16(shifted, ninth), zero));
+	}
+	return j;
+}
+#endif
+
+#ifdef IAS_HAVE_AVX2
+static IAS_TARGET_AVX2 int Row_Pass_Avx2(const uchar *src, int16_t *dst, const int *taps, int length, int count)
+{
+	int j = 0;
+	for (; j + 16 <= count; j += 16)
+	{
+		__m256i sum = _mm256_setzero_si256();
+		for (int k = 0; k < length; ++k)
+		{
+			__m256i pixels = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(src + j + k)));
+			sum = _mm256_add_epi16(sum, _mm256_mullo_epi16(pixels, _mm256_set1_epi16((short)taps[k])));
+		}
+		_mm256_storeu_si256((__m256i*)(dst + j), sum);
+	}
+	return j;
+}
+
+static IAS_TARGET_AVX2 int Column_Pass_Avx2(const int16_t *const *rows, uchar *out, const int *taps, int length, int count)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i ninth = _mm256_set1_epi16((short)NINTH_MULTIPLIER);
+	int j = 0;
+	for (; j + 16 <= count; j += 16)
+	{
+		__m256i low = zero, high = zero;
+		for (int k = 0; k < length; k += 2)
+		{
+			__m256i a = _mm256_loadu_si256((const __m256i*)(rows[k] + j));
+			__m256i b = (k + 1 < length) ? _mm256_loadu_si256((const __m256i*)(rows[k + 1] + j)) : zero;
+			__m256i weights = _mm256_set1_epi32((int)(((unsigned)((k + 1 < length) ? taps[k + 1] : 0) << 16) | (unsigned)taps[k]));
+			low = _mm256_add_epi32(low, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), weights));
+			high = _mm256_add_epi32(high, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), weights));
+		}
+		//unpacking and packing both work within 128 bit lanes, so the columns come back in order
+		__m256i shifted = _mm256_packs_epi32(_mm256_srai_epi32(low, SUM_SHIFT), _mm256_srai_epi32(high, SUM_SHIFT));
+		__m256i bytes = _mm256_packus_epi16(_mm256_mulhi_epu16(shifted, ninth), zero);
+		bytes = _mm256_permute4x64_epi64(bytes, 0xD8);
+		_mm_storeu_si128((__m128i*)(out + j), _mm256_castsi256_si128(bytes));
+	}
+	return j;
+}
+#endif
+
+static void Row_Pass(const uchar *src, int16_t *dst, const int *taps, int length, int count, SimdLevel level)
+{
+	int done = 0;
+#ifdef IAS_HAVE_AVX2
+	if (level == SIMD_AVX2)
+		done = Row_Pass_Avx2(src, dst, taps, length, count);
+#endif
+#ifdef IAS_HAVE_SSE2
+	if (level == SIMD_SSE2)
+		done = Row_Pass_Sse2(src, dst, taps, length, count);
+#endif
+	Row_Pass_Scalar(src, dst, taps, length, done, count);
+}
+
+static void Column_Pass(const int16_t *const *rows, uchar *out, const int *taps, int length, int count, SimdLevel level)
+{
+	int done = 0;
+#ifdef IAS_HAVE_AVX2
+	if (level == SIMD_AVX2)
+		done = Column_Pass_Avx2(rows, out, taps, length, count);
+#endif
+#ifdef IAS_HAVE_SSE2
+	if (level == SIMD_SSE2)
+		done = Column_Pass_Sse2(rows, out, taps, length, count);
+#endif
+	Column_Pass_Scalar(rows, out, taps, length, done, count);
+}
+
+//one row of a box column pass: sums[j] += entering[j], out[j] = sums[j] * scale rounded, sums[j] -= leaving[j].
+//The last box writes its values to pixels instead of out
+static void Box_Step_Scalar(const int16_t *entering, const int16_t *leaving, int32_t *sums, int16_t *out, uchar *pixels, float scale,
+	int first, int count)
+{
+	for (int j = first; j < count; ++j)
+	{
+		int sum = sums[j] + entering[j];
+		int value = (int)(sum * scale + 0.5f);
+		if (pixels != nullptr)
+			pixels[j] = (uchar)value;
+		else
+			out[j] = (int16_t)value;
+		sums[j] = sum - leaving[j];
+	}
+}
+
+#ifdef IAS_HAVE_SSE2
+static int Box_Step_Sse2(const int16_t *entering, const int16_t *leaving, int32_t *sums, int16_t *out, uchar *pixels, float scale, int count)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 factor = _mm_set1_ps(scale);
+	const __m128 half = _mm_set1_ps(0.5f);
+	int j = 0;
+	for (; j + 8 <= count; j += 8)
+	{
+		__m128i in = _mm_loadu_si128((const __m128i*)(entering + j));
+		__m128i gone = _mm_loadu_si128((const __m128i*)(leaving + j));
+		__m128i low = _mm_add_epi32(_mm_loadu_si128((const __m128i*)(sums + j)), _mm_unpacklo_epi16(in, zero));
+		__m128i high = _mm_add_epi32(_mm_loadu_si128((const __m128i*)(sums + j + 4)), _mm_unpackhi_epi16(in, zero));
+		__m128i lowOut = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(low), factor), half));
+		__m128i highOut = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(high), factor), half));
+		__m128i values = _mm_packs_epi32(lowOut, highOut);
+		if (pixels != nullptr)
+			_mm_storel_epi64((__m128i*)(pixels + j), _mm_packus_epi16(values, zero));
+		else
+			_mm_storeu_si128((__m128i*)(out + j), values);
+		_mm_storeu_si128((__m128i*)(sums + j), _mm_sub_epi32(low, _mm_unpacklo_epi16(gone, zero)));
+		_mm_storeu_si128((__m128i*)(sums + j + 4), _mm_sub_epi32(high, _mm_unpackhi_epi16(gone, zero)));
+	}
+	return j;
+}
+#endif
+
+#ifdef IAS_HAVE_AVX2
+static IAS_TARGET_AVX2 int Box_Step_Avx2(const int16_t *entering, const int16_t *leaving, int32_t *sums, int16_t *out, uchar *pixels, float scale,
+	int count)
+{
+	const __m256 factor = _mm256_set1_ps(scale);
+	const __m256 half = _mm256_set1_ps(0.5f);
+	int j = 0;
+	for (; j + 16 <= count; j += 16)
+	{
+		__m256i in = _mm256_loadu_si256((const __m256i*)(entering + j));
+		__m256i gone = _mm256_loadu_si256((const __m256i*)(leaving + j));
+		__m256i low = _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(sums + j)), _mm256_cvtepu16_epi32(_mm256_castsi256_si128(in)));
+		__m256i high = _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(sums + j + 8)), _mm256_cvtepu16_epi32(_mm256_extracti128_si256(in, 1)));
+		__m256i lowOut = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(low), factor), half));
+		__m256i highOut = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(high), factor), half));
+		//packing works within 128 bit lanes, the permute puts the columns back in order
+		__m256i values = _mm256_permute4x64_epi64(_mm256_packs_epi32(lowOut, highOut), 0xD8);
+		if (pixels != nullptr)
+			_mm_storeu_si128((__m128i*)(pixels + j), _mm_packus_epi16(_mm256_castsi256_si128(values), _mm256_extracti128_si256(values, 1)));
+		else
+			_mm256_storeu_si256((__m256i*)(out + j), values);
+		_mm256_storeu_si256((__m256i*)(sums + j), _mm256_sub_epi32(low, _mm256_cvtepu16_epi32(_mm256_castsi256_si128(gone))));
+		_mm256_storeu_si256((__m256i*)(sums + j + 8), _mm256_sub_epi32(high, _mm256_cvtepu16_epi32(_mm256_extracti128_si256(gone, 1))));
+	}
+	return j;
+}
+#endif
+
+static void Box_Step(const int16_t *entering, const int16_t *leaving, int32_t *sums, int16_t *out, uchar *pixels, float scale, int count,
+	SimdLevel level)
+{
+	int done = 0;
+#ifdef IAS_HAVE_AVX2
+	if (level == SIMD_AVX2)
+		done = Box_Step_Avx2(entering, leaving, sums, out, pixels, scale, count);
+#endif
+#ifdef IAS_HAVE_SSE2
+	if (level == SIMD_SSE2)
+		done = Box_Step_Sse2(entering, leaving, sums, out, pixels, scale, count);
+#endif
+	Box_Step_Scalar(entering, leaving, sums, out, pixels, scale, done, count);
+}
+
+//Box row passes work on running totals, prefix[j] being the sum of the first j values of the line. A box of width
+//w is then prefix[j + w] - prefix[j], and the totals of the next box add those differences up, so no box divides.
+//The totals are unsigned and may wrap, the differences are still exact as long as the boxes' sums fit 31 bits
+
+//prefix[j + 1] = prefix[j] + src[j], starting from first
+static void Prefix_Pixels_Scalar(const uchar *src, uint32_t *prefix, int first, int count)
+{
+	for (int j = first; j < count; ++j)
+		prefix[j + 1] = prefix[j] + src[j];
+}
+
+//prefix[j + 1] = prefix[j] + lower[j + width] - lower[j], the totals of a box over the totals lower
+static void Prefix_Box_Scalar(const uint32_t *lower, uint32_t *prefix, int width, int first, int count)
+{
+	for (int j = first; j < count; ++j)
+		prefix[j + 1] = prefix[j] + (lower[j + width] - lower[j]);
+}
+
+//the last box: out[j] = (lower[j + width] - lower[j]) * scale rounded
+static void Scale_Box_Scalar(const uint32_t *lower, int16_t *out, int width, float scale, int first, int count)
+{
+	for (int j = first; j < count; ++j)
+		out[j] = (int16_t)(int)((int)(lower[j + width] - lower[j]) * scale + 0.5f);
+}
+
+#ifdef IAS_HAVE_SSE2
+//the running totals of 4 values in a register, added to carry, and carry set to the last of them
+static inline __m128i Prefix_Sse2(__m128i values, __m128i &carry)
+{
+	values = _mm_add_epi32(values, _mm_slli_si128(values, 4));
+	values = _mm_add_epi32(values, _mm_slli_si128(values, 8));
+	values = _mm_add_epi32(values, carry);
+	carry = _mm_shuffle_epi32(values, 0xFF);
+	return values;
+}
+
+static int Prefix_Pixels_Sse2(const uchar *src, uint32_t *prefix, int count)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i carry = _mm_set1_epi32((int)prefix[0]);
+	int j = 0;
+	for (; j + 8 <= count; j += 8)
+	{
+		__m128i pixels = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(src + j)), zero);
+		_mm_storeu_si128((__m128i*)(prefix + j + 1), Prefix_Sse2(_mm_unpacklo_epi16(pixels, zero), carry));
+		_mm_storeu_si128((__m128i*)(prefix + j + 5), Prefix_Sse2(_mm_unpackhi_epi16(pixels, zero), carry));
+	}
+	return j;
+}
+
+static int Prefix_Box_Sse2(const uint32_t *lower, uint32_t *prefix, int width, int count)
+{
+	__m128i carry = _mm_set1_epi32((int)prefix[0]);
+	int j = 0;
+	for (; j + 4 <= count; j += 4)
+	{
+		__m128i sums = _mm_sub_epi32(_mm_loadu_si128((const __m128i*)(lower + j + width)), _mm_loadu_si128((const __m128i*)(lower + j)));
+		_mm_storeu_si128((__m128i*)(prefix + j + 1), Prefix_Sse2(sums, carry));
+	}
+	return j;
+}
+
+static int Scale_Box_Sse2(const uint32_t *lower, int16_t *out, int width, float scale, int count)
+{
+	const __m128 factor = _mm_set1_ps(scale);
+	const __m128 half = _mm_set1_ps(0.5f);
+	int j = 0;
+	for (; j + 8 <= count; j += 8)
+	{
+		__m128i low = _mm_sub_epi32(_mm_loadu_si128((const __m128i*)(lower + j + width)), _mm_loadu_si128((const __m128i*)(lower + j)));
+		__m128i high = _mm_sub_epi32(_mm_loadu_si128((const __m128i*)(lower + j + width + 4)), _mm_loadu_si128((const __m128i*)(lower + j + 4)));
+		low = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(low), factor), half));
+		high = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(high), factor), half));
+		_mm_storeu_si128((__m128i*)(out + j), _mm_packs_epi32(low, high));
+	}
+	return j;
+}
+#endif
+
+#ifdef IAS_HAVE_AVX2
+//the same for 8 values, the shifts work within 128 bit lanes so the low lane's total is added to the high lane
+static IAS_TARGET_AVX2 inline __m256i Prefix_Avx2(__m256i values, __m256i &carry)
+{
+	values = _mm256_add_epi32(values, _mm256_slli_si256(values, 4));
+	values = _mm256_add_epi32(values, _mm256_slli_si256(values, 8));
+	values = _mm256_add_epi32(values, _mm256_permute2x128_si256(_mm256_shuffle_epi32(values, 0xFF), values, 0x08));
+	values = _mm256_add_epi32(values, carry);
+	carry = _mm256_permutevar8x32_epi32(values, _mm256_set1_epi32(7));
+	return values;
+}
+
+static IAS_TARGET_AVX2 int Prefix_Pixels_Avx2(const uchar *src, uint32_t *prefix, int count)
+{
+	__m256i carry = _mm256_set1_epi32((int)prefix[0]);
+	int j = 0;
+	for (; j + 8 <= count; j += 8)
+	{
+		__m256i pixels = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(src + j)));
+		_mm256_storeu_si256((__m256i*)(prefix + j + 1), Prefix_Avx2(pixels, carry));
+	}
+	return j;
+}
+
+static IAS_TARGET_AVX2 int Prefix_Box_Avx2(const uint32_t *lower, uint32_t *prefix, int width, int count)
+{
+	__m256i carry = _mm256_set1_epi32((int)prefix[0]);
+	int j = 0;
+	for (; j + 8 <= count; j += 8)
+	{
+		__m256i sums = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i*)(lower + j + width)), _mm256_loadu_si256((const __m256i*)(lower + j)));
+		_mm256_storeu_si256((__m256i*)(prefix + j + 1), Prefix_Avx2(sums, carry));
+	}
+	return j;
+}
+
+static IAS_TARGET_AVX2 int Scale_Box_Avx2(const uint32_t *lower, int16_t *out, int width, float scale, int count)
+{
+	const __m256 factor = _mm256_set1_ps(scale);
+	const __m256 half = _mm256_set1_ps(0.5f);
+	int j = 0;
+	for (; j + 16 <= count; j += 16)
+	{
+		__m256i low = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i*)(lower + j + width)), _mm256_loadu_si256((const __m256i*)(lower + j)));
+		__m256i high = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i*)(lower + j + width + 8)), _mm256_loadu_si256((const __m256i*)(lower + j + 8)));
+		low = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(low), factor), half));
+		high = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(high), factor), half));
+		_mm256_storeu_si256((__m256i*)(out + j), _mm256_permute4x64_epi64(_mm256_packs_epi32(low, high), 0xD8));
+	}
+	return j;
+}
+#endif
+
+static void Prefix_Pixels(const uchar *src, uint32_t *prefix, int count, SimdLevel level)
+{
+	int done = 0;
+	prefix[0] = 0;
+#ifdef IAS_HAVE_AVX2
+	if (level == SIMD_AVX2)
+		done = Prefix_Pixels_Avx2(src, prefix, count);
+#endif
+#ifdef IAS_HAVE_SSE2
+	if (level == SIMD_SSE2)
+		done = Prefix_Pixels_Sse2(src, prefix, count);
+#endif
+	Prefix_Pixels_Scalar(src, prefix, done, count);
+}
+
+static void Prefix_Box(const uint32_t *lower, uint32_t *prefix, int width, int count, SimdLevel level)
+{
+	int done = 0;
+	prefix[0] = 0;
+#ifdef IAS_HAVE_AVX2
+	if (level == SIMD_AVX2)
+		done = Prefix_Box_Avx2(lower, prefix, width, count);
+#endif
+#ifdef IAS_HAVE_SSE2
+	if (level == SIMD_SSE2)
+		done = Prefix_Box_Sse2(lower, prefix, width, count);
+#endif
+	Prefix_Box_Scalar(lower, prefix, width, done, count);
+}
+
+static void Scale_Box(const uint32_t *lower, int16_t *out, int width, float scale, int count, SimdLevel level)
+{
+	int done = 0;
+#ifdef IAS_HAVE_AVX2
+	if (level == SIMD_AVX2)
+		done = Scale_Box_Avx2(lower, out, width, scale, count);
+#endif
+#ifdef IAS_HAVE_SSE2
+	if (level == SIMD_SSE2)
+		done = Scale_Box_Sse2(lower, out, width, scale, count);
+#endif
+	Scale_Box_Scalar(lower, out, width, scale, done, count);
+}
+
+//box column passes over rows x cols values (SMOOTHING_ONE times the pixels), which give rows - 2 * radius rows of
+//pixels. The rows are walked once with all of the boxes: each keeps a running sum per column and writes its averages
+//into a ring of the next box's last width rows, the last one into pixels scaled by gain. Every box divides by its
+//width as a float multiply
+static void Box_Columns(const int16_t *src, int rows, int cols, const std::vector<int> &boxes, float gain, uchar *pixels, size_t pixelStep,
+	SmoothBuffers &buffers, const std::atomic<bool> *cancel, SimdLevel level)
+{
+	const int boxCount = (int)boxes.size();
+	size_t ringRows = 0;
+	for (int b = 1; b < boxCount; ++b)
+		ringRows += boxes[b];
+	buffers.sums.assign((size_t)boxCount * cols, 0);
+	buffers.rings.resize(ringRows * cols);
+	for (int q = 0; q < rows; ++q)
+	{
+		if (Is_Cancelled(cancel))
+			return;
+		//box b gets its row index of q once the boxes before it have filled their windows
+		const int16_t *entering = src + (size_t)q * cols;
+		int index = q;
+		int16_t *ring = nullptr;
+		for (int b = 0; b < boxCount; ++b)
+		{
+			const int width = boxes[b];
+			int32_t *sums = &buffers.sums[(size_t)b * cols];
+			if (index < width - 1)
+			{
+				for (int j = 0; j < cols; ++j)
+					sums[j] += entering[j];
+				break;
+			}
+
+			const int16_t *leaving = (b == 0) ? src + (size_t)(q - width + 1) * cols : ring + (size_t)((index + 1) % width) * cols;
+			index -= width - 1;
+			if (b + 1 == boxCount)
+			{
+				Box_Step(entering, leaving, sums, nullptr, pixels + (size_t)index * pixelStep, gain / width, cols, level);
+				break;
+			}
+			int16_t *nextRing = (b == 0) ? buffers.rings.data() : ring + (size_t)width * cols;
+			int16_t *out = nextRing + (size_t)(index % boxes[b + 1]) * cols;
+			Box_Step(entering, leaving, sums, out, nullptr, 1.0f / width, cols, level);
+			entering = out;
+			ring = nextRing;
+		}
+	}
+}
+
+static void Smooth_Taps(const cv::Mat &ipImage, cv::Mat &opImage, const SmoothingKernel &kernel, const cv::Rect &bounds,
+	ThreadPool *pool, const std::atomic<bool> *cancel, SimdLevel level)
+{
+	const int radius = kernel.radius;
+	const int length = (int)kernel.taps.size();
+	const int cols = bounds.width;
+	const int planeRows = bounds.height + 2 * radius;
+	std::vector<int16_t> &plane = Smooth_Buffers().rows;
+	plane.resize((size_t)planeRows * cols);
+
+	//row pass over every input row the output rows reach
+	auto rowBand = [&](int first, int last)
+	{
+		for (int q = first; q < last; ++q)
+		{
+			if (Is_Cancelled(cancel))
+				return;
+			const uchar *src = ipImage.ptr<uchar>(bounds.y - radius + q) + bounds.x - radius;
+			Row_Pass(src, &plane[(size_t)q * cols], kernel.taps.data(), length, cols, level);
+		}
+	};
+
+	//column pass, output row i reads plane rows i .. i + length - 1
+	auto columnBand = [&](int first, int last)
+	{
+		//the taps path is only used up to BOX_KERNEL_SIZE taps
+		const int16_t *rows[BOX_KERNEL_SIZE];
+		for (int i = first; i < last; ++i)
+		{
+			if (Is_Cancelled(cancel))
+				return;
+			for (int k = 0; k < length; ++k)
+				rows[k] = &plane[(size_t)(i + k) * cols];
+			Column_Pass(rows, opImage.ptr<uchar>(bounds.y + i) + bounds.x, kernel.taps.data(), length, cols, level);
+		}
+	};
+
+	if (pool != nullptr)
+	{
+		pool->Parallel_For(0, planeRows, MIN_BAND_ROWS, rowBand);
+		pool->Parallel_For(0, bounds.height, MIN_BAND_ROWS, columnBand);
+	}
+	else
+	{
+		rowBand(0, planeRows);
+		columnBand(0, bounds.height);
+	}
+}
+
+static void Smooth_Boxes(const cv::Mat &ipImage, cv::Mat &opImage, const SmoothingKernel &kernel, const cv::Rect &bounds,
+	ThreadPool *pool, const std::atomic<bool> *cancel, SimdLevel level)
+{
+	const int radius = kernel.radius;
+	const int cols = bounds.width;
+	const int lineLength = cols + 2 * radius;
+	const int planeRows = bounds.height + 2 * radius;
+	std::vector<int16_t> &plane = Smooth_Buffers().rows;
+	plane.resize((size_t)planeRows * cols);
+
+	//row passes, the last box scales its sums once to the average times SMOOTHING_ONE
+	const std::vector<int> &boxes = kernel.boxes;
+	float product = 1;
+	for (size_t b = 0; b < boxes.size(); ++b)
+		product *= boxes[b];
+	auto rowBand = [&](int first, int last)
+	{
+		SmoothBuffers &lineBuffers = Smooth_Buffers();
+		std::vector<uint32_t> &prefix = lineBuffers.lines[0];
+		std::vector<uint32_t> &next = lineBuffers.lines[1];
+		prefix.resize(lineLength + 1);
+		next.resize(lineLength + 1);
+		for (int q = first; q < last; ++q)
+		{
+			if (Is_Cancelled(cancel))
+				return;
+			const uchar *src = ipImage.ptr<uchar>(bounds.y - radius + q) + bounds.x - radius;
+			Prefix_Pixels(src, prefix.data(), lineLength, level);
+			//each box shortens the line by its width - 1
+			int count = lineLength;
+			for (size_t b = 0; b + 1 < boxes.size(); ++b)
+			{
+				count -= boxes[b] - 1;
+				Prefix_Box(prefix.data(), next.data(), boxes[b], count, level);
+				std::swap(prefix, next);
+			}
+			Scale_Box(prefix.data(), &plane[(size_t)q * cols], boxes.back(), SMOOTHING_ONE / product, cols, level);
+		}
+	};
+
+	//column passes, the last box also applies the 4/9 gain of the taps path. A band first reads the 2 * radius
+	//rows above it, so bands are kept well over that
+	auto columnBand = [&](int first, int last)
+	{
+		Box_Columns(&plane[(size_t)first * cols], last - first + 2 * radius, cols, boxes, 4.0f / (9.0f * SMOOTHING_ONE),
+			opImage.ptr<uchar>(bounds.y + first) + bounds.x, opImage.step, Smooth_Buffers(), cancel, level);
+	};
+
+	if (pool != nullptr)
+	{
+		pool->Parallel_For(0, planeRows, MIN_BAND_ROWS, rowBand);
+		pool->Parallel_For(0, bounds.height, std::max(MIN_BAND_ROWS, 8 * radius), columnBand);
+	}
+	else
+	{
+		rowBand(0, planeRows);
+		columnBand(0, bounds.height);
+	}
+}
+
+void Gaussian_Smooth(const cv::Mat &ipImage, cv::Mat &opImage, const SmoothingKernel &kernel, const cv::Rect &area,
+	ThreadPool *pool, const std::atomic<bool> *cancel, SimdLevel level)
+{
+	//only pixels whose whole window is inside the image are written
+	const int radius = kernel.radius;
+	const int firstRow = std::max(radius, area.y);
+	const int lastRow = std::min(ipImage.rows - 1 - radius, area.y + area.height - 1);
+	const int firstCol = std::max(radius, area.x);
+	const int lastCol = std::min(ipImage.cols - 1 - radius, area.x + area.width - 1);
+	if ((firstRow > lastRow) || (firstCol > lastCol))
+		return;
+
+	if (level > Detect_Simd_Level())
+		level = Detect_Simd_Level();
+
+	cv::Rect bounds(firstCol, firstRow, lastCol - firstCol + 1, lastRow - firstRow + 1);
+	if (kernel.boxes.empty())
+		Smooth_Taps(ipImage, opImage, kernel, bounds, pool, cancel, level);
+	else
+		Smooth_Boxes(ipImage, opImage, kernel, bounds, pool, cancel, level);
+}
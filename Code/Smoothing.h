@@ -0,0 +1,43 @@
+#ifndef SMOOTHING_H
+#define SMOOTHING_H
+
+#include <atomic>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "Simd.h"
+#include "ThreadPool.h"
+
+//taps of a smoothing kernel add up to this, so a row pass of 8 bit pixels fits 16 bits
+static const int SMOOTHING_ONE = 128;
+//kernels wider than this are approximated by three box passes, whose cost does not grow with the size.
+//Around this size both cost about the same
+static const int BOX_KERNEL_SIZE = 15;
+//the box passes add up to 255 times the product of their widths in 32 bits, which holds up to this sigma
+static const double MAX_SMOOTHING_SIGMA = 100;
+
+//1D Gaussian applied along rows and then columns
+struct SmoothingKernel
+{
+	//fixed point taps adding up to SMOOTHING_ONE, empty when boxes are used
+	std::vector<int> taps;
+	//odd widths of the box passes standing in for a large kernel
+	std::vector<int> boxes;
+	//pixels the kernel reaches on each side
+	int radius = 0;
+};
+
+//size taps (odd) sampled from a Gaussian of sigma. sigma 0 takes the binomial coefficients of the size,
+//so size 3 is the original 1 2 1 filter. Sizes over BOX_KERNEL_SIZE become box passes of the same sigma,
+//which must not be over MAX_SMOOTHING_SIGMA (size 40001 with sigma 0)
+SmoothingKernel Make_Smoothing_Kernel(int size, double sigma);
+
+//Separable smoothing of CV_8UC1 images in integers: a row pass into 16 bit sums, then a column pass into
+//32 bit ones, both with SIMD. Box passes run along the rows on running totals and down the columns with running
+//sums, and divide each average by its width as a float multiply. The result keeps the original 3x3 filter's gain of 4/9 (its weighted sum was
+//divided by 9 and multiplied by 4), which for the default kernel gives exactly the original output.
+//Only pixels inside area whose whole window is inside the image are written, the rest of opImage is left
+//as it was. With a pool bands of rows run in parallel. Once cancel is set the remaining rows are skipped.
+void Gaussian_Smooth(const cv::Mat &ipImage, cv::Mat &opImage, const SmoothingKernel &kernel, const cv::Rect &area,
+	ThreadPool *pool = nullptr, const std::atomic<bool> *cancel = nullptr, SimdLevel level = Detect_Simd_Level());
+
+#endif
@@ -0,0 +1,141 @@
+#include "StripImage.h"
+
+bool ImageStrip::Contains(int row) const
+{
+	return rows && (row >= firstRow) && (row < firstRow + rows->rows);
+}
+
+bool StripImage::Open(const std::string &path)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_isOpen = false;
+	m_strips.clear();
+	m_index.clear();
+	m_bytes = 0;
+	m_reads = 0;
+
+	if (m_file.is_open())
+		m_file.close();
+	m_file.clear();
+	m_file.open(path, std::ios::binary);
+	if (!m_file || !Read_Raw_Header(m_file, m_header))
+		return false;
+
+	//strips of about 1 MB, at least one row
+	m_stripRows = std::max(1, (int)((1 << 20) / m_header.rowBytes));
+	m_isOpen = true;
+	return true;
+}
+
+void StripImage::Close()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_isOpen = false;
+	m_strips.clear();
+	m_index.clear();
+	m_bytes = 0;
+	if (m_file.is_open())
+		m_file.close();
+}
+
+bool StripImage::Is_Open() const
+{
+	return m_isOpen;
+}
+
+int StripImage::Width() const
+{
+	return (int)m_header.width;
+}
+
+int StripImage::Height() const
+{
+	return (int)m_header.height;
+}
+
+bool StripImage::Set_Budget(size_t bytes)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_reserved + Strip_Bytes() > bytes)
+		return false;
+	m_budget = bytes;
+	Trim();
+	return true;
+}
+
+bool StripImage::Reserve(size_t oldBytes, size_t newBytes)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	size_t reserved = m_reserved - oldBytes + newBytes;
+	if ((newBytes > oldBytes) && (reserved + Strip_Bytes() > m_budget))
+		return false;
+	m_reserved = reserved;
+	Trim();
+	return true;
+}
+
+size_t StripImage::Strip_Bytes() const
+{
+	return (size_t)m_stripRows * m_header.width * 3;
+}
+
+size_t StripImage::Reads()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_reads;
+}
+
+size_t StripImage::Bytes()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_bytes;
+}
+
+void StripImage::Trim()
+{
+	while ((m_bytes + m_reserved > m_budget) && (m_strips.size() > 1))
+	{
+		const ImageStrip &strip = m_strips.back();
+		m_bytes -= strip.rows->total() * strip.rows->elemSize();
+		m_index.erase(strip.firstRow / m_stripRows);
+		m_strips.pop_back();
+	}
+}
+
+ImageStrip StripImage::Strip_For_Row(int row)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	int stripIndex = row / m_stripRows;
+
+	std::unordered_map<int, std::list<ImageStrip>::iterator>::iterator found = m_index.find(stripIndex);
+	if (found != m_index.end())
+	{
+		//most recently used goes to the front
+		m_strips.splice(m_strips.begin(), m_strips, found->second);
+		return m_strips.front();
+	}
+
+	ImageStrip strip;
+	strip.firstRow = stripIndex * m_stripRows;
+	int rowCount = std::min(m_stripRows, (int)m_header.height - strip.firstRow);
+	std::shared_ptr<cv::Mat> rows = std::make_shared<cv::Mat>(rowCount, (int)m_header.width, CV_8UC3);
+
+	m_file.clear();
+	m_file.seekg((std::streamoff)(m_header.dataOffset + (uint64_t)strip.firstRow * m_header.rowBytes));
+	for (int i = 0; i < rowCount; ++i)
+	{
+		if ((i > 0) && (m_header.rowBytes != m_header.width * 3))
+			m_file.seekg(m_header.rowBytes - m_header.width * 3, std::ios::cur);
+		m_file.read((char*)rows->ptr<uchar>(i), m_header.width * 3);
+	}
+	if (!m_file)
+		throw std::runtime_error("raw image strip could not be read");
+	++m_reads;
+
+	strip.rows = rows;
+	m_strips.push_front(strip);
+	m_index[stripIndex] = m_strips.begin();
+	m_bytes += rows->total() * rows->elemSize();
+	Trim();
+	return strip;
+}
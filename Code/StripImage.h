@@ -0,0 +1,66 @@
+#ifndef STRIP_IMAGE_H
+#define STRIP_IMAGE_H
+
+#include <fstream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <opencv2/opencv.hpp>
+#include "RawImage.h"
+
+//rows of one strip, valid for as long as it is held
+struct ImageStrip
+{
+	std::shared_ptr<const cv::Mat> rows;
+	int firstRow = 0;
+
+	bool Contains(int row) const;
+};
+
+//Raw image read from disk a strip of rows at a time, as rows are asked for.
+//Strips are kept in a least recently used cache that is trimmed to the memory budget, a strip held by a
+//caller stays valid after it leaves the cache. The budget holds these rows and the buffers the services streaming
+//the image Reserve out of it, fewer strips are kept as more is reserved. Safe to use from several threads.
+class StripImage
+{
+private:
+	std::ifstream m_file;
+	RawImageHeader m_header;
+	int m_stripRows = 64;
+	size_t m_budget = 256 * 1024 * 1024;
+	size_t m_bytes = 0;
+	//bytes of the budget the services streaming the image hold for their own buffers
+	size_t m_reserved = 0;
+	size_t m_reads = 0;
+	bool m_isOpen = false;
+	std::list<ImageStrip> m_strips;
+	std::unordered_map<int, std::list<ImageStrip>::iterator> m_index;
+	std::mutex m_mutex;
+
+	void Trim();
+	size_t Strip_Bytes() const;
+
+public:
+	bool Open(const std::string &path);
+	void Close();
+	bool Is_Open() const;
+	int Width() const;
+	int Height() const;
+
+	//bytes of strips and reservations kept at once. At least one strip is always kept, so a budget without
+	//room for one next to the reservations is refused
+	bool Set_Budget(size_t bytes);
+	//changes a reservation of the budget from oldBytes to newBytes, fewer strips are then kept.
+	//Growing it fails when the budget would no longer have room for one strip, shrinking it always works
+	bool Reserve(size_t oldBytes, size_t newBytes);
+	//strips read from disk so far
+	size_t Reads();
+	//bytes of the strips loaded now
+	size_t Bytes();
+
+	//the strip holding row, read from disk when it is not cached
+	ImageStrip Strip_For_Row(int row);
+};
+
+#endif
@@ -0,0 +1,144 @@
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+
+ThreadPool::ThreadPool(int threadCount)
+{
+	if (threadCount <= 0)
+		threadCount = (int)std::thread::hardware_concurrency();
+	if (threadCount <= 0)
+		threadCount = 1;
+
+	//the caller of Parallel_For is one of the threads
+	for (int i = 1; i < threadCount; ++i)
+		m_threads.push_back(std::thread(&ThreadPool::Worker_Loop, this));
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_taskAvailable.notify_all();
+	for (size_t i = 0; i < m_threads.size(); ++i)
+		m_threads[i].join();
+}
+
+int ThreadPool::Thread_Count() const
+{
+	return (int)m_threads.size() + 1;
+}
+
+void ThreadPool::Submit(const std::function<void()> &task)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_tasks.push_back(task);
+	}
+	m_taskAvailable.notify_one();
+}
+
+void ThreadPool::Worker_Loop()
+{
+	while (true)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_taskAvailable.wait(lock, [this] { return m_stopping || !m_tasks.empty(); });
+			if (m_tasks.empty())
+				return;
+			task = m_tasks.front();
+			m_tasks.pop_front();
+		}
+		task();
+	}
+}
+
+bool ThreadPool::Run_Pending_Task()
+{
+	std::function<void()> task;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_tasks.empty())
+			return false;
+		task = m_tasks.front();
+		m_tasks.pop_front();
+	}
+	task();
+	return true;
+}
+
+void ThreadPool::Parallel_For(int begin, int end, int minBand, const std::function<void(int, int)> &body)
+{
+	if (end <= begin)
+		return;
+	if (minBand < 1)
+		minBand = 1;
+
+	//a few bands per thread so uneven rows still balance out
+	int bandCount = std::min((end - begin + minBand - 1) / minBand, 4 * Thread_Count());
+	if ((bandCount <= 1) || m_threads.empty())
+	{
+		body(begin, end);
+		return;
+	}
+
+	struct BandState
+	{
+		std::atomic<int> remaining;
+		std::mutex mutex;
+		std::condition_variable done;
+		std::exception_ptr error;
+	};
+	auto state = std::make_shared<BandState>();
+	state->remaining = bandCount;
+
+	auto runBand = [state, &body](int first, int last)
+	{
+		try
+		{
+			body(first, last);
+		}
+		catch (...)
+		{
+			std::lock_guard<std::mutex> lock(state->mutex);
+			if (!state->error)
+				state->error = std::current_exception();
+		}
+		if (--state->remaining == 0)
+		{
+			std::lock_guard<std::mutex> lock(state->mutex);
+			state->done.notify_all();
+		}
+	};
+
+	int length = end - begin;
+	for (int b = 1; b < bandCount; ++b)
+	{
+		int first = begin + (int)((long long)length * b / bandCount);
+		int last = begin + (int)((long long)length * (b + 1) / bandCount);
+		Submit([runBand, first, last] { runBand(first, last); });
+	}
+	runBand(begin, begin + (int)((long long)length / bandCount));
+
+	//help with queued work instead of idling, this also keeps nested calls from deadlocking
+	while (state->remaining > 0)
+	{
+		if (Run_Pending_Task())
+			continue;
+		std::unique_lock<std::mutex> lock(state->mutex);
+		state->done.wait(lock, [&state] { return state->remaining == 0; });
+	}
+
+	if (state->error)
+		std::rethrow_exception(state->error);
+}
+
+ThreadPool& ThreadPool::Shared()
+{
+	static ThreadPool pool(0);
+	return pool;
+}
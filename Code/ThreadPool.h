@@ -0,0 +1,49 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Fixed set of worker threads running queued tasks.
+//Parallel_For splits a range of rows into bands and blocks until every band is done; the calling
+//thread runs bands too and is counted as one of the threads, so a pool of N threads starts N - 1 workers,
+//keeps N cores busy and nested calls cannot deadlock.
+//Bands are fixed by the range, not by which thread picks them up, so results are deterministic.
+class ThreadPool
+{
+private:
+	std::vector<std::thread> m_threads;
+	std::deque<std::function<void()>> m_tasks;
+	std::mutex m_mutex;
+	std::condition_variable m_taskAvailable;
+	bool m_stopping = false;
+
+	void Worker_Loop();
+	bool Run_Pending_Task();
+
+public:
+	//threadCount <= 0 uses one thread per core, 1 runs everything on the calling thread
+	explicit ThreadPool(int threadCount);
+	~ThreadPool();
+
+	int Thread_Count() const;
+	void Submit(const std::function<void()> &task);
+
+	//body(first, last) is called for bands covering [begin, end), each at least minBand long
+	void Parallel_For(int begin, int end, int minBand, const std::function<void(int, int)> &body);
+	//takes the band closure by reference, a std::function holding a reference does not allocate
+	template <typename Body>
+	void Parallel_For(int begin, int end, int minBand, const Body &body)
+	{
+		Parallel_For(begin, end, minBand, std::function<void(int, int)>(std::cref(body)));
+	}
+
+	//process wide pool with one thread per core, shared by every service that does not set its own
+	static ThreadPool& Shared();
+};
+
+#endif